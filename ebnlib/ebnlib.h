@@ -10,9 +10,25 @@
 #include <netdb.h>
 #include <time.h>
 
+/* Maximum number of file descriptors passed in one message */
+#define CONNECTION_MAX_FDS 16
+/* Identifies the messages of connection_export() */
+#define CONNECTION_EXPORT_MAGIC 0x45424e58
+/* Record encryption offloaded to the kernel (connection_tls_offload) */
+#define CONNECTION_TLS_TX 0x1
+#define CONNECTION_TLS_RX 0x2
+/* Kernel software timestamps (connection_attr_t::timestamping) */
+#define CONNECTION_TIMESTAMP_RX 0x1
+#define CONNECTION_TIMESTAMP_TX_SCHED 0x2
+#define CONNECTION_TIMESTAMP_TX_SEND 0x4
+#define CONNECTION_TIMESTAMP_TX_ACK 0x8
+#define CONNECTION_TIMESTAMP_TX (CONNECTION_TIMESTAMP_TX_SCHED | \
+                                 CONNECTION_TIMESTAMP_TX_SEND | CONNECTION_TIMESTAMP_TX_ACK)
+
 typedef uintptr_t network_t;
 typedef uintptr_t connection_t;
 typedef uintptr_t network_timer_t;
+typedef uintptr_t network_buffer_t;
 
 typedef enum {
     connection_mode_client = 1,
@@ -29,7 +45,16 @@ typedef enum {
     connection_event_connection_created = 2,
     connection_event_connection_accepted = 3,
     connection_event_connection_closed = 4,
-    connection_event_connection_error = 5
+    connection_event_connection_error = 5,
+    connection_event_connection_migrated = 6,
+    connection_event_accept_paused = 7,
+    connection_event_accept_resumed = 8,
+    connection_event_connection_rejected = 9,
+    connection_event_connection_draining = 10,
+    connection_event_connection_writable = 11,
+    connection_event_tx_timestamp = 12,
+    connection_event_connection_dropped = 13,
+    connection_event_work_completed = 14
 } connection_event_e;
 
 typedef enum {
@@ -38,6 +63,23 @@ typedef enum {
     network_timer_type_absolute = 3
 } network_timer_type_e;
 
+/* Order in which the ready connections of a wakeup are served */
+typedef enum {
+    connection_priority_normal = 0,
+    connection_priority_high = 1,
+    connection_priority_low = 2
+} connection_priority_e;
+
+#define CONNECTION_PRIORITIES 3
+
+/* What happens to a connection whose send queue outgrows its backlog */
+typedef enum {
+    /* Closed; raises connection_dropped */
+    connection_backlog_drop = 1,
+    /* The queued buffers not yet started give way to the new ones */
+    connection_backlog_conflate = 2
+} connection_backlog_e;
+
 typedef union {
 	void *ptr;
 	uint32_t u32;
@@ -52,6 +94,42 @@ struct connection_event_t {
 	void *data_buffer;
 	size_t data_len;
 	user_data_t user_data;
+	/* Message header with ancillary data (AF_UNIX, SOCK_SEQPACKET and
+	 * connections receiving timestamps) */
+	struct msghdr *msg;
+	/* Kernel time the data arrived (data_received) or left a stage of
+	 * the transmit path (tx_timestamp); zero when not taken, e.g. for data
+	 * arriving just after the first socket of the host enabled them */
+	struct timespec timestamp;
+	/* tx_timestamp: the stage (SCM_TSTAMP_SCHED, _SND or _ACK) and the
+	 * byte offset (STREAM) or message count of the send it belongs to */
+	uint32_t timestamp_type;
+	uint32_t timestamp_key;
+	/* data_received: buffer holding data_buffer (0 = no buffer pool);
+	 * work_completed: the result (0 = none). Released after the callback
+	 * unless referenced */
+	network_buffer_t buffer;
+};
+
+typedef void (*connection_event_cb_t)(connection_t connection,
+                                     const struct connection_event_t *event,
+                                     user_data_t user_data);
+
+/* Functions for the events of one connection; NULL entries and the other
+ * events go to the network callback. Called with the context instead of
+ * the network user data. */
+struct connection_handlers_t {
+	connection_event_cb_t on_data;
+	connection_event_cb_t on_accept;
+	connection_event_cb_t on_close;
+	connection_event_cb_t on_error;
+	connection_event_cb_t on_created;
+	user_data_t context;
+};
+
+struct connection_export_t {
+	uint32_t magic;
+	uint32_t num_fds;
 };
 
 struct network_timer_event_t {
@@ -61,6 +139,41 @@ struct network_timer_event_t {
 	user_data_t user_data;
 };
 
+struct connection_rate_limit_t {
+	/* Sustained rates (0 = unlimited) */
+	uint64_t bytes_per_sec;
+	uint64_t messages_per_sec;
+	/* Bucket sizes (0 = one second of the rate) */
+	uint64_t bytes_burst;
+	uint64_t messages_burst;
+};
+
+struct connection_sockopts_t {
+	/* Listener: Fast Open queue length (0 = off) */
+	uint32_t fastopen;
+	/* Listener: seconds to wait for data before accepting (0 = off) */
+	uint32_t defer_accept;
+	/* Socket buffer sizes in bytes (0 = system default) */
+	uint32_t rcvbuf;
+	uint32_t sndbuf;
+	/* IP_TOS or IPV6_TCLASS (0 = system default) */
+	uint8_t tos;
+	uint8_t nodelay;
+};
+
+struct connection_backlog_t {
+	/* Bytes queued by buffer sends and broadcasts (0 = unlimited) */
+	size_t max_bytes;
+	connection_backlog_e policy;
+};
+
+struct connection_ring_t {
+	/* Receive ring in bytes, rounded up to pages (0 = the network buffer) */
+	size_t size;
+	/* Back the ring with huge pages when the system has them reserved */
+	uint8_t hugepages;
+};
+
 struct connection_attr_t {
 	network_t *network;
 	struct addrinfo hints;
@@ -70,6 +183,39 @@ struct connection_attr_t {
 	socklen_t src_addrlen;
 	struct sockaddr *src_addr;
 	user_data_t user_data;
+	/* Ingress limits; inherited by accepted connections */
+	struct connection_rate_limit_t rate_limit;
+	/* Accepted connections open at once (0 = unlimited) */
+	uint32_t max_connections;
+	/* Accepting resumes at this count (0 = below the maximum) */
+	uint32_t resume_connections;
+	/* OpenSSL SSL_CTX securing STREAM connections (NULL = plaintext);
+	 * inherited by accepted connections and owned by the caller */
+	void *tls_context;
+	/* Applied before bind or connect; inherited by accepted connections */
+	struct connection_sockopts_t sockopts;
+	/* Event handlers (NULL = network callback); inherited by accepted
+	 * connections and must outlive the connection */
+	const struct connection_handlers_t *handlers;
+	/* SOCK_STREAM only: unread data stays contiguous in the ring until
+	 * consumed; inherited by accepted connections */
+	struct connection_ring_t ring;
+	/* Served before lower classes each wakeup; inherited by accepted connections */
+	connection_priority_e priority;
+	/* CONNECTION_TIMESTAMP_* flags (not with TLS); inherited by accepted
+	 * connections */
+	uint32_t timestamping;
+	/* Limit of the send queue of a slow reader; inherited by accepted
+	 * connections */
+	struct connection_backlog_t backlog;
+	/* UDP listener: each new peer gets a connected socket bound to the same
+	 * address, raised as connection_accepted with its first datagram next;
+	 * the kernel then delivers the datagrams of the peer to that socket */
+	uint8_t udp_flows;
+	/* Stream sockets: sends from the callbacks are staged and written with
+	 * one sendmsg() at the end of the loop iteration, before the loop waits
+	 * again; inherited by accepted connections */
+	uint8_t auto_cork;
 };
 
 struct network_timer_attr_t {
@@ -78,6 +224,99 @@ struct network_timer_attr_t {
 	user_data_t user_data;
 };
 
+/* Callback that ran longer than the watchdog threshold; raised on the
+ * watchdog thread while the callback is still running */
+struct network_watchdog_event_t {
+	/* connection_t or network_timer_t */
+	uintptr_t handle;
+	/* connection_event_e, or 0 for a timer */
+	uint32_t event_type;
+	struct timespec elapsed;
+	/* Return addresses of the loop thread (NULL = not captured) */
+	void *const *backtrace;
+	int32_t backtrace_len;
+};
+
+struct network_watchdog_attr_t {
+	/* Longest callback tolerated (0 = no watchdog) */
+	struct timespec threshold;
+	/* Signal interrupting the loop thread for a backtrace (0 = none); must be
+	 * otherwise unused, and cuts short sleeps of the stalled callback */
+	int32_t backtrace_signal;
+	/* Called once per stall (NULL = written to stderr) */
+	void (*watchdog_cb)(network_t network,
+	                    const struct network_watchdog_event_t *event,
+	                    user_data_t network_user_data);
+};
+
+struct network_buffer_pool_attr_t {
+	/* Buffers received into, each of buffer_size bytes (0 = none) */
+	uint32_t num_buffers;
+	size_t buffer_size;
+};
+
+/* Request run on a worker thread */
+struct network_work_t {
+	/* Identifies the connection; not to be used from the worker */
+	connection_t connection;
+	user_data_t user_data;
+	/* The buffer handed off */
+	const void *data;
+	size_t data_len;
+	/* Set by the callback, e.g. with network_buffer_create(); raised on the
+	 * loop as work_completed after the earlier results of the connection */
+	network_buffer_t result;
+};
+
+struct network_offload_attr_t {
+	/* Worker threads (0 = none); requires PTHREAD */
+	uint32_t num_workers;
+	/* Requests in flight per worker, rounded up to a power of two (0 = 256) */
+	uint32_t queue_len;
+	void (*work_cb)(network_t network, struct network_work_t *work,
+	                user_data_t network_user_data);
+};
+
+struct network_client_pool_attr_t {
+	/* Idle connections kept; the least recently used is closed first (0 = none) */
+	uint32_t max_idle;
+	/* Idle connections are closed after this long (0 = until evicted) */
+	struct timespec idle_timeout;
+};
+
+struct network_tcp_info_attr_t {
+	/* Between two rounds of TCP_INFO sampling (0 = no sampler) */
+	struct timespec interval;
+	/* Connections sampled per round, continuing where the previous round
+	 * stopped (0 = all) */
+	uint32_t budget;
+};
+
+/* Latest TCP_INFO sample of a connection */
+struct connection_info_t {
+	/* CLOCK_MONOTONIC time of the sample in nanoseconds */
+	uint64_t sampled_at;
+	/* Smoothed round-trip time and its variation in microseconds */
+	uint32_t rtt_us;
+	uint32_t rttvar_us;
+	/* Congestion window in segments */
+	uint32_t snd_cwnd;
+	/* Segments sent and not acknowledged, and those of them presumed lost */
+	uint32_t unacked;
+	uint32_t lost;
+	/* Segments retransmitted over the life of the connection */
+	uint32_t total_retrans;
+};
+
+/* Aggregates over the latest samples of the connections of a network */
+struct network_info_t {
+	uint32_t num_sampled;
+	uint32_t rtt_avg_us;
+	uint64_t unacked;
+	uint64_t lost;
+	uint64_t total_retrans;
+};
+
 struct network_attr_t {
 	void (*connection_event_cb)(connection_t connection,
 	                            const struct connection_event_t *event,
@@ -89,6 +328,32 @@ struct network_attr_t {
 	void *data_buffer;
 	size_t buffer_len;
 	user_data_t user_data;
+	/* Maximum number of events per wakeup (0 = SOMAXCONN) */
+	uint32_t max_events;
+	/* Lower bound of the adaptive event batch (0 = default) */
+	uint32_t min_events;
+	/* Resize the event batch between min_events and max_events */
+	uint8_t adaptive_events;
+	/* Accepted connections served by the network at once, migrated ones
+	 * included (0 = unlimited) */
+	uint32_t max_connections;
+	/* Accepting resumes at this count (0 = below the maximum) */
+	uint32_t resume_connections;
+	/* Reads per wakeup for a connection of each priority (0 = default: high
+	 * until drained, normal 16, low 4; UINT32_MAX = until drained); the rest
+	 * waits for the next wakeup, after the higher classes */
+	uint32_t priority_reads[CONNECTION_PRIORITIES];
+	/* Reports callbacks stalling the event loop; requires PTHREAD */
+	struct network_watchdog_attr_t watchdog;
+	/* Data is received into pool buffers that callbacks may keep and pass
+	 * on to connection_send_buffers(); the heap serves when exhausted */
+	struct network_buffer_pool_attr_t buffer_pool;
+	/* Keeps the client connections of connection_pool_release() for reuse */
+	struct network_client_pool_attr_t client_pool;
+	/* Workers running the requests of connection_offload() */
+	struct network_offload_attr_t offload;
+	/* Samples TCP_INFO of the TCP connections from the loop */
+	struct network_tcp_info_attr_t tcp_info;
 };
 
 #ifdef __cplusplus
@@ -100,15 +365,81 @@ int32_t network_create(network_t *network, const struct network_attr_t *attr);
 int32_t network_free(network_t network);
 int32_t network_start(network_t network);
 int32_t network_stop(network_t network);
+int32_t network_drain(network_t network, const struct timespec *timeout);
+int32_t network_rebalance(const network_t *networks, size_t num_networks,
+                          size_t max_connections);
 
 /* Connection interface */
 int32_t connection_create(connection_t *connection, const struct connection_attr_t *attr);
+int32_t connection_create_send(connection_t *connection, const struct connection_attr_t *attr,
+                               const void *data, size_t len);
+int32_t connection_adopt(connection_t *connection, const struct connection_attr_t *attr,
+                         int32_t socket_fd);
+ssize_t connection_export(connection_t channel, const connection_t *connections,
+                          size_t num_connections);
+ssize_t connection_import(const struct connection_event_t *event,
+                          const struct connection_attr_t *attr,
+                          connection_t *connections, size_t max_connections);
 int32_t connection_free(connection_t connection);
+/* Queued data is written first. On the loop of the connection the socket
+ * stays open until it is, with nothing reported; elsewhere the rest is
+ * dropped and -1 returned with ENOBUFS once the socket is closed */
 int32_t connection_close(connection_t connection);
+int32_t connection_migrate(connection_t connection, network_t network);
+int32_t connection_set_user_data(connection_t connection, user_data_t user_data);
+int32_t connection_set_handlers(connection_t connection,
+                                const struct connection_handlers_t *handlers);
+int32_t connection_want_write(connection_t connection);
+int32_t connection_consume(connection_t connection, size_t len);
+int32_t connection_set_priority(connection_t connection, connection_priority_e priority);
+int32_t connection_shutdown(connection_t connection, int32_t how);
 ssize_t connection_sendmsg(connection_t connection, const struct msghdr *msg);
 ssize_t connection_send(connection_t connection, const void *data, size_t len);
 ssize_t connection_sendto(connection_t connection, const void *data, size_t len,
                           const struct sockaddr *dest_addr, socklen_t addrlen);
+ssize_t connection_send_fds(connection_t connection, const void *data, size_t len,
+                            const int32_t *fds, size_t num_fds);
+/* Descriptors passed with data_received; those not taken in the callback
+ * are closed once it returns */
+size_t connection_event_fds(const struct connection_event_t *event,
+                            int32_t *fds, size_t max_fds);
+ssize_t connection_sendfile(connection_t connection, int32_t fd, off_t *offset, size_t count);
+int32_t connection_tls_offload(connection_t connection);
+/* Queued behind buffers not yet sent; call from the loop of the connection.
+ * The other sends fail with EAGAIN while buffers are queued; a writable
+ * event requested with connection_want_write() follows the last of them */
+int32_t connection_send_buffers(connection_t connection, const network_buffer_t *buffers,
+                                size_t num_buffers);
+
+/* Queues one buffer to each connection, written together at the end of the
+ * loop iteration; for connections of the calling loop */
+int32_t connection_broadcast(const connection_t *connections, size_t num_connections,
+                             network_buffer_t buffer);
+
+/* Hands a buffer to the worker of the connection, referenced until the
+ * work is done; call from the loop of the connection. Fails with EAGAIN
+ * while the queue of the worker is full */
+int32_t connection_offload(connection_t connection, network_buffer_t buffer);
+
+/* Client pool; call from the loop of the network. Acquire returns 1 with an
+ * idle connection ready to send, or 0 with a new one raising connection_created */
+int32_t connection_pool_acquire(connection_t *connection, const struct connection_attr_t *attr);
+
+/* Hands an established connection back for reuse; the pool owns it from then
+ * on and closes it on data, a close by the peer, or idle timeout */
+int32_t connection_pool_release(connection_t connection);
+
+/* TCP_INFO telemetry of the sampler. A connection without a sample yet is
+ * sampled on the call; the network sums the latest samples */
+int32_t connection_get_info(connection_t connection, struct connection_info_t *info);
+int32_t network_get_info(network_t network, struct network_info_t *info);
+
+/* Buffer interface; references may be taken and dropped from any thread */
+int32_t network_buffer_create(network_t network, const void *data, size_t len,
+                              network_buffer_t *buffer);
+int32_t network_buffer_ref(network_buffer_t buffer);
+int32_t network_buffer_unref(network_buffer_t buffer);
+const void *network_buffer_data(network_buffer_t buffer, size_t *len);
 
 /* Timer interface */
 int32_t network_timer_create(network_timer_t *timer, const struct network_timer_attr_t *attr);
@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2015 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#ifndef _EBNLIB_HPP
+#define _EBNLIB_HPP
+
+#include "ebnlib.h"
+
+#include <cerrno>
+#include <system_error>
+
+namespace ebnlib {
+
+namespace detail {
+
+inline void throw_error(const char *what)
+{
+	throw std::system_error(errno != 0 ? errno : EINVAL, std::system_category(), what);
+}
+
+} /* namespace detail */
+
+/* Connection passed to the handlers; does not own it */
+class connection_ref {
+public:
+	connection_ref(connection_t handle = 0) noexcept : handle_(handle) {}
+
+	connection_t get() const noexcept { return handle_; }
+	explicit operator bool() const noexcept { return handle_ != 0; }
+	bool operator==(const connection_ref &other) const noexcept { return handle_ == other.handle_; }
+	bool operator!=(const connection_ref &other) const noexcept { return handle_ != other.handle_; }
+
+	ssize_t send(const void *data, size_t len) const
+	{
+		return connection_send(handle_, data, len);
+	}
+
+	ssize_t sendto(const void *data, size_t len, const struct sockaddr *addr, socklen_t addr_len) const
+	{
+		return connection_sendto(handle_, data, len, addr, addr_len);
+	}
+
+	ssize_t sendmsg(const struct msghdr *msg) const
+	{
+		return connection_sendmsg(handle_, msg);
+	}
+
+	ssize_t sendfile(int32_t fd, off_t *offset, size_t count) const
+	{
+		return connection_sendfile(handle_, fd, offset, count);
+	}
+
+	/* Sends received buffers without a copy; they are referenced until sent */
+	int32_t send_buffers(const network_buffer_t *buffers, size_t num_buffers) const
+	{
+		return connection_send_buffers(handle_, buffers, num_buffers);
+	}
+
+	/* Runs the work callback on a worker; the result comes to on_work() */
+	int32_t offload(network_buffer_t buffer) const
+	{
+		return connection_offload(handle_, buffer);
+	}
+
+	int32_t migrate(network_t network) const
+	{
+		return connection_migrate(handle_, network);
+	}
+
+	/* Latest TCP_INFO sample of the sampler */
+	int32_t get_info(struct connection_info_t &info) const
+	{
+		return connection_get_info(handle_, &info);
+	}
+
+	/* Raises on_writable() once the socket accepts data again */
+	int32_t want_write() const
+	{
+		return connection_want_write(handle_);
+	}
+
+	/* Releases data from the front of the receive ring */
+	int32_t consume(size_t len) const
+	{
+		return connection_consume(handle_, len);
+	}
+
+	int32_t shutdown(int32_t how) const
+	{
+		return connection_shutdown(handle_, how);
+	}
+
+	int32_t close() const
+	{
+		return connection_close(handle_);
+	}
+
+protected:
+	connection_t handle_;
+};
+
+/* Owns a connection; closes and frees it when destroyed */
+class connection : public connection_ref {
+public:
+	connection() noexcept {}
+
+	/* Takes over a handle, e.g. the new connection of on_accept() */
+	explicit connection(connection_t handle) noexcept : connection_ref(handle) {}
+
+	connection(network_t network, connection_attr_t attr)
+	{
+		attr.network = &network;
+
+		if (connection_create(&handle_, &attr) == -1) {
+			detail::throw_error("connection_create()");
+		}
+	}
+
+	/* Connects and sends the first payload (TCP Fast Open) */
+	connection(network_t network, connection_attr_t attr, const void *data, size_t len)
+	{
+		attr.network = &network;
+
+		if (connection_create_send(&handle_, &attr, data, len) == -1) {
+			detail::throw_error("connection_create_send()");
+		}
+	}
+
+	connection(connection &&other) noexcept : connection_ref(other.release()) {}
+
+	connection &operator=(connection &&other) noexcept
+	{
+		if (this != &other) {
+			reset(other.release());
+		}
+
+		return *this;
+	}
+
+	connection(const connection &) = delete;
+	connection &operator=(const connection &) = delete;
+
+	~connection() { reset(); }
+
+	void reset(connection_t handle = 0) noexcept
+	{
+		if (handle_ != 0) {
+			connection_close(handle_);
+			connection_free(handle_);
+		}
+
+		handle_ = handle;
+	}
+
+	connection_t release() noexcept
+	{
+		connection_t handle = handle_;
+		handle_ = 0;
+		return handle;
+	}
+};
+
+/* Timer passed to the handlers; does not own it */
+class timer_ref {
+public:
+	timer_ref(network_timer_t handle = 0) noexcept : handle_(handle) {}
+
+	network_timer_t get() const noexcept { return handle_; }
+	explicit operator bool() const noexcept { return handle_ != 0; }
+
+	int32_t start(const struct timespec &value) const
+	{
+		return network_timer_start(handle_, &value);
+	}
+
+	int32_t cancel() const
+	{
+		return network_timer_cancel(handle_);
+	}
+
+protected:
+	network_timer_t handle_;
+};
+
+/* Owns a timer; frees it when destroyed */
+class timer : public timer_ref {
+public:
+	timer(network_t network, network_timer_type_e type, user_data_t user_data = user_data_t())
+	{
+		struct network_timer_attr_t attr = {&network, type, user_data};
+
+		if (network_timer_create(&handle_, &attr) == -1) {
+			detail::throw_error("network_timer_create()");
+		}
+	}
+
+	timer(const timer &) = delete;
+	timer &operator=(const timer &) = delete;
+
+	~timer() { network_timer_free(handle_); }
+};
+
+/* Handlers derive from this and hide the events they handle */
+struct handler {
+	void on_data(connection_ref, const struct connection_event_t &) {}
+	void on_connect(connection_ref, const struct connection_event_t &) {}
+	void on_accept(connection_ref, const struct connection_event_t &) {}
+	void on_close(connection_ref, const struct connection_event_t &) {}
+	void on_error(connection_ref, const struct connection_event_t &) {}
+	void on_migrate(connection_ref, const struct connection_event_t &) {}
+	void on_accept_paused(connection_ref, const struct connection_event_t &) {}
+	void on_accept_resumed(connection_ref, const struct connection_event_t &) {}
+	void on_reject(connection_ref, const struct connection_event_t &) {}
+	void on_drain(connection_ref, const struct connection_event_t &) {}
+	void on_writable(connection_ref, const struct connection_event_t &) {}
+	void on_timestamp(connection_ref, const struct connection_event_t &) {}
+	void on_dropped(connection_ref, const struct connection_event_t &) {}
+	void on_work(connection_ref, const struct connection_event_t &) {}
+	void on_timer(timer_ref, const struct network_timer_event_t &) {}
+};
+
+/* Network delivering its events to a handler of type Handler */
+template <class Handler>
+class network {
+public:
+	network(Handler &handler, struct network_attr_t attr) : handle_(0), mode_(attr.mode), running_(false)
+	{
+		attr.connection_event_cb = &network::dispatch;
+		attr.timer_event_cb = &network::dispatch_timer;
+		attr.user_data.ptr = &handler;
+
+		if (network_create(&handle_, &attr) == -1) {
+			detail::throw_error("network_create()");
+		}
+	}
+
+	network(const network &) = delete;
+	network &operator=(const network &) = delete;
+
+	~network()
+	{
+		if (running_) {
+			network_stop(handle_);
+		}
+
+		network_free(handle_);
+	}
+
+	network_t get() const noexcept { return handle_; }
+
+	int32_t get_info(struct network_info_t &info) const
+	{
+		return network_get_info(handle_, &info);
+	}
+
+	/* Blocks in the main loop mode */
+	int32_t start()
+	{
+		int32_t s = network_start(handle_);
+		running_ = s == 0 && mode_ == network_mode_thread;
+		return s;
+	}
+
+	int32_t stop()
+	{
+		running_ = false;
+		return network_stop(handle_);
+	}
+
+	int32_t drain(const struct timespec *timeout)
+	{
+		running_ = false;
+		return network_drain(handle_, timeout);
+	}
+
+	/* The only indirect call; the handler methods are bound at compile time */
+	static void dispatch(connection_t handle, const struct connection_event_t *event,
+	                     user_data_t user_data)
+	{
+		Handler &handler = *static_cast<Handler *>(user_data.ptr);
+		connection_ref connection(handle);
+
+		switch (event->event_type) {
+			case connection_event_data_received:
+				handler.on_data(connection, *event);
+				break;
+
+			case connection_event_connection_created:
+				handler.on_connect(connection, *event);
+				break;
+
+			case connection_event_connection_accepted:
+				handler.on_accept(connection, *event);
+				break;
+
+			case connection_event_connection_closed:
+				handler.on_close(connection, *event);
+				break;
+
+			case connection_event_connection_error:
+				handler.on_error(connection, *event);
+				break;
+
+			case connection_event_connection_migrated:
+				handler.on_migrate(connection, *event);
+				break;
+
+			case connection_event_accept_paused:
+				handler.on_accept_paused(connection, *event);
+				break;
+
+			case connection_event_accept_resumed:
+				handler.on_accept_resumed(connection, *event);
+				break;
+
+			case connection_event_connection_rejected:
+				handler.on_reject(connection, *event);
+				break;
+
+			case connection_event_connection_draining:
+				handler.on_drain(connection, *event);
+				break;
+
+			case connection_event_connection_writable:
+				handler.on_writable(connection, *event);
+				break;
+
+			case connection_event_tx_timestamp:
+				handler.on_timestamp(connection, *event);
+				break;
+
+			case connection_event_connection_dropped:
+				handler.on_dropped(connection, *event);
+				break;
+
+			case connection_event_work_completed:
+				handler.on_work(connection, *event);
+				break;
+		}
+	}
+
+	static void dispatch_timer(network_timer_t handle, const struct network_timer_event_t *event,
+	                           user_data_t user_data)
+	{
+		static_cast<Handler *>(user_data.ptr)->on_timer(timer_ref(handle), *event);
+	}
+
+private:
+	network_t handle_;
+	network_mode_e mode_;
+	bool running_;
+};
+
+} /* namespace ebnlib */
+
+#endif /* _EBNLIB_HPP */
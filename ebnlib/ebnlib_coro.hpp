@@ -0,0 +1,637 @@
+/*
+ * Copyright (c) 2015 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#ifndef _EBNLIB_CORO_HPP
+#define _EBNLIB_CORO_HPP
+
+#if __cplusplus < 202002L
+#error "ebnlib_coro.hpp requires C++20"
+#endif
+
+#include "ebnlib.hpp"
+
+#include <chrono>
+#include <coroutine>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/*
+ * Coroutines are resumed from the callbacks of network_eventloop() and
+ * run on the loop thread. Start them from a callback or before
+ * network_start(), and keep a stream, listener or timer alive while a
+ * coroutine awaits it.
+ */
+namespace ebnlib::co {
+
+class stream;
+class listener;
+class timer;
+
+namespace detail {
+
+/* Recycles coroutine frames by size class; one pool per thread */
+class frame_pool {
+public:
+	static frame_pool &local()
+	{
+		thread_local frame_pool pool;
+		return pool;
+	}
+
+	frame_pool() = default;
+	frame_pool(const frame_pool &) = delete;
+	frame_pool &operator=(const frame_pool &) = delete;
+
+	~frame_pool()
+	{
+		for (block *&head : free_) {
+			while (head != nullptr) {
+				block *next = head->next;
+				::operator delete(head);
+				head = next;
+			}
+		}
+	}
+
+	void *allocate(std::size_t size)
+	{
+		std::size_t index = (size + granularity - 1) / granularity;
+
+		if (index >= num_classes) {
+			return ::operator new(size);
+		}
+
+		if (free_[index] != nullptr) {
+			block *ptr = free_[index];
+			free_[index] = ptr->next;
+			return ptr;
+		}
+
+		return ::operator new(index * granularity);
+	}
+
+	void deallocate(void *ptr, std::size_t size) noexcept
+	{
+		std::size_t index = (size + granularity - 1) / granularity;
+
+		if (index >= num_classes) {
+			::operator delete(ptr);
+			return;
+		}
+
+		block *head = static_cast<block *>(ptr);
+		head->next = free_[index];
+		free_[index] = head;
+	}
+
+private:
+	struct block {
+		block *next;
+	};
+
+	/* Frames up to 4 KB are recycled */
+	static constexpr std::size_t granularity = 64;
+	static constexpr std::size_t num_classes = 64;
+	block *free_[num_classes] = {};
+};
+
+/* Common base of the objects events are routed to through user_data */
+struct endpoint {
+	bool is_listener;
+};
+
+inline user_data_t user_data_of(endpoint *ptr) noexcept
+{
+	user_data_t user_data;
+	user_data.ptr = ptr;
+	return user_data;
+}
+
+inline void resume(std::coroutine_handle<> &waiter)
+{
+	std::coroutine_handle<> handle = std::exchange(waiter, nullptr);
+
+	if (handle) {
+		handle.resume();
+	}
+}
+
+struct handler;
+
+} /* namespace detail */
+
+/* Coroutine started eagerly and destroyed when it returns */
+class task {
+public:
+	struct promise_type {
+		task get_return_object() noexcept { return task(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+
+		static void *operator new(std::size_t size)
+		{
+			return detail::frame_pool::local().allocate(size);
+		}
+
+		static void operator delete(void *ptr, std::size_t size) noexcept
+		{
+			detail::frame_pool::local().deallocate(ptr, size);
+		}
+	};
+};
+
+/* Byte stream over a connection-oriented connection */
+class stream : public detail::endpoint {
+public:
+	/* Takes over an accepted connection */
+	explicit stream(connection_t handle) : detail::endpoint{false}, connection_(handle), connected_(true)
+	{
+		connection_set_user_data(handle, detail::user_data_of(this));
+	}
+
+	/* Connects to a server; await connect() before writing */
+	stream(network_t network, connection_attr_t attr) : detail::endpoint{false}
+	{
+		/* Routed to this stream from the first event on */
+		attr.user_data = detail::user_data_of(this);
+		connection_ = ebnlib::connection(network, attr);
+	}
+
+	stream(const stream &) = delete;
+	stream &operator=(const stream &) = delete;
+
+	~stream()
+	{
+		if (closed_ || !connection_) {
+			return;
+		}
+
+		/* This may run in a callback of the connection itself; the loop
+		 * frees it on the event raised by the shutdown */
+		connection_set_user_data(connection_.get(), user_data_t());
+
+		/* With data queued, closing lingers and the loop frees it once
+		 * written; otherwise the next event of the orphan ends it */
+		if (connection_.shutdown(SHUT_RDWR) == 0 || errno != EAGAIN) {
+			connection_.release();
+		}
+	}
+
+	/* Recycled like coroutine frames; accepting allocates nothing once warm */
+	static void *operator new(std::size_t size)
+	{
+		return detail::frame_pool::local().allocate(size);
+	}
+
+	static void operator delete(void *ptr, std::size_t size) noexcept
+	{
+		detail::frame_pool::local().deallocate(ptr, size);
+	}
+
+	connection_ref get() const noexcept { return connection_; }
+
+	/* Resumes with true once connected */
+	auto connect() noexcept
+	{
+		struct awaiter {
+			stream &self;
+
+			bool await_ready() const noexcept { return self.connected_ || self.closed_; }
+			void await_suspend(std::coroutine_handle<> handle) noexcept { self.connector_ = handle; }
+			bool await_resume() const noexcept { return self.connected_ && !self.closed_; }
+		};
+
+		return awaiter{*this};
+	}
+
+	/* Resumes with the number of bytes read, 0 at the end of the stream or -1 on error */
+	auto read_some(void *buffer, std::size_t len) noexcept
+	{
+		struct awaiter {
+			stream &self;
+			void *buffer;
+			std::size_t len;
+
+			bool await_ready() const noexcept
+			{
+				return self.offset_ < self.pending_.size() || self.closed_;
+			}
+
+			void await_suspend(std::coroutine_handle<> handle) noexcept
+			{
+				self.reader_ = handle;
+				self.read_buffer_ = buffer;
+				self.read_len_ = len;
+			}
+
+			ssize_t await_resume() noexcept
+			{
+				return self.take(buffer, len);
+			}
+		};
+
+		return awaiter{*this, buffer, len};
+	}
+
+	/* Resumes once all is sent, with the length or -1 on error */
+	auto write_all(const void *data, std::size_t len) noexcept
+	{
+		struct awaiter {
+			stream &self;
+			const void *data;
+			std::size_t len;
+
+			bool await_ready() noexcept
+			{
+				self.write_data_ = static_cast<const uint8_t *>(data);
+				self.write_len_ = len;
+				self.written_ = 0;
+				self.write_failed_ = false;
+				return self.flush();
+			}
+
+			void await_suspend(std::coroutine_handle<> handle) noexcept { self.writer_ = handle; }
+			ssize_t await_resume() const noexcept
+			{
+				return self.write_failed_ ? -1 : static_cast<ssize_t>(self.written_);
+			}
+		};
+
+		return awaiter{*this, data, len};
+	}
+
+private:
+	friend struct detail::handler;
+	friend class listener;
+
+	void on_connect()
+	{
+		connected_ = true;
+		detail::resume(connector_);
+	}
+
+	void on_data(const void *data, std::size_t len)
+	{
+		const uint8_t *ptr = static_cast<const uint8_t *>(data);
+
+		/* A waiting reader gets the data without a detour through pending_ */
+		if (reader_ && offset_ == pending_.size()) {
+			std::size_t n = len < read_len_ ? len : read_len_;
+			std::memcpy(read_buffer_, ptr, n);
+			pending_.insert(pending_.end(), ptr + n, ptr + len);
+			read_result_ = static_cast<ssize_t>(n);
+			detail::resume(reader_);
+			return;
+		}
+
+		pending_.insert(pending_.end(), ptr, ptr + len);
+		detail::resume(reader_);
+	}
+
+	void on_writable()
+	{
+		if (writer_ && flush()) {
+			detail::resume(writer_);
+		}
+	}
+
+	void on_close(bool error)
+	{
+		std::coroutine_handle<> connector = std::exchange(connector_, nullptr);
+		std::coroutine_handle<> reader = std::exchange(reader_, nullptr);
+		std::coroutine_handle<> writer = std::exchange(writer_, nullptr);
+		closed_ = true;
+		error_ = error;
+		write_failed_ = writer ? true : write_failed_;
+
+		if (connector) {
+			connector.resume();
+		}
+
+		if (reader) {
+			reader.resume();
+		}
+
+		if (writer) {
+			writer.resume();
+		}
+	}
+
+	ssize_t take(void *buffer, std::size_t len) noexcept
+	{
+		std::size_t n = pending_.size() - offset_;
+
+		if (read_result_ >= 0) {
+			return std::exchange(read_result_, -1);
+		}
+
+		if (n == 0) {
+			return closed_ && !error_ ? 0 : -1;
+		}
+
+		n = n < len ? n : len;
+		std::memcpy(buffer, pending_.data() + offset_, n);
+		offset_ += n;
+
+		if (offset_ == pending_.size()) {
+			/* Keeps the capacity; no allocation once warmed up */
+			pending_.clear();
+			offset_ = 0;
+		}
+
+		return static_cast<ssize_t>(n);
+	}
+
+	/* True when done or failed */
+	bool flush() noexcept
+	{
+		if (closed_) {
+			write_failed_ = true;
+			return true;
+		}
+
+		while (written_ < write_len_) {
+			ssize_t n = connection_.send(write_data_ + written_, write_len_ - written_);
+
+			if (n > 0) {
+				written_ += static_cast<std::size_t>(n);
+				continue;
+			}
+
+			/* The loop raises on_writable() when there is room again */
+			if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+			    connection_.want_write() == 0) {
+				return false;
+			}
+
+			write_failed_ = true;
+			return true;
+		}
+
+		return true;
+	}
+
+	ebnlib::connection connection_;
+	std::vector<uint8_t> pending_;
+	std::size_t offset_ = 0;
+	std::coroutine_handle<> connector_;
+	std::coroutine_handle<> reader_;
+	std::coroutine_handle<> writer_;
+	void *read_buffer_ = nullptr;
+	std::size_t read_len_ = 0;
+	ssize_t read_result_ = -1;
+	const uint8_t *write_data_ = nullptr;
+	std::size_t write_len_ = 0;
+	std::size_t written_ = 0;
+	bool write_failed_ = false;
+	bool connected_ = false;
+	bool closed_ = false;
+	bool error_ = false;
+	/* Accepted, waiting in the queue of the listener */
+	stream *next_ = nullptr;
+};
+
+/* Listening connection handing out accepted streams */
+class listener : public detail::endpoint {
+public:
+	listener(network_t network, connection_attr_t attr) : detail::endpoint{true}
+	{
+		attr.user_data = detail::user_data_of(this);
+		connection_ = ebnlib::connection(network, attr);
+	}
+
+	listener(const listener &) = delete;
+	listener &operator=(const listener &) = delete;
+
+	~listener()
+	{
+		while (head_ != nullptr) {
+			delete std::exchange(head_, head_->next_);
+		}
+	}
+
+	connection_ref get() const noexcept { return connection_; }
+
+	/* Resumes with the next stream, or null once the listener is closed */
+	auto accept() noexcept
+	{
+		struct awaiter {
+			listener &self;
+
+			bool await_ready() const noexcept { return self.head_ != nullptr || self.closed_; }
+			void await_suspend(std::coroutine_handle<> handle) noexcept { self.waiter_ = handle; }
+
+			std::unique_ptr<stream> await_resume() noexcept
+			{
+				stream *next = self.head_;
+
+				if (next != nullptr) {
+					self.head_ = std::exchange(next->next_, nullptr);
+				}
+
+				if (self.head_ == nullptr) {
+					self.tail_ = nullptr;
+				}
+
+				return std::unique_ptr<stream>(next);
+			}
+		};
+
+		return awaiter{*this};
+	}
+
+private:
+	friend struct detail::handler;
+
+	void on_accept(connection_t handle)
+	{
+		/* Routed to the stream before any of its events arrive */
+		stream *ptr = new stream(handle);
+
+		if (tail_ != nullptr) {
+			tail_->next_ = ptr;
+		} else {
+			head_ = ptr;
+		}
+
+		tail_ = ptr;
+		detail::resume(waiter_);
+	}
+
+	void on_close()
+	{
+		closed_ = true;
+		detail::resume(waiter_);
+	}
+
+	ebnlib::connection connection_;
+	/* Accepted streams in order, linked through the streams themselves */
+	stream *head_ = nullptr;
+	stream *tail_ = nullptr;
+	std::coroutine_handle<> waiter_;
+	bool closed_ = false;
+};
+
+inline auto accept(listener &server) noexcept
+{
+	return server.accept();
+}
+
+/* One-shot timer for sleeping in a coroutine */
+class timer {
+public:
+	explicit timer(network_t network) : timer_(network, network_timer_type_relative, user_data())
+	{
+	}
+
+	timer(const timer &) = delete;
+	timer &operator=(const timer &) = delete;
+
+	/* Resumes with false if the timer could not be started */
+	template <class Rep, class Period>
+	auto sleep(std::chrono::duration<Rep, Period> duration) noexcept
+	{
+		struct awaiter {
+			timer &self;
+			std::chrono::nanoseconds duration;
+			bool started;
+
+			bool await_ready() const noexcept { return duration.count() <= 0; }
+
+			bool await_suspend(std::coroutine_handle<> handle) noexcept
+			{
+				struct timespec value;
+				value.tv_sec = duration.count() / 1000000000;
+				value.tv_nsec = duration.count() % 1000000000;
+				self.waiter_ = handle;
+				started = self.timer_.start(value) == 0;
+
+				if (!started) {
+					self.waiter_ = nullptr;
+				}
+
+				return started;
+			}
+
+			bool await_resume() const noexcept { return started; }
+		};
+
+		return awaiter{*this, std::chrono::duration_cast<std::chrono::nanoseconds>(duration), true};
+	}
+
+private:
+	friend struct detail::handler;
+
+	user_data_t user_data() noexcept
+	{
+		user_data_t user_data;
+		user_data.ptr = this;
+		return user_data;
+	}
+
+	void on_timer()
+	{
+		detail::resume(waiter_);
+	}
+
+	ebnlib::timer timer_;
+	std::coroutine_handle<> waiter_;
+};
+
+namespace detail {
+
+/* Routes the events of the loop to the awaiting coroutines */
+struct handler : ebnlib::handler {
+	void on_data(connection_ref, const struct connection_event_t &event)
+	{
+		if (event.user_data.ptr != nullptr) {
+			stream_of(event)->on_data(event.data_buffer, event.data_len);
+		}
+	}
+
+	void on_connect(connection_ref connection, const struct connection_event_t &event)
+	{
+		if (event.user_data.ptr != nullptr) {
+			stream_of(event)->on_connect();
+		} else {
+			/* Destroyed while connecting; freed on the event of the shutdown */
+			connection.shutdown(SHUT_RDWR);
+		}
+	}
+
+	void on_accept(connection_ref, const struct connection_event_t &event)
+	{
+		if (event.user_data.ptr != nullptr) {
+			static_cast<listener *>(endpoint_of(event))->on_accept(event.new_connection);
+		} else {
+			ebnlib::connection orphan(event.new_connection);
+		}
+	}
+
+	void on_writable(connection_ref, const struct connection_event_t &event)
+	{
+		if (event.user_data.ptr != nullptr) {
+			stream_of(event)->on_writable();
+		}
+	}
+
+	void on_close(connection_ref connection, const struct connection_event_t &event)
+	{
+		finish(connection, event, false);
+	}
+
+	void on_error(connection_ref connection, const struct connection_event_t &event)
+	{
+		finish(connection, event, true);
+	}
+
+	void on_timer(timer_ref, const struct network_timer_event_t &event)
+	{
+		static_cast<timer *>(event.user_data.ptr)->on_timer();
+	}
+
+private:
+	static endpoint *endpoint_of(const struct connection_event_t &event) noexcept
+	{
+		return static_cast<endpoint *>(event.user_data.ptr);
+	}
+
+	static stream *stream_of(const struct connection_event_t &event) noexcept
+	{
+		return static_cast<stream *>(endpoint_of(event));
+	}
+
+	static void finish(connection_ref connection, const struct connection_event_t &event, bool error)
+	{
+		endpoint *ptr = endpoint_of(event);
+
+		/* Left behind by a destroyed stream */
+		if (ptr == nullptr) {
+			connection_free(connection.get());
+		} else if (ptr->is_listener) {
+			static_cast<listener *>(ptr)->on_close();
+		} else {
+			static_cast<stream *>(ptr)->on_close(error);
+		}
+	}
+};
+
+} /* namespace detail */
+
+/* Network whose events resume coroutines */
+class network : private detail::handler, public ebnlib::network<detail::handler> {
+public:
+	explicit network(const struct network_attr_t &attr)
+		: ebnlib::network<detail::handler>(static_cast<detail::handler &>(*this), attr)
+	{
+	}
+};
+
+} /* namespace ebnlib::co */
+
+#endif /* _EBNLIB_CORO_HPP */
@@ -1,30 +1,227 @@
 /*
  * Copyright (c) 2015 Jani Pellikka <jpellikk@users.noreply.github.com>
  */
+/* memfd_create() */
+#define _GNU_SOURCE
 #include "ebnlib.h"
 #include "types.h"
 
 #define _network ((struct network_data_t *)network)
 #define _connection ((struct connection_data_t *)connection)
 #define _timer ((struct timer_data_t *)timer)
+#define _buffer ((struct buffer_data_t *)buffer)
 
 #ifdef DEBUG
-#define _fprintf(...) do { fprintf(__VA_ARGS__); } while(0)
-#define _perror(x) do { perror((x)); } while(0)
+/* Callers test errno after logging (e.g. EAGAIN); keep it intact */
+#define _fprintf(...) do { int _e = errno; fprintf(__VA_ARGS__); errno = _e; } while(0)
+#define _perror(x) do { int _e = errno; perror((x)); errno = _e; } while(0)
 #else
 #define _fprintf(...) do { } while(0)
 #define _perror(x) do { } while(0)
 #endif
 
+/* Static probes of provider "ebnlib"; a no-op until traced:
+ *   wakeup(network, num_ready)              epoll_wait() returned
+ *   accept(network, listener, connection)   connection accepted
+ *   recv(network, connection, count)        data read (count <= 0 on close)
+ *   send(connection, count)                 data written
+ *   close(connection, socket_fd)            socket closed
+ *   timer(network, timer, num_expirations)  timer expired
+ *   callback_entry(network, handle, type)   event callback entered
+ *   callback_return(network, handle, type)  event callback returned
+ * Timer callbacks report the type 0. */
+#ifdef USDT
+#include <sys/sdt.h>
+#define _probe(name, ...) do { STAP_PROBEV(ebnlib, name, __VA_ARGS__); } while(0)
+#else
+#define _probe(name, ...) do { } while(0)
+#endif
+
 static void *network_eventloop(void *args);
 static int32_t network_socket_non_blocking(int32_t socket_fd);
 static int32_t network_ipc_create(struct network_data_t *network);
-static int32_t network_socket_connect(int32_t socket_fd, struct addrinfo *result,
+static ssize_t network_socket_connect(int32_t socket_fd, struct addrinfo *result,
+                                      const struct connection_attr_t *attr,
+                                      const void *data, size_t len);
+static int32_t network_socket_options(int32_t socket_fd, struct addrinfo *result,
                                       const struct connection_attr_t *attr);
+static int32_t network_socket_option(int32_t socket_fd, int32_t level,
+                                     int32_t name, int32_t value);
+static int32_t network_socket_timestamping(int32_t socket_fd, uint32_t timestamping);
+static void network_msg_timestamp(struct msghdr *msg, struct timespec *timestamp,
+                                  struct sock_extended_err *error);
+static int32_t handle_connection_errqueue(struct network_data_t *network,
+                                          struct connection_data_t *connection,
+                                          struct connection_event_t *conn_event);
 static int32_t network_socket_bind(int32_t socket_fd, struct addrinfo *result);
+static int32_t network_socket_unix(struct addrinfo *result, struct sockaddr_un *addr,
+                                   const struct connection_attr_t *attr);
 static void handle_timer(struct network_data_t *network, struct timer_data_t *timer);
+static void handle_connection_data(struct network_data_t *network,
+                                   struct connection_data_t *connection,
+                                   struct connection_event_t *conn_event);
+static void handle_throttle_timer(struct network_data_t *network, struct timer_data_t *timer);
+static uint64_t network_time_now(void);
+static void rate_limit_init(struct connection_data_t *connection,
+                            const struct connection_rate_limit_t *limit);
+static uint64_t rate_limit_check(struct network_data_t *network,
+                                 struct connection_data_t *connection, size_t *len);
+static int32_t network_throttle(struct network_data_t *network,
+                                struct connection_data_t *connection, uint64_t resume_at);
+static void network_throttle_remove(struct network_data_t *network,
+                                    struct connection_data_t *connection);
+static int32_t network_throttle_arm(struct network_data_t *network);
+static void handle_connection_accept(struct network_data_t *network,
+                                     struct connection_data_t *connection,
+                                     struct connection_event_t *conn_event);
+static int32_t network_accept_limited(struct network_data_t *network,
+                                      struct connection_data_t *connection, uint8_t resume);
+static struct connection_data_t *network_connection_accept(struct network_data_t *network,
+                                                           struct connection_data_t *connection,
+                                                           int32_t socket_fd);
+static struct connection_data_t *network_flow_find(struct connection_data_t *connection,
+                                                   const struct sockaddr_storage *addr);
+static struct connection_data_t *network_flow_accept(struct network_data_t *network,
+                                                     struct connection_data_t *connection,
+                                                     const struct sockaddr_storage *addr,
+                                                     socklen_t addr_len,
+                                                     struct connection_event_t *conn_event);
+static void connection_flows_unlink(struct connection_data_t *connection);
+static void network_accept_resume(struct network_data_t *network,
+                                  struct connection_event_t *conn_event);
+static void network_accept_shed(struct network_data_t *network,
+                                 struct connection_data_t *connection,
+                                 struct connection_event_t *conn_event);
+static int32_t connection_close_socket(struct connection_data_t *connection);
+static void connection_release(struct connection_data_t *connection);
+static void network_wakeup(struct network_data_t *network);
+static int32_t connection_register(struct connection_data_t *connection,
+                                   const struct connection_attr_t *attr, uint32_t events);
+static int32_t network_join(struct network_data_t *network);
+static int32_t ring_buffer_create(struct ring_buffer_t *ring, size_t size, uint8_t hugepages);
+static void network_events_order(struct network_data_t *network,
+                                 struct epoll_event *events, int32_t num_ready);
+static void network_defer(struct network_data_t *network, struct connection_data_t *connection);
+static void network_defer_remove(struct network_data_t *network,
+                                 struct connection_data_t *connection);
+static void network_deferred_process(struct network_data_t *network,
+                                     struct connection_event_t *conn_event);
+static void ring_buffer_free(struct ring_buffer_t *ring);
+static struct buffer_pool_t *buffer_pool_create(const struct network_buffer_pool_attr_t *attr);
+static struct buffer_data_t *buffer_pool_get(struct buffer_pool_t *pool);
+static void buffer_pool_put(struct buffer_data_t *buffer);
+static void buffer_pool_close(struct buffer_pool_t *pool);
+static void buffer_release(struct buffer_data_t *buffer);
+static struct buffer_data_t *buffer_heap_create(size_t size);
+static int32_t send_queue_reserve(struct send_queue_t *queue, size_t num_buffers);
+static int32_t send_queue_append(struct connection_data_t *connection,
+                                 const network_buffer_t *buffers, size_t num_buffers);
+static int32_t send_queue_copy(struct connection_data_t *connection,
+                               const void *data, size_t len);
+static int32_t send_queue_flush(struct connection_data_t *connection);
+static void send_queue_free(struct send_queue_t *queue);
+static void network_flush_add(struct network_data_t *network, struct connection_data_t *connection);
+static void network_flush_remove(struct network_data_t *network,
+                                 struct connection_data_t *connection);
+static void network_flush_process(struct network_data_t *network,
+                                  struct connection_event_t *conn_event);
+static uint8_t network_corking(const struct network_data_t *network);
+static ssize_t connection_cork(struct connection_data_t *connection, const void *data, size_t len);
+static int32_t connection_cork_commit(struct connection_data_t *connection);
+static int32_t connection_uncork(struct connection_data_t *connection);
+static int32_t connection_send_ready(struct connection_data_t *connection);
+static uint8_t network_on_loop(const struct network_data_t *network);
+static int32_t connection_linger(struct connection_data_t *connection);
+static void connection_linger_event(struct connection_data_t *connection, uint32_t events);
+static void connection_linger_end(struct connection_data_t *connection);
+static ssize_t connection_write_msg(struct connection_data_t *connection,
+                                    const struct msghdr *msg);
+static void network_drain_start(struct network_data_t *network,
+                                struct connection_event_t *conn_event);
+static int32_t network_drain_check(struct network_data_t *network,
+                                   struct connection_event_t *conn_event);
+static int32_t network_drain_timeout(struct network_data_t *network);
+static void network_events_adapt(struct network_data_t *network, int32_t num_ready);
 static int32_t network_socket_create(struct connection_data_t *connection,
-                                     const struct connection_attr_t *attr);
+                                     const struct connection_attr_t *attr,
+                                     const void *data, size_t len);
+static int32_t connection_open(connection_t *connection, const struct connection_attr_t *attr,
+                               const void *data, size_t len);
+static int32_t connection_send_payload(struct connection_data_t *connection);
+static void network_connection_link(struct network_data_t *network,
+                                    struct connection_data_t *connection);
+static void network_connection_unlink(struct network_data_t *network,
+                                      struct connection_data_t *connection);
+static int32_t network_ipc_post(struct network_data_t *network, struct ipc_message_t *message);
+static void network_ipc_process(struct network_data_t *network,
+                                struct connection_event_t *conn_event);
+static int32_t network_connection_detach(struct network_data_t *network,
+                                         struct connection_data_t *connection,
+                                         struct network_data_t *destination);
+static void network_connection_attach(struct network_data_t *network,
+                                      struct connection_data_t *connection,
+                                      struct connection_event_t *conn_event);
+static int32_t connection_tls_init(struct connection_data_t *connection,
+                                   const struct connection_attr_t *attr);
+static void connection_tls_free(struct connection_data_t *connection);
+#ifdef TLS
+static int32_t connection_tls_session(struct connection_data_t *connection,
+                                      SSL_CTX *context, const char *hostname);
+static void handle_tls_handshake(struct network_data_t *network,
+                                 struct connection_data_t *connection,
+                                 struct connection_event_t *conn_event);
+static ssize_t connection_tls_result(struct connection_data_t *connection,
+                                     int32_t s, size_t len);
+static ssize_t connection_tls_write(struct connection_data_t *connection,
+                                    const void *data, size_t len);
+static ssize_t connection_tls_sendfile(struct connection_data_t *connection,
+                                       int32_t fd, off_t *offset, size_t count);
+static int32_t connection_tls_encrypts(struct connection_data_t *connection);
+#endif
+static int32_t network_connection_events(struct network_data_t *network,
+                                         struct connection_data_t *connection,
+                                         uint32_t events);
+static void handle_connection_writable(struct network_data_t *network,
+                                       struct connection_data_t *connection,
+                                       struct connection_event_t *conn_event,
+                                       uint32_t events);
+static void network_rebalance_select(struct network_data_t *network,
+                                     const struct ipc_message_t *message);
+static void network_dispatch(struct network_data_t *network,
+                             struct connection_data_t *connection,
+                             struct connection_event_t *conn_event);
+static void connection_pool_key(const struct connection_attr_t *attr, char *key, size_t len);
+static void network_pool_remove(struct network_data_t *network,
+                                struct connection_data_t *connection);
+static void connection_pool_close(struct connection_data_t *connection);
+static void connection_pool_event(struct connection_data_t *connection,
+                                  const struct connection_event_t *conn_event);
+static int32_t network_pool_arm(struct network_data_t *network);
+static void handle_pool_timer(struct network_data_t *network, struct timer_data_t *timer);
+static int32_t network_info_start(struct network_data_t *network);
+static void handle_info_timer(struct network_data_t *network, struct timer_data_t *timer);
+static uint8_t connection_info_eligible(const struct connection_data_t *connection);
+static int32_t connection_info_sample(struct network_data_t *network,
+                                      struct connection_data_t *connection, uint64_t now);
+static void network_info_remove(struct network_data_t *network,
+                                struct connection_data_t *connection);
+static void network_watch_enter(struct network_data_t *network,
+                                uintptr_t handle, uint32_t type);
+static void network_watch_leave(struct network_data_t *network);
+#ifdef PTHREAD
+static int32_t network_watchdog_start(struct network_data_t *network);
+static void network_watchdog_stop(struct network_data_t *network);
+static int32_t network_workers_start(struct network_data_t *network);
+static void network_workers_stop(struct network_data_t *network);
+static void network_workers_free(struct network_data_t *network);
+static void network_offload_process(struct network_data_t *network,
+                                    struct connection_event_t *conn_event);
+static struct offload_worker_t *network_worker_select(struct network_data_t *network);
+static void offload_ring_push(struct offload_ring_t *ring, const struct offload_item_t *item);
+
+/* Network whose loop runs on this thread; read by the backtrace signal */
+static __thread struct network_data_t *watchdog_network;
+#endif
 
 int32_t network_create(network_t *network, const struct network_attr_t *attr)
 {
@@ -47,28 +244,174 @@ int32_t network_create(network_t *network, const struct network_attr_t *attr)
 
 	ptr->attr = *attr;
 
+	/* Bulk readers yield to the higher classes unless told otherwise */
+	if (ptr->attr.priority_reads[connection_priority_normal] == 0) {
+		ptr->attr.priority_reads[connection_priority_normal] = NETWORK_NORMAL_READS;
+	}
+
+	if (ptr->attr.priority_reads[connection_priority_low] == 0) {
+		ptr->attr.priority_reads[connection_priority_low] = NETWORK_LOW_READS;
+	}
+
+#ifndef PTHREAD
+
+	if (attr->watchdog.threshold.tv_sec != 0 || attr->watchdog.threshold.tv_nsec != 0) {
+		_fprintf(stderr, "Watchdog requires PTHREAD.\n");
+		close(ptr->epoll_fd);
+		free(ptr);
+		return -1;
+	}
+
+	if (attr->offload.num_workers > 0) {
+		_fprintf(stderr, "Workers require PTHREAD.\n");
+		close(ptr->epoll_fd);
+		free(ptr);
+		return -1;
+	}
+
+#endif
+
+	if (attr->offload.num_workers > 0 && attr->offload.work_cb == NULL) {
+		_fprintf(stderr, "Workers require a work callback.\n");
+		close(ptr->epoll_fd);
+		free(ptr);
+		return -1;
+	}
+
+	if (attr->buffer_pool.num_buffers > 0) {
+		ptr->buffer_pool = buffer_pool_create(&attr->buffer_pool);
+
+		if (ptr->buffer_pool == NULL) {
+			close(ptr->epoll_fd);
+			free(ptr);
+			return -1;
+		}
+	}
+
 	if (network_ipc_create(ptr) == -1) {
+		buffer_pool_close(ptr->buffer_pool);
+		free(ptr);
+		return -1;
+	}
+
+	/* Failure only disables shedding connections on descriptor exhaustion */
+	ptr->reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+#ifdef PTHREAD
+
+	pthread_condattr_t cond_attr;
+	pthread_condattr_init(&cond_attr);
+	/* The watchdog polls on the clock the loop stamps callbacks with */
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+
+	if (pthread_mutex_init(&ptr->lock, NULL) ||
+	    pthread_cond_init(&ptr->watchdog_cond, &cond_attr) ||
+	    sem_init(&ptr->backtrace_done, 0, 0) == -1) {
+		_perror("pthread_mutex_init()");
+		pthread_condattr_destroy(&cond_attr);
+		buffer_pool_close(ptr->buffer_pool);
+		close(ptr->ipc->socket_fd);
+		free(ptr->ipc);
+
+		if (ptr->reserve_fd != -1) {
+			close(ptr->reserve_fd);
+		}
+
 		free(ptr);
 		return -1;
 	}
 
+	pthread_condattr_destroy(&cond_attr);
+
+#endif
 	*network = (network_t)ptr;
 	return 0;
 }
 
 int32_t network_free(network_t network)
 {
+	struct connection_data_t *connection, *next;
+	struct ipc_message_t *message;
+
+	/* The loop is gone; the rest of the queued data with it */
+	for (connection = _network->connections; connection != NULL; connection = next) {
+		next = connection->next;
+
+		if (connection->lingering) {
+			connection_linger_end(connection);
+		}
+	}
+
 	/* Clean the IPC resources */
 	close(_network->ipc->socket_fd);
 	free(_network->ipc);
+
+	while ((message = _network->ipc_head) != NULL) {
+		_network->ipc_head = message->next;
+		free(message);
+	}
+
+	if (_network->throttle_timer != NULL) {
+		network_timer_free((network_timer_t)_network->throttle_timer);
+	}
+
+#ifdef PTHREAD
+	/* Work not returned is dropped; connections freed meanwhile go with it */
+	network_workers_free(_network);
+#endif
+
+	/* The pool owns its idle connections */
+	while (_network->pool_head != NULL) {
+		connection_pool_close(_network->pool_head);
+	}
+
+	if (_network->pool_timer != NULL) {
+		network_timer_free((network_timer_t)_network->pool_timer);
+	}
+
+	if (_network->info_timer != NULL) {
+		network_timer_free((network_timer_t)_network->info_timer);
+	}
+
+	if (_network->reserve_fd != -1) {
+		close(_network->reserve_fd);
+	}
+
+	/* Buffers still referenced keep the pool until released */
+	if (_network->spare_buffer != NULL) {
+		buffer_pool_put(_network->spare_buffer);
+	}
+
+	buffer_pool_close(_network->buffer_pool);
+
+	/* Connections outlive the network; forget the owner */
+	for (connection = _network->connections; connection != NULL;
+	     connection = connection->next) {
+		if (connection->mode == connection_mode_server &&
+		    connection->counter != NULL) {
+			connection->counter->network = NULL;
+		}
+
+		connection->accounted = NULL;
+		connection->network = NULL;
+	}
+
 	/* Free the network resources */
 	close(_network->epoll_fd);
+#ifdef PTHREAD
+	pthread_mutex_destroy(&_network->lock);
+	pthread_cond_destroy(&_network->watchdog_cond);
+	sem_destroy(&_network->backtrace_done);
+#endif
 	free(_network);
 	return 0;
 }
 
 int32_t network_start(network_t network)
 {
+	__atomic_store_n(&_network->stopped, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&_network->drain_deadline, 0, __ATOMIC_RELEASE);
+	_network->draining = 0;
 #ifdef PTHREAD
 
 	if (_network->attr.mode == network_mode_thread) {
@@ -95,6 +438,7 @@ int32_t network_start(network_t network)
 int32_t network_stop(network_t network)
 {
 	uint64_t data = 1;
+	__atomic_store_n(&_network->stopped, 1, __ATOMIC_RELEASE);
 
 	/* Signal the network event loop to stop */
 	if (write(_network->ipc->socket_fd, &data, sizeof(data)) == -1) {
@@ -102,31 +446,58 @@ int32_t network_stop(network_t network)
 		return -1;
 	}
 
-#ifdef PTHREAD
+	return network_join(_network);
+}
 
-	if (_network->attr.mode == network_mode_thread) {
-		if (pthread_join(_network->thread, NULL)) {
-			_perror("pthread_join()");
-			return -1;
-		}
-	} else
-#endif
-		if (_network->attr.mode == network_mode_mainloop) {
-			return 0;
-		} else {
-			_fprintf(stderr, "Invalid network mode: %d\n", _network->attr.mode);
-			return -1;
-		}
+int32_t network_drain(network_t network, const struct timespec *timeout)
+{
+	uint64_t deadline = UINT64_MAX;
+	uint64_t data = 1;
 
-	return 0;
+	if (timeout != NULL) {
+		deadline = network_time_now() + timeout->tv_sec * NSEC_PER_SEC + timeout->tv_nsec;
+	}
+
+	__atomic_store_n(&_network->drain_deadline, deadline, __ATOMIC_RELEASE);
+
+	/* Signal the network event loop to drain */
+	if (write(_network->ipc->socket_fd, &data, sizeof(data)) == -1) {
+		_perror("write()");
+		return -1;
+	}
+
+	return network_join(_network);
 }
 
 int32_t connection_create(connection_t *connection,
                           const struct connection_attr_t *attr)
+{
+	return connection_open(connection, attr, NULL, 0);
+}
+
+int32_t connection_create_send(connection_t *connection,
+                               const struct connection_attr_t *attr,
+                               const void *data, size_t len)
+{
+	if (attr->mode != connection_mode_client) {
+		_fprintf(stderr, "Invalid connection mode: %d\n", attr->mode);
+		return -1;
+	}
+
+	/* Application data follows the handshake */
+	if (attr->tls_context != NULL) {
+		_fprintf(stderr, "First payload not supported with TLS.\n");
+		return -1;
+	}
+
+	return connection_open(connection, attr, data, len);
+}
+
+static int32_t connection_open(connection_t *connection, const struct connection_attr_t *attr,
+                               const void *data, size_t len)
 {
 	struct connection_data_t *ptr;
-	struct network_data_t *network;
-	struct epoll_event event = {0};
+	uint32_t events = EPOLLIN | EPOLLET;
 	ptr = malloc(sizeof(*ptr));
 
 	if (ptr == NULL) {
@@ -136,551 +507,5030 @@ int32_t connection_create(connection_t *connection,
 
 	memset(ptr, 0, sizeof(*ptr));
 
-	if (network_socket_create(ptr, attr) == -1) {
+	if (network_socket_create(ptr, attr, data, len) == -1) {
 		free(ptr);
 		return -1;
 	}
 
-	event.events = EPOLLIN | EPOLLET;
-
 	if (attr->mode == connection_mode_client) {
-		event.events |= EPOLLOUT;
+		events |= EPOLLOUT;
 	}
 
-	event.data.ptr = ptr;
-	network = (struct network_data_t *)(*attr->network);
+	ptr->mode = attr->mode;
 
-	if (epoll_ctl(network->epoll_fd, EPOLL_CTL_ADD,
-	              ptr->socket_fd, &event) == -1) {
-		_perror("epoll_ctl()");
+	if (attr->tls_context != NULL && connection_tls_init(ptr, attr) == -1) {
 		close(ptr->socket_fd);
 		free(ptr);
 		return -1;
 	}
 
-	ptr->mode = attr->mode;
-	ptr->user_data = attr->user_data;
-	ptr->data_type = data_type_connection;
-	*connection = (connection_t)ptr;
-	return 0;
-}
+	if (connection_register(ptr, attr, events) == -1) {
+		connection_tls_free(ptr);
+		close(ptr->socket_fd);
+		free(ptr->payload);
+		free(ptr);
+		return -1;
+	}
 
-int32_t connection_free(connection_t connection)
-{
-	free(_connection);
+	*connection = (connection_t)ptr;
 	return 0;
 }
 
-int32_t connection_close(connection_t connection)
-{
-	return close(_connection->socket_fd);
-}
-
-ssize_t connection_sendmsg(connection_t connection, const struct msghdr *msg)
+int32_t connection_adopt(connection_t *connection,
+                         const struct connection_attr_t *attr, int32_t socket_fd)
 {
-	ssize_t s = sendmsg(_connection->socket_fd, msg, 0);
+	struct connection_data_t *ptr;
+	struct addrinfo info;
+	socklen_t len = sizeof(int32_t);
+	int32_t listening = 0;
+	ptr = malloc(sizeof(*ptr));
 
-	if (s == -1) {
-		_perror("sendmsg()");
+	if (ptr == NULL) {
+		_perror("malloc()");
 		return -1;
 	}
 
-	return s;
-}
-
-ssize_t connection_send(connection_t connection, const void *data, size_t len)
-{
-	ssize_t s = send(_connection->socket_fd, data, len, 0);
+	memset(ptr, 0, sizeof(*ptr));
+	ptr->socket_fd = socket_fd;
 
-	if (s == -1) {
-		_perror("send()");
+	/* The socket describes itself; no resolution, bind or listen */
+	if (getsockopt(socket_fd, SOL_SOCKET, SO_TYPE, &ptr->socktype, &len) == -1 ||
+	    getsockopt(socket_fd, SOL_SOCKET, SO_DOMAIN, &ptr->family, &len) == -1 ||
+	    getsockopt(socket_fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == -1) {
+		_perror("getsockopt()");
+		free(ptr);
 		return -1;
 	}
 
-	return s;
-}
-
-ssize_t connection_sendto(connection_t connection, const void *data, size_t len,
-                          const struct sockaddr *dest_addr, socklen_t addrlen)
-{
-	ssize_t s = sendto(_connection->socket_fd, data, len, 0, dest_addr, addrlen);
+	/* Listening sockets and datagram servers are servers; the rest are established */
+	if (listening || (attr->mode == connection_mode_server && ptr->socktype == SOCK_DGRAM)) {
+		ptr->mode = connection_mode_server;
+	} else {
+		ptr->mode = connection_mode_client;
+	}
 
-	if (s == -1) {
-		_perror("sendto()");
+	if (network_socket_non_blocking(socket_fd) == -1) {
+		free(ptr);
 		return -1;
 	}
 
-	return s;
-}
-
-int32_t network_timer_create(network_timer_t *timer, const struct network_timer_attr_t *attr)
-{
-	struct timer_data_t *ptr;
-	struct network_data_t *network;
-	struct epoll_event event = {0};
-	ptr = malloc(sizeof(*ptr));
+	memset(&info, 0, sizeof(info));
+	info.ai_family = ptr->family;
+	info.ai_socktype = ptr->socktype;
 
-	if (ptr == NULL) {
-		_perror("malloc()");
+	if (network_socket_options(socket_fd, &info, attr) == -1) {
+		free(ptr);
 		return -1;
 	}
 
-	memset(ptr, 0, sizeof(*ptr));
-	ptr->timer_fd = timerfd_create(attr->type == network_timer_type_absolute
-	                               ? CLOCK_REALTIME : CLOCK_MONOTONIC, TFD_NONBLOCK);
-
-	if (ptr->timer_fd == -1) {
-		_perror("timerfd_create()");
+	/* Sessions cannot be inherited; only listeners take the context */
+	if (attr->tls_context != NULL && ptr->mode == connection_mode_server &&
+	    connection_tls_init(ptr, attr) == -1) {
 		free(ptr);
 		return -1;
 	}
 
-	event.events = EPOLLIN;
-	event.data.ptr = ptr;
-	network = (struct network_data_t *)(*attr->network);
-
-	if (epoll_ctl(network->epoll_fd, EPOLL_CTL_ADD,
-	              ptr->timer_fd, &event) == -1) {
-		_perror("epoll_ctl()");
-		close(ptr->timer_fd);
+	if (connection_register(ptr, attr, EPOLLIN | EPOLLET) == -1) {
 		free(ptr);
 		return -1;
 	}
 
-	ptr->data_type = data_type_timer;
-	ptr->user_data = attr->user_data;
-	ptr->timer_type = attr->type;
-	*timer = (network_timer_t)ptr;
+	*connection = (connection_t)ptr;
 	return 0;
 }
 
-int32_t network_timer_free(network_timer_t timer)
+ssize_t connection_export(connection_t channel, const connection_t *connections,
+                          size_t num_connections)
 {
-	/* Remove from the event list */
-	close(_timer->timer_fd);
-	/* Free resources */
-	free(_timer);
-	return 0;
+	struct connection_export_t header;
+	int32_t fds[CONNECTION_MAX_FDS];
+	ssize_t sent = 0;
+
+	/* One message carries at most CONNECTION_MAX_FDS descriptors */
+	while ((size_t)sent < num_connections) {
+		size_t i, n = num_connections - sent;
+		n = n < CONNECTION_MAX_FDS ? n : CONNECTION_MAX_FDS;
+
+		for (i = 0; i < n; ++i) {
+			fds[i] = ((struct connection_data_t *)connections[sent + i])->socket_fd;
+		}
+
+		memset(&header, 0, sizeof(header));
+		header.magic = CONNECTION_EXPORT_MAGIC;
+		header.num_fds = n;
+
+		if (connection_send_fds(channel, &header, sizeof(header), fds, n) == -1) {
+			return sent > 0 ? sent : -1;
+		}
+
+		sent += n;
+	}
+
+	return sent;
 }
 
-int32_t network_timer_start(network_timer_t timer, const struct timespec *value)
+ssize_t connection_import(const struct connection_event_t *event,
+                          const struct connection_attr_t *attr,
+                          connection_t *connections, size_t max_connections)
 {
-	int32_t flags = 0;
-	struct itimerspec spec;
-	memset(&spec, 0, sizeof(spec));
+	struct connection_export_t header;
+	int32_t fds[CONNECTION_MAX_FDS];
+	size_t i, num_fds = connection_event_fds(event, fds, CONNECTION_MAX_FDS);
+	ssize_t imported = 0;
 
-	if (_timer->timer_type == network_timer_type_periodic) {
-		/* Value specifies expiration interval */
-		spec.it_interval = *value;
-		spec.it_value = *value;
-	} else if (_timer->timer_type == network_timer_type_relative) {
-		/* Expiry time relative to now (expires only once) */
-		spec.it_value = *value;
-	} else if (_timer->timer_type == network_timer_type_absolute) {
-		/* Expiry time as an absolute time (expires only once) */
-		flags = TFD_TIMER_ABSTIME;
-		spec.it_value = *value;
+	if (event->data_len != sizeof(header)) {
+		header.magic = 0;
 	} else {
-		_fprintf(stderr, "Invalid timer type: %d\n", _timer->timer_type);
-		return -1;
+		memcpy(&header, event->data_buffer, sizeof(header));
 	}
 
-	if (timerfd_settime(_timer->timer_fd, flags, &spec, NULL) == -1) {
-		_perror("timerfd_settime()");
+	if (header.magic != CONNECTION_EXPORT_MAGIC) {
+		_fprintf(stderr, "Invalid export message.\n");
+
+		for (i = 0; i < num_fds; ++i) {
+			close(fds[i]);
+		}
+
 		return -1;
 	}
 
-	return 0;
-}
-
-int32_t network_timer_cancel(network_timer_t timer)
-{
-	struct itimerspec spec;
-	memset(&spec, 0, sizeof(spec));
+	for (i = 0; i < num_fds; ++i) {
+		/* Descriptors that cannot be adopted are not leaked */
+		if ((size_t)imported >= max_connections ||
+		    connection_adopt(&connections[imported], attr, fds[i]) == -1) {
+			close(fds[i]);
+			continue;
+		}
 
-	if (timerfd_settime(_timer->timer_fd, 0, &spec, NULL) == -1) {
-		_perror("timerfd_settime()");
-		return -1;
+		++imported;
 	}
 
-	return 0;
+	return imported;
 }
 
-static int32_t network_ipc_create(struct network_data_t *network)
+int32_t connection_free(connection_t connection)
 {
-	struct connection_data_t *conn;
-	struct epoll_event event = {0};
-	conn = malloc(sizeof(*conn));
+	struct accept_counter_t *counter = _connection->counter;
 
-	if (conn == NULL) {
-		_perror("malloc()");
-		return -1;
+	/* Freed once the queued data is written */
+	if (_connection->lingering) {
+		_connection->orphaned = 1;
+		return 0;
 	}
 
-	memset(conn, 0, sizeof(*conn));
+	/* Freed once the workers have returned its requests */
+	if (_connection->work_pending > 0) {
+		if (_connection->socket_fd != -1) {
+			connection_close_socket(_connection);
+		}
+
+		_connection->orphaned = 1;
+		return 0;
+	}
+
+	if (_connection->network != NULL) {
+		network_throttle_remove(_connection->network, _connection);
+		network_defer_remove(_connection->network, _connection);
+		network_flush_remove(_connection->network, _connection);
+		network_pool_remove(_connection->network, _connection);
+		network_connection_unlink(_connection->network, _connection);
+		connection_flows_unlink(_connection);
+
+		if (_connection->accept_paused) {
+			__atomic_sub_fetch(&_connection->network->num_paused, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	if (_connection->mode == connection_mode_server) {
+		/* The accepted connections may outlive the listener */
+		if (counter != NULL && __atomic_sub_fetch(&counter->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+			free(counter);
+		}
+	} else {
+		connection_release(_connection);
+	}
+
+	connection_tls_free(_connection);
+	ring_buffer_free(&_connection->ring);
+	send_queue_free(&_connection->send_queue);
+	free(_connection->cork);
+	free(_connection->payload);
+	free(_connection->pool_key);
+	free(_connection);
+	return 0;
+}
+
+int32_t connection_set_user_data(connection_t connection, user_data_t user_data)
+{
+	_connection->user_data = user_data;
+	return 0;
+}
+
+int32_t connection_set_handlers(connection_t connection,
+                                const struct connection_handlers_t *handlers)
+{
+	_connection->handlers = handlers;
+	return 0;
+}
+
+int32_t connection_want_write(connection_t connection)
+{
+	if (_connection->network == NULL) {
+		_fprintf(stderr, "Connection has no network.\n");
+		return -1;
+	}
+
+	/* Raised once; only for connections already created or accepted */
+	_connection->want_write = 1;
+	return network_connection_events(_connection->network, _connection,
+	                                 EPOLLIN | EPOLLOUT | EPOLLET);
+}
+
+int32_t connection_consume(connection_t connection, size_t len)
+{
+	struct ring_buffer_t *ring = &_connection->ring;
+
+	if (_connection->network == NULL) {
+		_fprintf(stderr, "Connection has no network.\n");
+		return -1;
+	}
+
+	if (ring->base == NULL || len > ring->len) {
+		_fprintf(stderr, "Invalid length to consume: %lu\n", (unsigned long)len);
+		return -1;
+	}
+
+	ring->head = (ring->head + len) % ring->size;
+	ring->len -= len;
+
+	/* Re-arming the edge reports the data left in the socket */
+	if (ring->stalled && len > 0) {
+		struct epoll_event event = {0};
+		event.events = _connection->events;
+		event.data.ptr = _connection;
+		ring->stalled = 0;
+
+		if (epoll_ctl(_connection->network->epoll_fd, EPOLL_CTL_MOD,
+		              _connection->socket_fd, &event) == -1) {
+			_perror("epoll_ctl()");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int32_t connection_set_priority(connection_t connection, connection_priority_e priority)
+{
+	if ((uint32_t)priority >= CONNECTION_PRIORITIES) {
+		_fprintf(stderr, "Invalid connection priority: %d\n", priority);
+		return -1;
+	}
+
+	/* Takes effect from the next wakeup; call from the loop thread */
+	if (_connection->deferred) {
+		network_defer_remove(_connection->network, _connection);
+		_connection->priority = priority;
+		network_defer(_connection->network, _connection);
+	} else {
+		_connection->priority = priority;
+	}
+
+	return 0;
+}
+
+int32_t connection_shutdown(connection_t connection, int32_t how)
+{
+	/* Staged and queued data go first; EAGAIN until they are written */
+	if (how != SHUT_RD && connection_send_ready(_connection) == -1) {
+		return -1;
+	}
+
+	if (shutdown(_connection->socket_fd, how) == -1) {
+		_perror("shutdown()");
+		return -1;
+	}
+
+	return 0;
+}
+
+int32_t connection_migrate(connection_t connection, network_t network)
+{
+	struct ipc_message_t *message;
+
+	if (_connection->network == NULL) {
+		_fprintf(stderr, "Connection has no network.\n");
+		return -1;
+	}
+
+	if (_connection->network == _network) {
+		return 0;
+	}
+
+	message = malloc(sizeof(*message));
+
+	if (message == NULL) {
+		_perror("malloc()");
+		return -1;
+	}
+
+	/* The owning loop detaches the connection between two wakeups */
+	memset(message, 0, sizeof(*message));
+	message->type = ipc_message_migrate;
+	message->connection = _connection;
+	message->network = _network;
+	return network_ipc_post(_connection->network, message);
+}
+
+int32_t network_rebalance(const network_t *networks, size_t num_networks,
+                          size_t max_connections)
+{
+	struct network_data_t *busiest = NULL, *idlest = NULL;
+	struct ipc_message_t *message;
+	uint64_t max_load = 0, min_load = UINT64_MAX;
+	size_t i;
+
+	for (i = 0; i < num_networks; ++i) {
+		struct network_data_t *network = (struct network_data_t *)networks[i];
+		uint64_t load = __atomic_load_n(&network->load, __ATOMIC_RELAXED);
+		/* Concurrent callers each take a period of their own */
+		uint64_t mark = __atomic_exchange_n(&network->load_mark, load, __ATOMIC_RELAXED);
+		uint64_t delta = load - mark;
+
+		if (busiest == NULL || delta > max_load) {
+			busiest = network;
+			max_load = delta;
+		}
+
+		if (idlest == NULL || delta < min_load) {
+			idlest = network;
+			min_load = delta;
+		}
+	}
+
+	/* Balanced enough; moving connections would cost more than it saves */
+	if (busiest == idlest || max_load <= 2 * min_load || max_connections == 0) {
+		return 0;
+	}
+
+	message = malloc(sizeof(*message));
+
+	if (message == NULL) {
+		_perror("malloc()");
+		return -1;
+	}
+
+	memset(message, 0, sizeof(*message));
+	message->type = ipc_message_rebalance;
+	message->network = idlest;
+	message->max_connections = max_connections;
+	/* Move about half of the difference */
+	message->load = (max_load - min_load) / 2;
+
+	if (network_ipc_post(busiest, message) == -1) {
+		return -1;
+	}
+
+	return 1;
+}
+
+int32_t connection_close(connection_t connection)
+{
+	int32_t dropped = 0;
+
+	/* Staged and queued data go first; the loop lingers for the rest */
+	if (connection_send_ready(_connection) == -1) {
+		if (errno == EAGAIN && connection_linger(_connection) == 0) {
+			return 0;
+		}
+
+		_fprintf(stderr, "Unsent data dropped.\n");
+		dropped = 1;
+	}
+#ifdef TLS
+	/* Notify the peer; best effort on a non-blocking socket */
+	if (_connection->tls != NULL && !_connection->tls_handshake) {
+		ERR_clear_error();
+		SSL_shutdown(_connection->tls);
+	}
+#endif
+	if (connection_close_socket(_connection) == -1) {
+		return -1;
+	}
+
+	if (dropped) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	return 0;
+}
+
+ssize_t connection_sendmsg(connection_t connection, const struct msghdr *msg)
+{
+	if (connection_send_ready(_connection) == -1) {
+		return -1;
+	}
+
+	return connection_write_msg(_connection, msg);
+}
+
+static ssize_t connection_write_msg(struct connection_data_t *connection,
+                                    const struct msghdr *msg)
+{
+	ssize_t s;
+#ifdef TLS
+	if (connection_tls_encrypts(connection)) {
+		ssize_t total = 0;
+		size_t i;
+
+		/* Ancillary data has no meaning inside the session */
+		for (i = 0; i < msg->msg_iovlen; ++i) {
+			s = connection_tls_write(connection, msg->msg_iov[i].iov_base,
+			                         msg->msg_iov[i].iov_len);
+
+			if (s == -1) {
+				_perror("SSL_write()");
+				return total > 0 ? total : -1;
+			}
+
+			total += s;
+
+			if ((size_t)s < msg->msg_iov[i].iov_len) {
+				break;
+			}
+		}
+
+		_probe(send, connection, total);
+		return total;
+	}
+#endif
+	s = sendmsg(connection->socket_fd, msg, 0);
+
+	if (s == -1) {
+		_perror("sendmsg()");
+		return -1;
+	}
+
+	_probe(send, connection, s);
+	return s;
+}
+
+ssize_t connection_send(connection_t connection, const void *data, size_t len)
+{
+	ssize_t s;
+
+	if (_connection->auto_cork && network_corking(_connection->network)) {
+		size_t used = _connection->cork != NULL ? _connection->cork->len : 0;
+
+		/* Written at the end of the iteration with the rest */
+		if (used + len <= CONNECTION_CORK_MAX) {
+			return connection_cork(_connection, data, len);
+		}
+	}
+
+	/* Large writes go out directly, after what was staged or queued */
+	if (connection_send_ready(_connection) == -1) {
+		return -1;
+	}
+#ifdef TLS
+	if (connection_tls_encrypts(_connection)) {
+		s = connection_tls_write(_connection, data, len);
+
+		if (s == -1) {
+			_perror("SSL_write()");
+			return -1;
+		}
+
+		_probe(send, _connection, s);
+		return s;
+	}
+#endif
+	/* Offloaded sessions are encrypted by the kernel */
+	s = send(_connection->socket_fd, data, len, 0);
+
+	if (s == -1) {
+		_perror("send()");
+		return -1;
+	}
+
+	_probe(send, _connection, s);
+	return s;
+}
+
+int32_t connection_send_buffers(connection_t connection, const network_buffer_t *buffers,
+                                size_t num_buffers)
+{
+	struct send_queue_t *queue = &_connection->send_queue;
+	uint8_t idle;
+
+	if (_connection->network == NULL) {
+		_fprintf(stderr, "Connection has no network.\n");
+		return -1;
+	}
+
+	/* Behind the staged data, flushed at the end of the iteration */
+	if (connection_cork_commit(_connection) == -1) {
+		return -1;
+	}
+
+	idle = queue->len == 0;
+
+	/* Sent with one sendmsg(); the queue holds a reference until written */
+	if (send_queue_append(_connection, buffers, num_buffers) == -1) {
+		return -1;
+	}
+
+	/* The socket or the end of the iteration sends the earlier buffers */
+	if (!idle || _connection->flush_pending) {
+		return 0;
+	}
+
+	if (send_queue_flush(_connection) == -1) {
+		return -1;
+	}
+
+	/* The rest is sent by the writable handler */
+	if (queue->len > 0) {
+		return network_connection_events(_connection->network, _connection,
+		                                 EPOLLIN | EPOLLOUT | EPOLLET);
+	}
+
+	return 0;
+}
+
+int32_t connection_broadcast(const connection_t *connections, size_t num_connections,
+                             network_buffer_t buffer)
+{
+	int32_t retval = 0;
+	size_t i;
+
+	for (i = 0; i < num_connections; ++i) {
+		struct connection_data_t *connection = (struct connection_data_t *)connections[i];
+		uint8_t idle = connection->send_queue.len == 0;
+
+		/* Closed and dropped connections are skipped */
+		if (connection->network == NULL || connection->socket_fd == -1) {
+			continue;
+		}
+
+		/* Staged data is flushed with the broadcasts */
+		if (connection_cork_commit(connection) == -1 ||
+		    send_queue_append(connection, &buffer, 1) == -1) {
+			retval = -1;
+			continue;
+		}
+
+		/* Batched with the other broadcasts of the iteration; a busy socket
+		 * reports itself */
+		if (idle && !connection->flush_pending) {
+			network_flush_add(connection->network, connection);
+		}
+	}
+
+	return retval;
+}
+
+int32_t connection_offload(connection_t connection, network_buffer_t buffer)
+{
+#ifdef PTHREAD
+	struct network_data_t *network = _connection->network;
+	struct offload_worker_t *worker;
+	struct offload_item_t item;
+
+	if (network == NULL || network->workers == NULL) {
+		_fprintf(stderr, "Network has no workers.\n");
+		return -1;
+	}
+
+	if (buffer == 0) {
+		_fprintf(stderr, "Invalid buffer.\n");
+		return -1;
+	}
+
+	/* Results return in order from one worker; any will do with none in flight */
+	if (_connection->work_pending == 0) {
+		_connection->worker = network_worker_select(network);
+	}
+
+	worker = _connection->worker;
+
+	/* Every request needs room for its result */
+	if (worker->pending > worker->requests.mask) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	network_buffer_ref(buffer);
+	item.connection = _connection;
+	item.buffer = _buffer;
+	item.user_data = _connection->user_data;
+	offload_ring_push(&worker->requests, &item);
+	++worker->pending;
+	++_connection->work_pending;
+
+	/* Pairs with the worker announcing itself before checking the ring */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&worker->sleeping, __ATOMIC_RELAXED)) {
+		uint64_t data = 1;
+
+		if (write(worker->wake_fd, &data, sizeof(data)) == -1) {
+			_perror("write()");
+		}
+	}
+
+	return 0;
+#else
+	(void)connection;
+	(void)buffer;
+	_fprintf(stderr, "Workers require PTHREAD.\n");
+	return -1;
+#endif
+}
+
+int32_t connection_pool_acquire(connection_t *connection, const struct connection_attr_t *attr)
+{
+	struct network_data_t *network;
+	struct connection_data_t *ptr;
+	char key[CONNECTION_POOL_KEY];
+
+	if (attr->mode != connection_mode_client) {
+		_fprintf(stderr, "Invalid connection mode: %d\n", attr->mode);
+		return -1;
+	}
+
+	network = (struct network_data_t *)*attr->network;
+	connection_pool_key(attr, key, sizeof(key));
+
+	/* The most recently released is the least likely closed by the peer */
+	for (ptr = network->pool_tail; ptr != NULL; ptr = ptr->pool_prev) {
+		if (ptr->socket_fd != -1 && strcmp(ptr->pool_key, key) == 0) {
+			network_pool_remove(network, ptr);
+			ptr->user_data = attr->user_data;
+			ptr->handlers = attr->handlers;
+			*connection = (connection_t)ptr;
+			return 1;
+		}
+	}
+
+	if (connection_create(connection, attr) == -1) {
+		return -1;
+	}
+
+	ptr = (struct connection_data_t *)*connection;
+	ptr->pool_key = strdup(key);
+
+	if (ptr->pool_key == NULL) {
+		_perror("strdup()");
+		connection_close(*connection);
+		connection_free(*connection);
+		return -1;
+	}
+
+	return 0;
+}
+
+int32_t connection_pool_release(connection_t connection)
+{
+	struct network_data_t *network = _connection->network;
+
+	if (network == NULL || _connection->pool_key == NULL || _connection->pool_idle) {
+		_fprintf(stderr, "Connection not acquired from the pool.\n");
+		return -1;
+	}
+
+	/* Nothing worth keeping */
+	if (_connection->socket_fd == -1 || network->attr.client_pool.max_idle == 0) {
+		connection_close_socket(_connection);
+		return connection_free(connection);
+	}
+
+	/* Make room by closing the least recently used */
+	if (network->num_pooled >= network->attr.client_pool.max_idle) {
+		connection_pool_close(network->pool_head);
+	}
+
+	_connection->want_write = 0;
+	_connection->idle_since = network_time_now();
+	_connection->pool_idle = 1;
+	_connection->pool_prev = network->pool_tail;
+	_connection->pool_next = NULL;
+
+	if (network->pool_tail != NULL) {
+		network->pool_tail->pool_next = _connection;
+	} else {
+		network->pool_head = _connection;
+	}
+
+	network->pool_tail = _connection;
+	++network->num_pooled;
+	return network_pool_arm(network);
+}
+
+int32_t connection_get_info(connection_t connection, struct connection_info_t *info)
+{
+	struct network_data_t *network = _connection->network;
+	int32_t s = 0;
+
+	if (network == NULL) {
+		_fprintf(stderr, "Connection has no network.\n");
+		return -1;
+	}
+
+	if (!connection_info_eligible(_connection)) {
+		_fprintf(stderr, "Not an open TCP connection.\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	_lock(network);
+
+	if (_connection->info.sampled_at == 0) {
+		s = connection_info_sample(network, _connection, network_time_now());
+	}
+
+	*info = _connection->info;
+	_unlock(network);
+	return s;
+}
+
+int32_t network_get_info(network_t network, struct network_info_t *info)
+{
+	memset(info, 0, sizeof(*info));
+	_lock(_network);
+	info->num_sampled = _network->info_count;
+
+	if (_network->info_count > 0) {
+		info->rtt_avg_us = _network->info_rtt_us / _network->info_count;
+	}
+
+	info->unacked = _network->info_unacked;
+	info->lost = _network->info_lost;
+	info->total_retrans = _network->info_retrans;
+	_unlock(_network);
+	return 0;
+}
+
+int32_t network_buffer_create(network_t network, const void *data, size_t len,
+                              network_buffer_t *buffer)
+{
+	struct buffer_pool_t *pool = network != 0 ? _network->buffer_pool : NULL;
+	struct buffer_data_t *ptr;
+
+	/* The pool serves what fits; larger messages come from the heap */
+	if (pool != NULL && len <= pool->buffer_size) {
+		ptr = buffer_pool_get(pool);
+	} else {
+		ptr = buffer_heap_create(len);
+	}
+
+	if (ptr == NULL) {
+		return -1;
+	}
+
+	memcpy(ptr->data, data, len);
+	ptr->len = len;
+	ptr->refs = 1;
+	*buffer = (network_buffer_t)ptr;
+	return 0;
+}
+
+int32_t network_buffer_ref(network_buffer_t buffer)
+{
+	__atomic_add_fetch(&_buffer->refs, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+int32_t network_buffer_unref(network_buffer_t buffer)
+{
+	buffer_release(_buffer);
+	return 0;
+}
+
+const void *network_buffer_data(network_buffer_t buffer, size_t *len)
+{
+	*len = _buffer->len;
+	return _buffer->data;
+}
+
+ssize_t connection_sendto(connection_t connection, const void *data, size_t len,
+                          const struct sockaddr *dest_addr, socklen_t addrlen)
+{
+	ssize_t s;
+#ifdef TLS
+	/* The session is connected; the address is ignored */
+	if (_connection->tls != NULL) {
+		return connection_send(connection, data, len);
+	}
+#endif
+	if (connection_send_ready(_connection) == -1) {
+		return -1;
+	}
+
+	s = sendto(_connection->socket_fd, data, len, 0, dest_addr, addrlen);
+
+	if (s == -1) {
+		_perror("sendto()");
+		return -1;
+	}
+
+	_probe(send, _connection, s);
+	return s;
+}
+
+ssize_t connection_send_fds(connection_t connection, const void *data, size_t len,
+                            const int32_t *fds, size_t num_fds)
+{
+	union {
+		size_t align;
+		uint8_t buf[CMSG_SPACE(sizeof(int32_t) * CONNECTION_MAX_FDS)];
+	} control;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t s;
+
+	if (num_fds > CONNECTION_MAX_FDS) {
+		_fprintf(stderr, "Too many file descriptors: %zu\n", num_fds);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (connection_send_ready(_connection) == -1) {
+		return -1;
+	}
+#ifdef TLS
+	if (_connection->tls != NULL) {
+		_fprintf(stderr, "Descriptors cannot be passed over TLS.\n");
+		errno = EINVAL;
+		return -1;
+	}
+#endif
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = (void *)data;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (num_fds > 0) {
+		struct cmsghdr *cmsg;
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int32_t) * num_fds);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int32_t) * num_fds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int32_t) * num_fds);
+	}
+
+	s = sendmsg(_connection->socket_fd, &msg, 0);
+
+	if (s == -1) {
+		_perror("sendmsg()");
+		return -1;
+	}
+
+	_probe(send, _connection, s);
+	return s;
+}
+
+size_t connection_event_fds(const struct connection_event_t *event,
+                            int32_t *fds, size_t max_fds)
+{
+	struct cmsghdr *cmsg;
+	size_t num_fds = 0;
+
+	if (event->msg == NULL) {
+		return 0;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(event->msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(event->msg, cmsg)) {
+		size_t i, n;
+
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS) {
+			continue;
+		}
+
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int32_t);
+
+		for (i = 0; i < n; ++i) {
+			int32_t fd, taken = -1;
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(fd), sizeof(fd));
+
+			if (fd == -1) {
+				continue;
+			}
+
+			/* Descriptors that do not fit are closed */
+			if (num_fds < max_fds) {
+				fds[num_fds++] = fd;
+			} else {
+				close(fd);
+			}
+
+			/* Handed out once; the loop closes the rest after the callback */
+			memcpy(CMSG_DATA(cmsg) + i * sizeof(fd), &taken, sizeof(taken));
+		}
+	}
+
+	return num_fds;
+}
+
+ssize_t connection_sendfile(connection_t connection, int32_t fd, off_t *offset, size_t count)
+{
+	ssize_t s;
+
+	if (connection_send_ready(_connection) == -1) {
+		return -1;
+	}
+#ifdef TLS
+	if (_connection->tls != NULL) {
+		return connection_tls_sendfile(_connection, fd, offset, count);
+	}
+#endif
+	s = sendfile(_connection->socket_fd, fd, offset, count);
+
+	if (s == -1) {
+		_perror("sendfile()");
+		return -1;
+	}
+
+	_probe(send, _connection, s);
+	return s;
+}
+
+int32_t connection_tls_offload(connection_t connection)
+{
+#ifdef TLS
+	int32_t flags = 0;
+
+	if (_connection->tls == NULL) {
+		return -1;
+	}
+
+	if (BIO_get_ktls_send(SSL_get_wbio(_connection->tls))) {
+		flags |= CONNECTION_TLS_TX;
+	}
+
+	if (BIO_get_ktls_recv(SSL_get_rbio(_connection->tls))) {
+		flags |= CONNECTION_TLS_RX;
+	}
+
+	return flags;
+#else
+	(void)connection;
+	return -1;
+#endif
+}
+
+int32_t network_timer_create(network_timer_t *timer, const struct network_timer_attr_t *attr)
+{
+	struct timer_data_t *ptr;
+	struct network_data_t *network;
+	struct epoll_event event = {0};
+	ptr = malloc(sizeof(*ptr));
+
+	if (ptr == NULL) {
+		_perror("malloc()");
+		return -1;
+	}
+
+	memset(ptr, 0, sizeof(*ptr));
+	ptr->timer_fd = timerfd_create(attr->type == network_timer_type_absolute
+	                               ? CLOCK_REALTIME : CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+	if (ptr->timer_fd == -1) {
+		_perror("timerfd_create()");
+		free(ptr);
+		return -1;
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = ptr;
+	network = (struct network_data_t *)(*attr->network);
+
+	if (epoll_ctl(network->epoll_fd, EPOLL_CTL_ADD,
+	              ptr->timer_fd, &event) == -1) {
+		_perror("epoll_ctl()");
+		close(ptr->timer_fd);
+		free(ptr);
+		return -1;
+	}
+
+	ptr->data_type = data_type_timer;
+	ptr->user_data = attr->user_data;
+	ptr->timer_type = attr->type;
+	*timer = (network_timer_t)ptr;
+	return 0;
+}
+
+int32_t network_timer_free(network_timer_t timer)
+{
+	/* Remove from the event list */
+	close(_timer->timer_fd);
+	/* Free resources */
+	free(_timer);
+	return 0;
+}
+
+int32_t network_timer_start(network_timer_t timer, const struct timespec *value)
+{
+	int32_t flags = 0;
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+
+	if (_timer->timer_type == network_timer_type_periodic) {
+		/* Value specifies expiration interval */
+		spec.it_interval = *value;
+		spec.it_value = *value;
+	} else if (_timer->timer_type == network_timer_type_relative) {
+		/* Expiry time relative to now (expires only once) */
+		spec.it_value = *value;
+	} else if (_timer->timer_type == network_timer_type_absolute) {
+		/* Expiry time as an absolute time (expires only once) */
+		flags = TFD_TIMER_ABSTIME;
+		spec.it_value = *value;
+	} else {
+		_fprintf(stderr, "Invalid timer type: %d\n", _timer->timer_type);
+		return -1;
+	}
+
+	if (timerfd_settime(_timer->timer_fd, flags, &spec, NULL) == -1) {
+		_perror("timerfd_settime()");
+		return -1;
+	}
+
+	return 0;
+}
+
+int32_t network_timer_cancel(network_timer_t timer)
+{
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+
+	if (timerfd_settime(_timer->timer_fd, 0, &spec, NULL) == -1) {
+		_perror("timerfd_settime()");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int32_t network_ipc_create(struct network_data_t *network)
+{
+	struct connection_data_t *conn;
+	struct epoll_event event = {0};
+	conn = malloc(sizeof(*conn));
+
+	if (conn == NULL) {
+		_perror("malloc()");
+		return -1;
+	}
+
+	memset(conn, 0, sizeof(*conn));
 	conn->data_type = data_type_connection;
 	conn->socket_fd = eventfd(0, EFD_NONBLOCK);
 
-	if (conn->socket_fd == -1) {
-		_perror("eventfd()");
-		free(conn);
-		return -1;
+	if (conn->socket_fd == -1) {
+		_perror("eventfd()");
+		free(conn);
+		return -1;
+	}
+
+	event.data.ptr = conn;
+	event.events = EPOLLIN | EPOLLET;
+
+	if (epoll_ctl(network->epoll_fd, EPOLL_CTL_ADD,
+	              conn->socket_fd, &event) == -1) {
+		_perror("epoll_ctl()");
+		free(conn);
+		return -1;
+	}
+
+	network->ipc = conn;
+	return 0;
+}
+
+static int32_t network_socket_create(struct connection_data_t *connection, const struct connection_attr_t *attr,
+                                     const void *data, size_t len)
+{
+	struct addrinfo *rp, *result, unix_info;
+	struct sockaddr_un unix_addr;
+	ssize_t sent = 0;
+	int32_t s;
+
+	if (attr->hints.ai_family == AF_UNIX) {
+		/* Local sockets are addressed by a path; no resolution needed */
+		if (network_socket_unix(&unix_info, &unix_addr, attr) == -1) {
+			return -1;
+		}
+
+		result = &unix_info;
+	} else {
+		s = getaddrinfo(attr->hostname, attr->service, &attr->hints, &result);
+
+		if (s != 0) {
+			_fprintf(stderr, "getaddrinfo(): %s\n", gai_strerror(s));
+			return -1;
+		}
+	}
+
+	for (rp = result; rp != NULL; rp = rp->ai_next) {
+		connection->socket_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+
+		if (connection->socket_fd == -1) {
+			continue;
+		}
+
+		if (network_socket_non_blocking(connection->socket_fd) == -1) {
+			close(connection->socket_fd);
+			continue;
+		}
+
+		/* Options take effect before the handshake and the listen queue */
+		if (network_socket_options(connection->socket_fd, rp, attr) == -1) {
+			close(connection->socket_fd);
+			continue;
+		}
+
+		if (attr->mode == connection_mode_client) {
+			sent = network_socket_connect(connection->socket_fd, rp, attr, data, len);
+			s = sent == -1 ? -1 : 0;
+		} else if (attr->mode == connection_mode_server) {
+			s = network_socket_bind(connection->socket_fd, rp);
+		} else {
+			_fprintf(stderr, "Invalid connection mode: %d\n", attr->mode);
+			s = -1;
+		}
+
+		if (s == 0) {
+			connection->socktype = rp->ai_socktype;
+			connection->family = rp->ai_family;
+			break;
+		}
+
+		close(connection->socket_fd);
+	}
+
+	if (result != &unix_info) {
+		freeaddrinfo(result);
+	}
+
+	if (rp == NULL) {
+		_fprintf(stderr, "Creating socket failed.\n");
+		return -1;
+	}
+
+	/* What did not fit in the SYN is sent once connected */
+	if (data != NULL && (size_t)sent < len) {
+		connection->payload = malloc(len - sent);
+
+		if (connection->payload == NULL) {
+			_perror("malloc()");
+			close(connection->socket_fd);
+			return -1;
+		}
+
+		memcpy(connection->payload, (const uint8_t *)data + sent, len - sent);
+		connection->payload_len = len - sent;
+	}
+
+	return 0;
+}
+
+static int32_t network_socket_unix(struct addrinfo *result, struct sockaddr_un *addr,
+                                   const struct connection_attr_t *attr)
+{
+	size_t len = strnlen(attr->hostname, sizeof(attr->hostname));
+
+	if (len == 0 || len >= sizeof(addr->sun_path)) {
+		_fprintf(stderr, "Invalid socket path: %.*s\n", (int)len, attr->hostname);
+		return -1;
+	}
+
+	memset(result, 0, sizeof(*result));
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	memcpy(addr->sun_path, attr->hostname, len);
+
+	/* A leading '@' denotes a name in the abstract namespace */
+	if (addr->sun_path[0] == '@') {
+		addr->sun_path[0] = '\0';
+		result->ai_addrlen = offsetof(struct sockaddr_un, sun_path) + len;
+	} else {
+		result->ai_addrlen = sizeof(*addr);
+	}
+
+	result->ai_family = AF_UNIX;
+	result->ai_socktype = attr->hints.ai_socktype;
+	result->ai_addr = (struct sockaddr *)addr;
+	return 0;
+}
+
+static ssize_t network_socket_connect(int32_t socket_fd, struct addrinfo *result, const struct connection_attr_t *attr,
+                                      const void *data, size_t len)
+{
+	ssize_t s;
+
+	if (attr->src_addrlen > 0) {
+		/* Bind to a source address/port if given by the user */
+		if (bind(socket_fd, attr->src_addr, attr->src_addrlen) == -1) {
+			_perror("bind()");
+			return -1;
+		}
+	}
+
+	if (len > 0 && result->ai_socktype == SOCK_STREAM &&
+	    (result->ai_family == AF_INET || result->ai_family == AF_INET6)) {
+		/* The payload rides on the SYN if the server has given a cookie */
+		s = sendto(socket_fd, data, len, MSG_FASTOPEN | MSG_NOSIGNAL,
+		           result->ai_addr, result->ai_addrlen);
+
+		if (s >= 0) {
+			return s;
+		}
+
+		/* No cookie yet; it was requested with the SYN */
+		if (errno == EINPROGRESS) {
+			return 0;
+		}
+
+		if (errno != EOPNOTSUPP) {
+			_perror("sendto()");
+			return -1;
+		}
+
+		/* Fast Open is disabled; connect as usual */
+	}
+
+	if (connect(socket_fd, result->ai_addr, result->ai_addrlen) == -1) {
+		if (errno != EINPROGRESS) {
+			_perror("connect()");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int32_t network_socket_options(int32_t socket_fd, struct addrinfo *result,
+                                      const struct connection_attr_t *attr)
+{
+	const struct connection_sockopts_t *opts = &attr->sockopts;
+
+	if (opts->rcvbuf > 0 &&
+	    network_socket_option(socket_fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf) == -1) {
+		return -1;
+	}
+
+	if (opts->sndbuf > 0 &&
+	    network_socket_option(socket_fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf) == -1) {
+		return -1;
+	}
+
+	if (opts->tos > 0) {
+		if (result->ai_family == AF_INET &&
+		    network_socket_option(socket_fd, IPPROTO_IP, IP_TOS, opts->tos) == -1) {
+			return -1;
+		}
+
+		if (result->ai_family == AF_INET6 &&
+		    network_socket_option(socket_fd, IPPROTO_IPV6, IPV6_TCLASS, opts->tos) == -1) {
+			return -1;
+		}
+	}
+
+	/* The sockets of the peers share the address of the listener */
+	if (attr->udp_flows && attr->mode == connection_mode_server &&
+	    (network_socket_option(socket_fd, SOL_SOCKET, SO_REUSEADDR, 1) == -1 ||
+	     network_socket_option(socket_fd, SOL_SOCKET, SO_REUSEPORT, 1) == -1)) {
+		return -1;
+	}
+
+	if (result->ai_socktype != SOCK_STREAM ||
+	    (result->ai_family != AF_INET && result->ai_family != AF_INET6)) {
+		return 0;
+	}
+
+	if (opts->nodelay &&
+	    network_socket_option(socket_fd, IPPROTO_TCP, TCP_NODELAY, 1) == -1) {
+		return -1;
+	}
+
+	/* Accepted sockets inherit the options of the listener */
+	if (attr->mode == connection_mode_server) {
+		if (opts->fastopen > 0 &&
+		    network_socket_option(socket_fd, IPPROTO_TCP, TCP_FASTOPEN, opts->fastopen) == -1) {
+			return -1;
+		}
+
+		if (opts->defer_accept > 0 &&
+		    network_socket_option(socket_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+		                          opts->defer_accept) == -1) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int32_t network_socket_timestamping(int32_t socket_fd, uint32_t timestamping)
+{
+	int32_t flags = SOF_TIMESTAMPING_SOFTWARE;
+
+	if (timestamping & CONNECTION_TIMESTAMP_RX) {
+		flags |= SOF_TIMESTAMPING_RX_SOFTWARE;
+	}
+
+	if (timestamping & CONNECTION_TIMESTAMP_TX_SCHED) {
+		flags |= SOF_TIMESTAMPING_TX_SCHED;
+	}
+
+	if (timestamping & CONNECTION_TIMESTAMP_TX_SEND) {
+		flags |= SOF_TIMESTAMPING_TX_SOFTWARE;
+	}
+
+	if (timestamping & CONNECTION_TIMESTAMP_TX_ACK) {
+		flags |= SOF_TIMESTAMPING_TX_ACK;
+	}
+
+	/* Keyed by the send they belong to, without a copy of the payload */
+	if (timestamping & CONNECTION_TIMESTAMP_TX) {
+		flags |= SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+	}
+
+	return network_socket_option(socket_fd, SOL_SOCKET, SO_TIMESTAMPING, flags);
+}
+
+static void network_msg_timestamp(struct msghdr *msg, struct timespec *timestamp,
+                                  struct sock_extended_err *error)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+			struct scm_timestamping stamps;
+			memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+			/* The software stamp; the others come from the hardware */
+			*timestamp = stamps.ts[0];
+		} else if (error != NULL &&
+		           ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+		            (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+			memcpy(error, CMSG_DATA(cmsg), sizeof(*error));
+		}
+	}
+}
+
+static int32_t handle_connection_errqueue(struct network_data_t *network,
+                                          struct connection_data_t *connection,
+                                          struct connection_event_t *conn_event)
+{
+	int32_t error = 0;
+	socklen_t len = sizeof(error);
+
+	/* The callback may close the connection */
+	while (connection->socket_fd != -1) {
+		struct sock_extended_err ee;
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		memset(&ee, 0, sizeof(ee));
+		msg.msg_control = network->control.buf;
+		msg.msg_controllen = sizeof(network->control.buf);
+
+		if (recvmsg(connection->socket_fd, &msg, MSG_ERRQUEUE) == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+
+			_perror("recvmsg()");
+			return -1;
+		}
+
+		network_msg_timestamp(&msg, &conn_event->timestamp, &ee);
+
+		/* Anything else on the queue is a real error (e.g. ICMP) */
+		if (ee.ee_origin != SO_EE_ORIGIN_TIMESTAMPING || ee.ee_errno != ENOMSG) {
+			memset(&conn_event->timestamp, 0, sizeof(conn_event->timestamp));
+			return -1;
+		}
+
+		conn_event->timestamp_type = ee.ee_info;
+		conn_event->timestamp_key = ee.ee_data;
+		conn_event->data_len = conn_event->addr_len = 0;
+		conn_event->msg = NULL;
+		conn_event->user_data = connection->user_data;
+		conn_event->event_type = connection_event_tx_timestamp;
+		network_dispatch(network, connection, conn_event);
+		memset(&conn_event->timestamp, 0, sizeof(conn_event->timestamp));
+		conn_event->timestamp_type = conn_event->timestamp_key = 0;
+	}
+
+	/* The queue may not have been the only cause of EPOLLERR */
+	if (connection->socket_fd != -1 &&
+	    getsockopt(connection->socket_fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 &&
+	    error != 0) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int32_t network_socket_option(int32_t socket_fd, int32_t level,
+                                     int32_t name, int32_t value)
+{
+	if (setsockopt(socket_fd, level, name, &value, sizeof(value)) == -1) {
+		_perror("setsockopt()");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int32_t network_socket_bind(int32_t socket_fd, struct addrinfo *result)
+{
+	if (bind(socket_fd, result->ai_addr, result->ai_addrlen) == -1) {
+		_perror("bind()");
+		return -1;
+	}
+
+	/* Listen only STREAM and SEQPACKET sockets */
+	if (result->ai_socktype != SOCK_STREAM &&
+	    result->ai_socktype != SOCK_SEQPACKET) {
+		return 0;
+	}
+
+	if (listen(socket_fd, SOMAXCONN) == -1) {
+		_perror("listen()");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int32_t network_socket_non_blocking(int32_t socket_fd)
+{
+	int32_t flags = fcntl(socket_fd, F_GETFL, 0);
+
+	if (flags == -1) {
+		_perror("fcntl()");
+		return -1;
+	}
+
+	if (fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		_perror("fcntl()");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *network_eventloop(void *args)
+{
+	struct epoll_event event = {0};
+	struct connection_event_t conn_event = {0};
+	struct network_data_t *network;
+	sigset_t *wait_maskp = NULL;
+#ifdef PTHREAD
+	sigset_t wait_mask;
+#endif
+	network = (struct network_data_t *)args;
+	network->num_events = network->attr.max_events > 0
+	                      ? network->attr.max_events : SOMAXCONN;
+	network->full_wakeups = network->sparse_wakeups = 0;
+	network->loop_retval = 0;
+#ifdef PTHREAD
+	network->loop_thread = pthread_self();
+#endif
+
+	if (network->attr.adaptive_events) {
+		/* Start small and grow under load */
+		uint32_t min_events = network->attr.min_events > 0
+		                      ? network->attr.min_events : NETWORK_MIN_EVENTS;
+
+		if (min_events < network->num_events) {
+			network->num_events = min_events;
+		}
+	}
+
+	network->events = calloc(network->num_events, sizeof(event));
+
+	if (network->events == NULL) {
+		network->loop_retval = -1;
+		_perror("calloc()");
+		return NULL;
+	}
+
+	conn_event.data_buffer = network->attr.data_buffer;
+
+	if (network_info_start(network) == -1) {
+		network->loop_retval = -1;
+		free(network->events);
+		network->events = NULL;
+		return NULL;
+	}
+
+#ifdef PTHREAD
+
+	if (network_watchdog_start(network) == -1) {
+		network->loop_retval = -1;
+		free(network->events);
+		network->events = NULL;
+		return NULL;
+	}
+
+	if (network_workers_start(network) == -1) {
+		network_watchdog_stop(network);
+		network->loop_retval = -1;
+		free(network->events);
+		network->events = NULL;
+		return NULL;
+	}
+
+	/* A backtrace requested after the callback returned must not end the wait */
+	if (network->attr.watchdog.backtrace_signal != 0) {
+		pthread_sigmask(SIG_BLOCK, NULL, &wait_mask);
+		sigaddset(&wait_mask, network->attr.watchdog.backtrace_signal);
+		wait_maskp = &wait_mask;
+	}
+
+#endif
+
+	while (1) {
+		struct epoll_event *events = network->events;
+		uint8_t ipc_pending = 0;
+		/* Deferred connections are served without waiting */
+		int32_t i, j = epoll_pwait(network->epoll_fd, events, network->num_events,
+		                           network->num_deferred > 0 || network->flushed != NULL
+		                           ? 0 : network_drain_timeout(network), wait_maskp);
+		_probe(wakeup, network, j);
+
+		if (j == -1) {
+			/* A signal handler may have requested draining */
+			if (errno == EINTR &&
+			    __atomic_load_n(&network->drain_deadline, __ATOMIC_ACQUIRE) != 0) {
+				continue;
+			}
+
+			/* Error or interrupt occurred */
+			if (errno != EINTR) {
+				network->loop_retval = -1;
+				_perror("epoll_pwait()");
+			}
+
+			break;
+		}
+
+		++network->round;
+		network->batching = 1;
+		network_events_order(network, events, j);
+
+		for (i = 0; i < j; ++i) {
+			struct connection_data_t *connection = events[i].data.ptr;
+
+			if (connection == network->ipc) {
+				uint64_t data;
+
+				/* A stop request ends the event loop immediately */
+				if (__atomic_load_n(&network->stopped, __ATOMIC_ACQUIRE)) {
+					goto END;
+				}
+
+				if (read(connection->socket_fd, &data, sizeof(data)) == -1 &&
+				    errno != EAGAIN) {
+					_perror("read()");
+				}
+
+				/* Queued messages are handled after the batch */
+				ipc_pending = 1;
+				continue;
+			}
+
+			if (connection->data_type == data_type_connection) {
+				++connection->load;
+
+				/* Closed by the application; only the queued data is left */
+				if (connection->lingering) {
+					connection_linger_event(connection, events[i].events);
+					continue;
+				}
+			}
+
+			__atomic_store_n(&network->load, network->load + 1, __ATOMIC_RELAXED);
+
+			/* Transmit timestamps are queued as errors; drain them first */
+			if ((events[i].events & EPOLLERR) && !(events[i].events & EPOLLHUP) &&
+			    connection->data_type == data_type_connection &&
+			    (connection->timestamping & CONNECTION_TIMESTAMP_TX) &&
+			    handle_connection_errqueue(network, connection, &conn_event) == 0) {
+				events[i].events &= ~EPOLLERR;
+			}
+
+			if ((events[i].events & EPOLLERR) ||
+			    (events[i].events & EPOLLHUP)) {
+				/* Error occurred; close the connection */
+				connection_close_socket(connection);
+				conn_event.user_data = connection->user_data;
+				conn_event.data_len = conn_event.addr_len = 0;
+				conn_event.event_type = connection_event_connection_error;
+				network_dispatch(network, connection, &conn_event);
+			} else if ((events[i].events & EPOLLOUT) &&
+			           (connection->want_write || connection->send_queue.len > 0)) {
+				/* Established connection can be written to again */
+				handle_connection_writable(network, connection, &conn_event,
+				                           events[i].events);
+			} else if (events[i].events & EPOLLOUT) {
+#ifdef TLS
+				/* The session reports itself once the handshake completes */
+				if (connection->tls != NULL) {
+					handle_tls_handshake(network, connection, &conn_event);
+					continue;
+				}
+#endif
+				/* Outgoing connection succeeded */
+				event.events = EPOLLIN | EPOLLET;
+				event.data.ptr = connection;
+
+				/* Remove EPOLLOUT so that we don't receive it again */
+				if (epoll_ctl(network->epoll_fd, EPOLL_CTL_MOD,
+				              connection->socket_fd, &event) == -1) {
+					_perror("epoll_ctl()");
+					continue;
+				}
+
+				connection->events = event.events;
+
+				if (connection->payload != NULL &&
+				    connection_send_payload(connection) == -1) {
+					connection_close_socket(connection);
+					conn_event.user_data = connection->user_data;
+					conn_event.data_len = conn_event.addr_len = 0;
+					conn_event.event_type = connection_event_connection_error;
+					network_dispatch(network, connection, &conn_event);
+					continue;
+				}
+
+				conn_event.data_len = conn_event.addr_len = 0;
+				conn_event.user_data = connection->user_data;
+				conn_event.event_type = connection_event_connection_created;
+				network_dispatch(network, connection, &conn_event);
+			} else if (events[i].events & EPOLLIN) {
+				/* Handle timer expiration event if data type is timer */
+				if (connection->data_type == data_type_timer) {
+					handle_timer(network, (struct timer_data_t *)connection);
+					continue;
+				}
+
+				if (connection->mode == connection_mode_server &&
+				    (connection->socktype == SOCK_STREAM ||
+				     connection->socktype == SOCK_SEQPACKET)) {
+					/* New connection on a connection-oriented socket */
+					handle_connection_accept(network, connection, &conn_event);
+				}
+#ifdef TLS
+				else if (connection->tls != NULL && connection->tls_handshake) {
+					handle_tls_handshake(network, connection, &conn_event);
+				}
+#endif
+				else {
+					/* Data from an existing connection */
+					handle_connection_data(network, connection, &conn_event);
+				}
+			}
+		}
+
+		if (network->num_deferred > 0) {
+			network_deferred_process(network, &conn_event);
+		}
+
+#ifdef PTHREAD
+
+		/* Workers wake the loop through the IPC eventfd */
+		if (ipc_pending && network->workers != NULL) {
+			network_offload_process(network, &conn_event);
+		}
+
+#endif
+
+		if (ipc_pending) {
+			network_ipc_process(network, &conn_event);
+		}
+
+		if (network->num_paused > 0 && !network->draining) {
+			network_accept_resume(network, &conn_event);
+		}
+
+		if (!network->draining &&
+		    __atomic_load_n(&network->drain_deadline, __ATOMIC_ACQUIRE) != 0) {
+			network_drain_start(network, &conn_event);
+		}
+
+		/* Written before the loop waits again */
+		if (network->flushed != NULL) {
+			network_flush_process(network, &conn_event);
+		}
+
+		network->batching = 0;
+
+		/* Drained once every connection is closed or the deadline passes */
+		if (network->draining && network_drain_check(network, &conn_event)) {
+			break;
+		}
+
+		if (network->attr.adaptive_events) {
+			network_events_adapt(network, j);
+		}
+	}
+
+END:
+	network->batching = 0;
+#ifdef PTHREAD
+	network_workers_stop(network);
+	network_watchdog_stop(network);
+#endif
+	free(network->events);
+	network->events = NULL;
+	return NULL;
+}
+
+static void network_connection_link(struct network_data_t *network,
+                                    struct connection_data_t *connection)
+{
+	_lock(network);
+	connection->network = network;
+	connection->prev = NULL;
+	connection->next = network->connections;
+
+	if (network->connections != NULL) {
+		network->connections->prev = connection;
+	}
+
+	network->connections = connection;
+	_unlock(network);
+}
+
+static void network_connection_unlink(struct network_data_t *network,
+                                      struct connection_data_t *connection)
+{
+	_lock(network);
+	network_info_remove(network, connection);
+
+	/* The sampler continues from the next one */
+	if (network->info_next == connection) {
+		network->info_next = connection->next;
+	}
+
+	if (connection->prev != NULL) {
+		connection->prev->next = connection->next;
+	} else if (network->connections == connection) {
+		network->connections = connection->next;
+	}
+
+	if (connection->next != NULL) {
+		connection->next->prev = connection->prev;
+	}
+
+	connection->prev = connection->next = NULL;
+	_unlock(network);
+}
+
+static int32_t network_ipc_post(struct network_data_t *network, struct ipc_message_t *message)
+{
+	uint64_t data = 1;
+	message->next = NULL;
+	_lock(network);
+
+	if (network->ipc_tail != NULL) {
+		network->ipc_tail->next = message;
+	} else {
+		network->ipc_head = message;
+	}
+
+	network->ipc_tail = message;
+	_unlock(network);
+
+	/* Wake up the event loop; the message stays queued on failure */
+	if (write(network->ipc->socket_fd, &data, sizeof(data)) == -1) {
+		_perror("write()");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void network_ipc_process(struct network_data_t *network,
+                                struct connection_event_t *conn_event)
+{
+	struct ipc_message_t *message;
+	_lock(network);
+	message = network->ipc_head;
+	network->ipc_head = network->ipc_tail = NULL;
+	_unlock(network);
+
+	while (message != NULL) {
+		struct ipc_message_t *next = message->next;
+
+		switch (message->type) {
+			case ipc_message_migrate:
+				/* Ignore stale requests for connections owned by another loop */
+				if (message->connection->network == network) {
+					network_connection_detach(network, message->connection,
+					                          message->network);
+				}
+
+				break;
+
+			case ipc_message_attach:
+				network_connection_attach(network, message->connection, conn_event);
+				break;
+
+			case ipc_message_rebalance:
+				network_rebalance_select(network, message);
+				break;
+
+			default:
+				_fprintf(stderr, "Invalid IPC message: %d\n", message->type);
+				break;
+		}
+
+		free(message);
+		message = next;
+	}
+}
+
+static int32_t network_connection_detach(struct network_data_t *network,
+                                         struct connection_data_t *connection,
+                                         struct network_data_t *destination)
+{
+	struct ipc_message_t *message;
+
+	/* The results of the workers return to this loop */
+	if (connection->work_pending > 0) {
+		_fprintf(stderr, "Connection has work in flight.\n");
+		return -1;
+	}
+
+	message = malloc(sizeof(*message));
+
+	if (message == NULL) {
+		_perror("malloc()");
+		return -1;
+	}
+
+	if (epoll_ctl(network->epoll_fd, EPOLL_CTL_DEL,
+	              connection->socket_fd, NULL) == -1) {
+		_perror("epoll_ctl()");
+		free(message);
+		return -1;
+	}
+
+	network_throttle_remove(network, connection);
+	network_defer_remove(network, connection);
+	/* Staged data moves with the queue */
+	connection_cork_commit(connection);
+	network_flush_remove(network, connection);
+	network_connection_unlink(network, connection);
+	connection_flows_unlink(connection);
+	connection->network = NULL;
+
+	/* Counted against the limit of the loop serving it */
+	if (__atomic_exchange_n(&connection->accounted, NULL, __ATOMIC_ACQ_REL) != NULL) {
+		__atomic_sub_fetch(&network->num_accepted, 1, __ATOMIC_RELAXED);
+	}
+
+	/* Queued buffers are sent once the destination finds the socket writable */
+	if (connection->send_queue.len > 0) {
+		connection->events |= EPOLLOUT;
+	}
+
+	if (connection->accept_paused) {
+		__atomic_sub_fetch(&network->num_paused, 1, __ATOMIC_RELAXED);
+	}
+
+	/* Hand the connection over to the destination loop */
+	memset(message, 0, sizeof(*message));
+	message->type = ipc_message_attach;
+	message->connection = connection;
+	network_ipc_post(destination, message);
+	return 0;
+}
+
+static void network_connection_attach(struct network_data_t *network,
+                                      struct connection_data_t *connection,
+                                      struct connection_event_t *conn_event)
+{
+	struct epoll_event event = {0};
+	event.events = connection->events;
+	event.data.ptr = connection;
+	network_connection_link(network, connection);
+	connection->load = 0;
+	conn_event->data_len = conn_event->addr_len = 0;
+
+	if (connection->mode == connection_mode_server && connection->counter != NULL) {
+		__atomic_store_n(&connection->counter->network, network, __ATOMIC_RELEASE);
+
+		/* Resumed at the end of the batch if below the limits */
+		if (connection->accept_paused) {
+			__atomic_add_fetch(&network->num_paused, 1, __ATOMIC_RELAXED);
+		}
+	} else if (connection->counter != NULL) {
+		__atomic_add_fetch(&network->num_accepted, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&connection->accounted, network, __ATOMIC_RELEASE);
+	}
+
+	conn_event->user_data = connection->user_data;
+
+	/* Pending input is reported right away by the registration */
+	if (epoll_ctl(network->epoll_fd, EPOLL_CTL_ADD,
+	              connection->socket_fd, &event) == -1) {
+		_perror("epoll_ctl()");
+		conn_event->event_type = connection_event_connection_error;
+	} else {
+		conn_event->event_type = connection_event_connection_migrated;
+	}
+
+	network_dispatch(network, connection, conn_event);
+}
+
+static void network_rebalance_select(struct network_data_t *network,
+                                     const struct ipc_message_t *message)
+{
+	struct connection_data_t *connection;
+	uint64_t moved = 0;
+	size_t i;
+
+	/* Detach the busiest connections until about half of the excess load moves */
+	for (i = 0; i < message->max_connections && moved < message->load; ++i) {
+		struct connection_data_t *busiest = NULL;
+		uint64_t load;
+
+		/* Other threads may create connections meanwhile */
+		_lock(network);
+
+		for (connection = network->connections; connection != NULL;
+		     connection = connection->next) {
+			if (connection->mode == connection_mode_server || connection->pool_idle ||
+			    connection->work_pending > 0 || connection->lingering) {
+				continue;
+			}
+
+			if (connection->load > 0 && (busiest == NULL ||
+			                             connection->load > busiest->load)) {
+				busiest = connection;
+			}
+		}
+
+		_unlock(network);
+
+		if (busiest == NULL || (moved > 0 && moved + busiest->load > message->load)) {
+			break;
+		}
+
+		/* Owned by the destination once detached */
+		load = busiest->load;
+
+		/* Left out for the rest of the period if it cannot move */
+		if (network_connection_detach(network, busiest, message->network) == -1) {
+			busiest->load = 0;
+			continue;
+		}
+
+		moved += load;
+	}
+
+	/* Start a new sampling period */
+	_lock(network);
+
+	for (connection = network->connections; connection != NULL;
+	     connection = connection->next) {
+		connection->load = 0;
+	}
+
+	_unlock(network);
+}
+
+static void network_events_adapt(struct network_data_t *network, int32_t num_ready)
+{
+	struct epoll_event *events;
+	uint32_t num_events = network->num_events;
+	uint32_t max_events = network->attr.max_events > 0
+	                      ? network->attr.max_events : SOMAXCONN;
+	uint32_t min_events = network->attr.min_events > 0
+	                      ? network->attr.min_events : NETWORK_MIN_EVENTS;
+
+	if (min_events > max_events) {
+		min_events = max_events;
+	}
+
+	if ((uint32_t)num_ready >= num_events) {
+		/* Full array; more events are likely waiting */
+		network->sparse_wakeups = 0;
+
+		if (++network->full_wakeups < NETWORK_ADAPT_WAKEUPS) {
+			return;
+		}
+
+		num_events = num_events * 2 < max_events ? num_events * 2 : max_events;
+	} else if ((uint32_t)num_ready < num_events / 4) {
+		/* Mostly empty array; shrink to keep the batches short */
+		network->full_wakeups = 0;
+
+		if (++network->sparse_wakeups < NETWORK_ADAPT_WAKEUPS) {
+			return;
+		}
+
+		num_events = num_events / 2 > min_events ? num_events / 2 : min_events;
+	} else {
+		network->full_wakeups = network->sparse_wakeups = 0;
+		return;
+	}
+
+	network->full_wakeups = network->sparse_wakeups = 0;
+
+	if (num_events == network->num_events) {
+		return;
+	}
+
+	events = realloc(network->events, num_events * sizeof(*events));
+
+	if (events == NULL) {
+		/* Keep using the current array */
+		_perror("realloc()");
+		return;
+	}
+
+	network->events = events;
+	network->num_events = num_events;
+}
+
+static void handle_connection_data(struct network_data_t *network,
+                                   struct connection_data_t *connection,
+                                   struct connection_event_t *conn_event)
+{
+	struct connection_data_t *target;
+	int32_t closed = 0;
+	uint32_t reads = 0, max_reads = network->attr.priority_reads[connection->priority];
+	uint8_t limited = connection->rate_limit.bytes_per_sec > 0 ||
+	                  connection->rate_limit.messages_per_sec > 0;
+
+	/* Reading resumes from the throttle timer or in its turn when deferred */
+	if (connection->throttled || connection->deferred) {
+		return;
+	}
+
+	while (1) {
+		struct sockaddr_storage in_addr;
+		socklen_t in_len = sizeof(in_addr);
+		void *buffer = network->attr.data_buffer;
+		size_t len = network->attr.buffer_len;
+		struct buffer_data_t *pooled = NULL;
+		struct msghdr msg;
+		struct iovec iov;
+		ssize_t count;
+
+		/* Leave the rest to the next wakeup, after the higher classes */
+		if (max_reads > 0 && reads == max_reads) {
+			network_defer(network, connection);
+			break;
+		}
+
+		if (connection->ring.base != NULL) {
+			struct ring_buffer_t *ring = &connection->ring;
+
+			/* The free space is contiguous through the second mapping */
+			buffer = ring->base + ring->head + ring->len;
+			len = ring->size - ring->len;
+
+			/* Reading resumes from connection_consume() */
+			if (len == 0) {
+				ring->stalled = 1;
+				break;
+			}
+		} else if (network->buffer_pool != NULL) {
+			/* The buffer of the previous read is reused unless it was kept */
+			if (network->spare_buffer == NULL) {
+				network->spare_buffer = buffer_pool_get(network->buffer_pool);
+			}
+
+			pooled = network->spare_buffer;
+
+			if (pooled != NULL) {
+				buffer = pooled->data;
+				len = network->buffer_pool->buffer_size;
+			}
+		}
+
+		if (limited) {
+			uint64_t resume_at = rate_limit_check(network, connection, &len);
+
+			/* Out of tokens; leave the data to the socket buffer. Without
+			 * a timer to resume reading, keep reading rather than stall. */
+			if (resume_at > 0 && network_throttle(network, connection, resume_at) == 0) {
+				break;
+			}
+		}
+
+#ifdef TLS
+		if (connection->tls != NULL) {
+			size_t n = 0;
+			ERR_clear_error();
+			count = SSL_read_ex(connection->tls, buffer, len, &n);
+			count = connection_tls_result(connection, count, n);
+			conn_event->msg = NULL;
+		} else
+#endif
+		if (connection->socktype == SOCK_SEQPACKET ||
+		    connection->family == AF_UNIX ||
+		    (connection->timestamping & CONNECTION_TIMESTAMP_RX)) {
+			/* Receive the ancillary data (e.g. passed descriptors) as well */
+			memset(&msg, 0, sizeof(msg));
+			iov.iov_base = buffer;
+			iov.iov_len = len;
+			msg.msg_name = &in_addr;
+			msg.msg_namelen = in_len;
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = network->control.buf;
+			msg.msg_controllen = sizeof(network->control.buf);
+			count = recvmsg(connection->socket_fd, &msg, MSG_CMSG_CLOEXEC);
+			conn_event->msg = &msg;
+			in_len = msg.msg_namelen;
+		} else {
+			/* Structure in_addr is ignored with connection-oriented sockets */
+			count = recvfrom(connection->socket_fd, buffer,
+			                 len, 0, (struct sockaddr *)&in_addr, &in_len);
+			conn_event->msg = NULL;
+		}
+
+		_probe(recv, network, connection, count);
+
+		if (count == -1) {
+			/* Closed by the user? */
+			if (errno == EBADF) {
+				closed = 1;
+				break;
+			}
+
+			/* No more data to read; break the loop */
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+#ifdef TLS
+				/* The session has a record to send first (e.g. a key update) */
+				if (connection->tls != NULL && SSL_want_write(connection->tls)) {
+					network_connection_events(network, connection,
+					                          EPOLLIN | EPOLLOUT | EPOLLET);
+				}
+#endif
+				break;
+			}
+
+			_perror("recv()");
+			closed = 1;
+			break;
+		} else if (count == 0) {
+			/* Closed by the remote host */
+			connection_event_fds(conn_event, NULL, 0);
+			closed = 1;
+			break;
+		}
+
+		if (limited) {
+			connection->bucket.bytes -= count * NSEC_PER_SEC;
+			connection->bucket.messages -= NSEC_PER_SEC;
+		}
+
+		target = connection;
+
+		/* Datagrams reaching the listener come from new peers, or those
+		 * queued before the socket of the peer was connected */
+		if (connection->udp_flows) {
+			target = network_flow_find(connection, &in_addr);
+
+			if (target == NULL) {
+				target = network_flow_accept(network, connection, &in_addr, in_len, conn_event);
+			}
+
+			if (target == NULL) {
+				target = connection;
+			}
+		}
+
+		conn_event->data_len = count;
+
+		if (connection->ring.base != NULL) {
+			/* All the unread data, not just what arrived */
+			connection->ring.len += count;
+			conn_event->data_buffer = connection->ring.base + connection->ring.head;
+			conn_event->data_len = connection->ring.len;
+		}
+
+		/* The callback holds the reference of the loop */
+		if (pooled != NULL) {
+			network->spare_buffer = NULL;
+			pooled->len = count;
+			pooled->refs = 1;
+			conn_event->buffer = (network_buffer_t)pooled;
+			conn_event->data_buffer = pooled->data;
+		}
+
+		if (conn_event->msg != NULL) {
+			network_msg_timestamp(&msg, &conn_event->timestamp, NULL);
+		}
+
+		conn_event->addr_len = in_len;
+		conn_event->addr = (struct sockaddr *)&in_addr;
+		conn_event->user_data = target->user_data;
+		conn_event->event_type = connection_event_data_received;
+		network_dispatch(network, target, conn_event);
+		conn_event->data_buffer = network->attr.data_buffer;
+		memset(&conn_event->timestamp, 0, sizeof(conn_event->timestamp));
+		/* Descriptors the callback did not take */
+		connection_event_fds(conn_event, NULL, 0);
+		conn_event->msg = NULL;
+		++reads;
+
+		if (pooled != NULL) {
+			conn_event->buffer = 0;
+
+			/* Not kept by the callback; read into it again */
+			if (__atomic_sub_fetch(&pooled->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+				if (network->spare_buffer == NULL) {
+					network->spare_buffer = pooled;
+				} else {
+					buffer_pool_put(pooled);
+				}
+			}
+		}
+	}
+
+	conn_event->msg = NULL;
+
+	if (closed) {
+		connection_close_socket(connection);
+		conn_event->data_len = conn_event->addr_len = 0;
+		conn_event->user_data = connection->user_data;
+		conn_event->event_type = connection_event_connection_closed;
+		network_dispatch(network, connection, conn_event);
+	}
+}
+
+static void handle_connection_accept(struct network_data_t *network,
+                                     struct connection_data_t *connection,
+                                     struct connection_event_t *conn_event)
+{
+	/* Accepting resumes at the end of a batch */
+	if (connection->accept_paused) {
+		return;
+	}
+
+	while (1) {
+		struct connection_data_t *ptr;
+		struct sockaddr_storage in_addr;
+		socklen_t in_len = sizeof(in_addr);
+		int32_t socket_fd;
+
+		if (network_accept_limited(network, connection, 0)) {
+			/* Leave the rest to the backlog until connections close */
+			connection->accept_paused = 1;
+			__atomic_add_fetch(&network->num_paused, 1, __ATOMIC_RELAXED);
+			conn_event->data_len = conn_event->addr_len = 0;
+			conn_event->user_data = connection->user_data;
+			conn_event->event_type = connection_event_accept_paused;
+			network_dispatch(network, connection, conn_event);
+			break;
+		}
+
+		socket_fd = accept(connection->socket_fd, (struct sockaddr *)&in_addr, &in_len);
+
+		if (socket_fd == -1) {
+			/* Closed by the user? */
+			if (errno == EBADF) {
+				break;
+			}
+
+			/* No more incoming connections; break the loop */
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+
+			/* The peer gave up before accept(); try the next one */
+			if (errno == ECONNABORTED || errno == EINTR) {
+				continue;
+			}
+
+			if ((errno == EMFILE || errno == ENFILE) && network->reserve_fd != -1) {
+				/* The edge is lost if the backlog is left as is */
+				network_accept_shed(network, connection, conn_event);
+				break;
+			}
+
+			_perror("accept()");
+			break;
+		}
+
+		ptr = network_connection_accept(network, connection, socket_fd);
+
+		if (ptr == NULL) {
+			break;
+		}
+
+		_probe(accept, network, connection, ptr);
+
+		conn_event->data_len = 0;
+		conn_event->addr_len = in_len;
+		conn_event->addr = (struct sockaddr *)&in_addr;
+		conn_event->new_connection = (connection_t)ptr;
+		conn_event->user_data = connection->user_data;
+		conn_event->event_type = connection_event_connection_accepted;
+		network_dispatch(network, connection, conn_event);
+	}
+}
+
+static struct connection_data_t *network_connection_accept(struct network_data_t *network,
+                                                           struct connection_data_t *connection,
+                                                           int32_t socket_fd)
+{
+	struct epoll_event event = {0};
+	struct connection_data_t *ptr = malloc(sizeof(*ptr));
+
+	if (ptr == NULL) {
+		_perror("malloc()");
+		close(socket_fd);
+		return NULL;
+	}
+
+	memset(ptr, 0, sizeof(*ptr));
+	ptr->mode = connection_mode_client;
+	ptr->data_type = data_type_connection;
+	ptr->socktype = connection->socktype;
+	ptr->family = connection->family;
+	ptr->socket_fd = socket_fd;
+	ptr->network = network;
+	ptr->handlers = connection->handlers;
+	ptr->priority = connection->priority;
+	ptr->timestamping = connection->timestamping;
+	ptr->backlog = connection->backlog;
+	ptr->auto_cork = connection->auto_cork;
+	rate_limit_init(ptr, &connection->rate_limit);
+
+	if (network_socket_non_blocking(ptr->socket_fd) == -1) {
+		close(socket_fd);
+		free(ptr);
+		return NULL;
+	}
+
+	if (ptr->timestamping != 0 &&
+	    network_socket_timestamping(ptr->socket_fd, ptr->timestamping) == -1) {
+		close(socket_fd);
+		free(ptr);
+		return NULL;
+	}
+
+	if (connection->ring.size > 0 &&
+	    ring_buffer_create(&ptr->ring, connection->ring.size,
+	                       connection->ring.hugepages) == -1) {
+		close(socket_fd);
+		free(ptr);
+		return NULL;
+	}
+#ifdef TLS
+	/* The client speaks first; the handshake starts on its hello */
+	if (connection->tls_context != NULL &&
+	    connection_tls_session(ptr, connection->tls_context, NULL) == -1) {
+		ring_buffer_free(&ptr->ring);
+		close(socket_fd);
+		free(ptr);
+		return NULL;
+	}
+#endif
+
+	event.events = EPOLLIN | EPOLLET;
+	event.data.ptr = ptr;
+
+	if (epoll_ctl(network->epoll_fd, EPOLL_CTL_ADD,
+	              ptr->socket_fd, &event) == -1) {
+		_perror("epoll_ctl()");
+		connection_tls_free(ptr);
+		ring_buffer_free(&ptr->ring);
+		close(socket_fd);
+		free(ptr);
+		return NULL;
+	}
+
+	ptr->events = event.events;
+	ptr->counter = connection->counter;
+	__atomic_add_fetch(&ptr->counter->refs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ptr->counter->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&network->num_accepted, 1, __ATOMIC_RELAXED);
+	ptr->accounted = network;
+	network_connection_link(network, ptr);
+	return ptr;
+}
+
+static struct connection_data_t *network_flow_find(struct connection_data_t *connection,
+                                                   const struct sockaddr_storage *addr)
+{
+	struct connection_data_t *flow;
+
+	for (flow = connection->flows; flow != NULL; flow = flow->flow_next) {
+		const struct sockaddr_in6 *peer = &flow->flow_peer;
+
+		if (peer->sin6_family != addr->ss_family) {
+			continue;
+		}
+
+		if (addr->ss_family == AF_INET) {
+			const struct sockaddr_in *a = (const struct sockaddr_in *)addr;
+			const struct sockaddr_in *b = (const struct sockaddr_in *)peer;
+
+			if (a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr) {
+				return flow;
+			}
+		} else {
+			const struct sockaddr_in6 *a = (const struct sockaddr_in6 *)addr;
+
+			if (a->sin6_port == peer->sin6_port &&
+			    a->sin6_scope_id == peer->sin6_scope_id &&
+			    memcmp(&a->sin6_addr, &peer->sin6_addr, sizeof(a->sin6_addr)) == 0) {
+				return flow;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static struct connection_data_t *network_flow_accept(struct network_data_t *network,
+                                                     struct connection_data_t *connection,
+                                                     const struct sockaddr_storage *addr,
+                                                     socklen_t addr_len,
+                                                     struct connection_event_t *conn_event)
+{
+	struct sockaddr_storage local;
+	socklen_t local_len = sizeof(local);
+	struct connection_data_t *ptr;
+	int32_t socket_fd;
+
+	/* Over the limits the listener serves the peer itself */
+	if (addr_len > sizeof(ptr->flow_peer) || network_accept_limited(network, connection, 0)) {
+		return NULL;
+	}
+
+	if (getsockname(connection->socket_fd, (struct sockaddr *)&local, &local_len) == -1) {
+		_perror("getsockname()");
+		return NULL;
+	}
+
+	socket_fd = socket(connection->family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+	if (socket_fd == -1) {
+		_perror("socket()");
+		return NULL;
+	}
+
+	/* A connected socket wins the lookup of its peer over the listener */
+	if (network_socket_option(socket_fd, SOL_SOCKET, SO_REUSEADDR, 1) == -1 ||
+	    network_socket_option(socket_fd, SOL_SOCKET, SO_REUSEPORT, 1) == -1) {
+		close(socket_fd);
+		return NULL;
+	}
+
+	if (bind(socket_fd, (struct sockaddr *)&local, local_len) == -1) {
+		_perror("bind()");
+		close(socket_fd);
+		return NULL;
+	}
+
+	if (connect(socket_fd, (const struct sockaddr *)addr, addr_len) == -1) {
+		_perror("connect()");
+		close(socket_fd);
+		return NULL;
+	}
+
+	ptr = network_connection_accept(network, connection, socket_fd);
+
+	if (ptr == NULL) {
+		return NULL;
+	}
+
+	memcpy(&ptr->flow_peer, addr, addr_len);
+	ptr->flow_listener = connection;
+	ptr->flow_next = connection->flows;
+
+	if (connection->flows != NULL) {
+		connection->flows->flow_prev = ptr;
+	}
+
+	connection->flows = ptr;
+	_probe(accept, network, connection, ptr);
+
+	conn_event->data_len = 0;
+	conn_event->addr_len = addr_len;
+	conn_event->addr = (struct sockaddr *)addr;
+	conn_event->new_connection = (connection_t)ptr;
+	conn_event->user_data = connection->user_data;
+	conn_event->event_type = connection_event_connection_accepted;
+	network_dispatch(network, connection, conn_event);
+	return ptr;
+}
+
+static void connection_flows_unlink(struct connection_data_t *connection)
+{
+	struct connection_data_t *listener = connection->flow_listener, *flow;
+
+	/* The sockets of the peers outlive the listener */
+	for (flow = connection->flows; flow != NULL; flow = flow->flow_next) {
+		flow->flow_listener = NULL;
+	}
+
+	connection->flows = NULL;
+
+	if (listener == NULL) {
+		return;
+	}
+
+	if (connection->flow_prev != NULL) {
+		connection->flow_prev->flow_next = connection->flow_next;
+	} else {
+		listener->flows = connection->flow_next;
+	}
+
+	if (connection->flow_next != NULL) {
+		connection->flow_next->flow_prev = connection->flow_prev;
+	}
+
+	connection->flow_listener = NULL;
+	connection->flow_prev = connection->flow_next = NULL;
+}
+
+static int32_t network_accept_limited(struct network_data_t *network,
+                                      struct connection_data_t *connection, uint8_t resume)
+{
+	uint32_t count = __atomic_load_n(&connection->counter->count, __ATOMIC_RELAXED);
+	uint32_t limit = connection->max_connections;
+
+	if (limit > 0) {
+		/* Resuming waits for the count to drop to the low watermark */
+		if (resume && connection->resume_connections > 0 &&
+		    connection->resume_connections < limit) {
+			limit = connection->resume_connections + 1;
+		}
+
+		if (count >= limit) {
+			return 1;
+		}
+	}
+
+	count = __atomic_load_n(&network->num_accepted, __ATOMIC_RELAXED);
+	limit = network->attr.max_connections;
+
+	if (limit > 0) {
+		if (resume && network->attr.resume_connections > 0 &&
+		    network->attr.resume_connections < limit) {
+			limit = network->attr.resume_connections + 1;
+		}
+
+		if (count >= limit) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void network_accept_resume(struct network_data_t *network,
+                                  struct connection_event_t *conn_event)
+{
+	struct connection_data_t *connection = network->connections;
+
+	while (connection != NULL) {
+		if (!connection->accept_paused || network_accept_limited(network, connection, 1)) {
+			connection = connection->next;
+			continue;
+		}
+
+		connection->accept_paused = 0;
+		__atomic_sub_fetch(&network->num_paused, 1, __ATOMIC_RELAXED);
+		conn_event->data_len = conn_event->addr_len = 0;
+		conn_event->user_data = connection->user_data;
+		conn_event->event_type = connection_event_accept_resumed;
+		network_dispatch(network, connection, conn_event);
+		/* The backlog raises no new edge; drain it now */
+		handle_connection_accept(network, connection, conn_event);
+		/* Callbacks may have freed connections; start over */
+		connection = network->connections;
+	}
+}
+
+static void network_accept_shed(struct network_data_t *network,
+                                 struct connection_data_t *connection,
+                                 struct connection_event_t *conn_event)
+{
+	/* Give up the spare descriptor to accept and close the pending connections */
+	close(network->reserve_fd);
+
+	while (1) {
+		int32_t socket_fd = accept(connection->socket_fd, NULL, NULL);
+
+		if (socket_fd == -1) {
+			if (errno == ECONNABORTED || errno == EINTR) {
+				continue;
+			}
+
+			break;
+		}
+
+		close(socket_fd);
+		conn_event->data_len = conn_event->addr_len = 0;
+		conn_event->user_data = connection->user_data;
+		conn_event->event_type = connection_event_connection_rejected;
+		network_dispatch(network, connection, conn_event);
+	}
+
+	network->reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+	if (network->reserve_fd == -1) {
+		_perror("open()");
+	}
+}
+
+static int32_t connection_close_socket(struct connection_data_t *connection)
+{
+	int32_t s;
+
+	if (connection->network != NULL) {
+		network_throttle_remove(connection->network, connection);
+		network_defer_remove(connection->network, connection);
+		network_flush_remove(connection->network, connection);
+		_lock(connection->network);
+		network_info_remove(connection->network, connection);
+		_unlock(connection->network);
+	}
+
+	connection_flows_unlink(connection);
+
+	if (connection->mode != connection_mode_server) {
+		connection_release(connection);
+	}
+
+	connection_tls_free(connection);
+	free(connection->payload);
+	connection->payload = NULL;
+	free(connection->cork);
+	connection->cork = NULL;
+	_probe(close, connection, connection->socket_fd);
+	s = close(connection->socket_fd);
+	connection->socket_fd = -1;
+	return s;
+}
+
+static void connection_release(struct connection_data_t *connection)
+{
+	struct accept_counter_t *counter = connection->counter;
+	struct network_data_t *network;
+
+	if (counter == NULL) {
+		return;
+	}
+
+	connection->counter = NULL;
+	__atomic_sub_fetch(&counter->count, 1, __ATOMIC_RELAXED);
+
+	/* Cleared if the network was freed or the connection is migrating */
+	network = __atomic_exchange_n(&connection->accounted, NULL, __ATOMIC_ACQ_REL);
+
+	if (network != NULL) {
+		__atomic_sub_fetch(&network->num_accepted, 1, __ATOMIC_RELAXED);
+	}
+
+	network = __atomic_load_n(&counter->network, __ATOMIC_ACQUIRE);
+
+	/* Let the loop of a paused listener check its limits */
+	if (network != NULL && __atomic_load_n(&network->num_paused, __ATOMIC_RELAXED) > 0) {
+		network_wakeup(network);
+	}
+
+	if (__atomic_sub_fetch(&counter->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(counter);
+	}
+}
+
+static int32_t connection_register(struct connection_data_t *connection,
+                                   const struct connection_attr_t *attr, uint32_t events)
+{
+	struct network_data_t *network = (struct network_data_t *)(*attr->network);
+	struct epoll_event event = {0};
+	event.events = events;
+	event.data.ptr = connection;
+
+	if ((uint32_t)attr->priority >= CONNECTION_PRIORITIES) {
+		_fprintf(stderr, "Invalid connection priority: %d\n", attr->priority);
+		return -1;
+	}
+
+	if (attr->backlog.max_bytes > 0 &&
+	    attr->backlog.policy != connection_backlog_drop &&
+	    attr->backlog.policy != connection_backlog_conflate) {
+		_fprintf(stderr, "Invalid backlog policy: %d\n", attr->backlog.policy);
+		return -1;
+	}
+
+	if (attr->timestamping & ~(CONNECTION_TIMESTAMP_RX | CONNECTION_TIMESTAMP_TX)) {
+		_fprintf(stderr, "Invalid timestamping flags: 0x%x\n", attr->timestamping);
+		return -1;
+	}
+
+	/* Timestamps would report the records, not the application data */
+	if (attr->timestamping != 0 && attr->tls_context != NULL) {
+		_fprintf(stderr, "Timestamping is not supported over TLS.\n");
+		return -1;
+	}
+
+	if (attr->udp_flows &&
+	    (connection->mode != connection_mode_server || connection->socktype != SOCK_DGRAM ||
+	     (connection->family != AF_INET && connection->family != AF_INET6))) {
+		_fprintf(stderr, "Per-peer sockets require a UDP listener.\n");
+		return -1;
+	}
+
+	if (attr->auto_cork && connection->socktype != SOCK_STREAM) {
+		_fprintf(stderr, "Auto-cork requires a stream socket.\n");
+		return -1;
+	}
+
+	/* Accepted sockets inherit it; accept applies it again to restart the keys */
+	if (attr->timestamping != 0) {
+		connection->timestamping = attr->timestamping;
+
+		if (network_socket_timestamping(connection->socket_fd, attr->timestamping) == -1) {
+			return -1;
+		}
+	}
+
+	if (attr->ring.size > 0) {
+		if (connection->socktype != SOCK_STREAM) {
+			_fprintf(stderr, "Receive ring requires a stream socket.\n");
+			return -1;
+		}
+
+		/* Listeners only pass the settings on to accepted connections */
+		if (connection->mode == connection_mode_server) {
+			connection->ring.size = attr->ring.size;
+			connection->ring.hugepages = attr->ring.hugepages;
+		} else if (ring_buffer_create(&connection->ring, attr->ring.size,
+		                              attr->ring.hugepages) == -1) {
+			return -1;
+		}
+	}
+
+	if (epoll_ctl(network->epoll_fd, EPOLL_CTL_ADD,
+	              connection->socket_fd, &event) == -1) {
+		_perror("epoll_ctl()");
+		ring_buffer_free(&connection->ring);
+		return -1;
+	}
+
+	if (connection->mode == connection_mode_server &&
+	    (connection->socktype == SOCK_STREAM || connection->socktype == SOCK_SEQPACKET ||
+	     attr->udp_flows)) {
+		/* Accepted connections count against the limits of the listener */
+		connection->counter = malloc(sizeof(*connection->counter));
+
+		if (connection->counter == NULL) {
+			_perror("malloc()");
+			epoll_ctl(network->epoll_fd, EPOLL_CTL_DEL, connection->socket_fd, NULL);
+			ring_buffer_free(&connection->ring);
+			return -1;
+		}
+
+		memset(connection->counter, 0, sizeof(*connection->counter));
+		connection->counter->refs = 1;
+		connection->counter->network = network;
+		connection->max_connections = attr->max_connections;
+		connection->resume_connections = attr->resume_connections;
+	}
+
+	connection->events = events;
+	connection->user_data = attr->user_data;
+	connection->handlers = attr->handlers;
+	connection->priority = attr->priority;
+	connection->backlog = attr->backlog;
+	connection->udp_flows = attr->udp_flows;
+	connection->auto_cork = attr->auto_cork;
+	connection->data_type = data_type_connection;
+	rate_limit_init(connection, &attr->rate_limit);
+	network_connection_link(network, connection);
+	return 0;
+}
+
+static int32_t network_join(struct network_data_t *network)
+{
+#ifdef PTHREAD
+
+	if (network->attr.mode == network_mode_thread) {
+		if (pthread_join(network->thread, NULL)) {
+			_perror("pthread_join()");
+			return -1;
+		}
+	} else
+#endif
+		if (network->attr.mode == network_mode_mainloop) {
+			return 0;
+		} else {
+			_fprintf(stderr, "Invalid network mode: %d\n", network->attr.mode);
+			return -1;
+		}
+
+	return 0;
+}
+
+static void network_drain_start(struct network_data_t *network,
+                                struct connection_event_t *conn_event)
+{
+	struct connection_data_t *connection, *next;
+	network->draining = 1;
+
+	for (connection = network->connections; connection != NULL; connection = next) {
+		next = connection->next;
+
+		if (connection->mode == connection_mode_server) {
+			/* Stop accepting; the listening socket stays open for the user */
+			if (epoll_ctl(network->epoll_fd, EPOLL_CTL_DEL,
+			              connection->socket_fd, NULL) == -1) {
+				_perror("epoll_ctl()");
+			}
+
+			if (connection->accept_paused) {
+				connection->accept_paused = 0;
+				__atomic_sub_fetch(&network->num_paused, 1, __ATOMIC_RELAXED);
+			}
+
+			continue;
+		}
+
+		if (connection->socket_fd == -1) {
+			continue;
+		}
+
+		/* Let the application finish and close its connections */
+		conn_event->data_len = conn_event->addr_len = 0;
+		conn_event->user_data = connection->user_data;
+		conn_event->event_type = connection_event_connection_draining;
+		network_dispatch(network, connection, conn_event);
+	}
+}
+
+static int32_t network_drain_check(struct network_data_t *network,
+                                   struct connection_event_t *conn_event)
+{
+	struct connection_data_t *connection, *next;
+	uint8_t expired = network_time_now() >= network->drain_deadline;
+
+	for (connection = network->connections; connection != NULL; connection = next) {
+		next = connection->next;
+
+		if (connection->mode == connection_mode_server || connection->socket_fd == -1) {
+			continue;
+		}
+
+		/* Still in flight; closed ones lingering for queued data as well */
+		if (!expired) {
+			return 0;
+		}
+
+		/* Closed by the application already; nothing is reported */
+		if (connection->lingering) {
+			connection_linger_end(connection);
+			continue;
+		}
+
+		connection_close_socket(connection);
+		conn_event->data_len = conn_event->addr_len = 0;
+		conn_event->user_data = connection->user_data;
+		conn_event->event_type = connection_event_connection_closed;
+		network_dispatch(network, connection, conn_event);
+	}
+
+	return 1;
+}
+
+static int32_t network_drain_timeout(struct network_data_t *network)
+{
+	uint64_t now;
+
+	if (!network->draining || network->drain_deadline == UINT64_MAX) {
+		return -1;
+	}
+
+	now = network_time_now();
+
+	if (now >= network->drain_deadline) {
+		return 0;
+	}
+
+	/* Round up so that the deadline has passed on wakeup */
+	return (network->drain_deadline - now + 999999) / 1000000;
+}
+
+static void network_wakeup(struct network_data_t *network)
+{
+	uint64_t data = 1;
+#ifdef PTHREAD
+
+	/* The loop checks its state at the end of each batch anyway */
+	if (pthread_equal(pthread_self(), network->loop_thread)) {
+		return;
+	}
+
+	if (write(network->ipc->socket_fd, &data, sizeof(data)) == -1) {
+		_perror("write()");
+	}
+
+#else
+	(void)network;
+	(void)data;
+#endif
+}
+
+static void connection_pool_key(const struct connection_attr_t *attr, char *key, size_t len)
+{
+	/* Connections differing in any of these are not interchangeable */
+	snprintf(key, len, "%.*s\n%.*s\n%d %d %d %p",
+	         (int)sizeof(attr->hostname), attr->hostname,
+	         (int)sizeof(attr->service), attr->service,
+	         attr->hints.ai_family, attr->hints.ai_socktype,
+	         attr->hints.ai_protocol, attr->tls_context);
+}
+
+static void network_pool_remove(struct network_data_t *network,
+                                struct connection_data_t *connection)
+{
+	if (!connection->pool_idle) {
+		return;
+	}
+
+	if (connection->pool_prev != NULL) {
+		connection->pool_prev->pool_next = connection->pool_next;
+	} else {
+		network->pool_head = connection->pool_next;
+	}
+
+	if (connection->pool_next != NULL) {
+		connection->pool_next->pool_prev = connection->pool_prev;
+	} else {
+		network->pool_tail = connection->pool_prev;
+	}
+
+	connection->pool_prev = connection->pool_next = NULL;
+	connection->pool_idle = 0;
+	--network->num_pooled;
+}
+
+static void connection_pool_close(struct connection_data_t *connection)
+{
+	connection_close_socket(connection);
+	connection_free((connection_t)connection);
+}
+
+static void connection_pool_event(struct connection_data_t *connection,
+                                  const struct connection_event_t *conn_event)
+{
+	switch (conn_event->event_type) {
+		case connection_event_data_received:
+			/* Nothing was asked; the closed event that follows evicts it */
+			connection_close_socket(connection);
+			break;
+
+		case connection_event_connection_created:
+		case connection_event_connection_writable:
+		case connection_event_tx_timestamp:
+			break;
+
+		default:
+			/* Closed by the peer, failed, dropped or draining */
+			connection_pool_close(connection);
+			break;
+	}
+}
+
+static int32_t network_pool_arm(struct network_data_t *network)
+{
+	const struct timespec *timeout = &network->attr.client_pool.idle_timeout;
+	uint64_t idle_ns = (uint64_t)timeout->tv_sec * NSEC_PER_SEC + timeout->tv_nsec;
+	uint64_t expires_at = 0;
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+
+	if (idle_ns == 0) {
+		return 0;
+	}
+
+	/* The oldest expires first */
+	if (network->pool_head != NULL) {
+		expires_at = network->pool_head->idle_since + idle_ns;
+	}
+
+	if (network->pool_timer == NULL) {
+		network_t handle = (network_t)network;
+		network_timer_t timer;
+		struct network_timer_attr_t attr;
+
+		if (expires_at == 0) {
+			return 0;
+		}
+
+		memset(&attr, 0, sizeof(attr));
+		attr.network = &handle;
+		attr.type = network_timer_type_relative;
+
+		if (network_timer_create(&timer, &attr) == -1) {
+			return -1;
+		}
+
+		network->pool_timer = (struct timer_data_t *)timer;
+		network->pool_timer->handler = handle_pool_timer;
+	}
+
+	/* An all-zero value disarms the timer */
+	spec.it_value.tv_sec = expires_at / NSEC_PER_SEC;
+	spec.it_value.tv_nsec = expires_at % NSEC_PER_SEC;
+
+	if (timerfd_settime(network->pool_timer->timer_fd, TFD_TIMER_ABSTIME,
+	                    &spec, NULL) == -1) {
+		_perror("timerfd_settime()");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void handle_pool_timer(struct network_data_t *network, struct timer_data_t *timer)
+{
+	const struct timespec *timeout = &network->attr.client_pool.idle_timeout;
+	uint64_t idle_ns = (uint64_t)timeout->tv_sec * NSEC_PER_SEC + timeout->tv_nsec;
+	uint64_t now = network_time_now();
+	(void)timer;
+
+	while (network->pool_head != NULL && network->pool_head->idle_since + idle_ns <= now) {
+		connection_pool_close(network->pool_head);
+	}
+
+	network_pool_arm(network);
+}
+
+static int32_t network_info_start(struct network_data_t *network)
+{
+	const struct timespec *interval = &network->attr.tcp_info.interval;
+	network_t handle = (network_t)network;
+	network_timer_t timer;
+	struct network_timer_attr_t attr;
+	struct itimerspec spec;
+
+	/* Kept armed over restarts of the loop */
+	if ((interval->tv_sec == 0 && interval->tv_nsec == 0) || network->info_timer != NULL) {
+		return 0;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.network = &handle;
+	attr.type = network_timer_type_relative;
+
+	if (network_timer_create(&timer, &attr) == -1) {
+		return -1;
+	}
+
+	network->info_timer = (struct timer_data_t *)timer;
+	network->info_timer->handler = handle_info_timer;
+	spec.it_value = *interval;
+	spec.it_interval = *interval;
+
+	if (timerfd_settime(network->info_timer->timer_fd, 0, &spec, NULL) == -1) {
+		_perror("timerfd_settime()");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void handle_info_timer(struct network_data_t *network, struct timer_data_t *timer)
+{
+	struct connection_data_t *connection, *first = NULL;
+	uint32_t budget = network->attr.tcp_info.budget;
+	uint32_t num_sampled = 0;
+	uint64_t now = network_time_now();
+	(void)timer;
+
+	/* Rotate through the connections so that a round stays within its budget */
+	_lock(network);
+
+	while (budget == 0 || num_sampled < budget) {
+		connection = network->info_next != NULL ? network->info_next : network->connections;
+
+		/* Each connection once per round */
+		if (connection == NULL || connection == first) {
+			break;
+		}
+
+		if (first == NULL) {
+			first = connection;
+		}
+
+		network->info_next = connection->next;
+
+		if (connection_info_eligible(connection) &&
+		    connection_info_sample(network, connection, now) == 0) {
+			++num_sampled;
+		}
+	}
+
+	_unlock(network);
+}
+
+static uint8_t connection_info_eligible(const struct connection_data_t *connection)
+{
+	/* Listeners have no TCP_INFO worth sampling */
+	return connection->data_type == data_type_connection &&
+	       connection->mode == connection_mode_client && connection->socket_fd != -1 &&
+	       connection->socktype == SOCK_STREAM &&
+	       (connection->family == AF_INET || connection->family == AF_INET6);
+}
+
+static int32_t connection_info_sample(struct network_data_t *network,
+                                      struct connection_data_t *connection, uint64_t now)
+{
+	struct connection_info_t *info = &connection->info;
+	struct tcp_info tcp;
+	socklen_t len = sizeof(tcp);
+
+	if (getsockopt(connection->socket_fd, IPPROTO_TCP, TCP_INFO, &tcp, &len) == -1) {
+		_perror("getsockopt()");
+		return -1;
+	}
+
+	/* The sums of the network follow the latest sample */
+	network_info_remove(network, connection);
+	info->sampled_at = now;
+	info->rtt_us = tcp.tcpi_rtt;
+	info->rttvar_us = tcp.tcpi_rttvar;
+	info->snd_cwnd = tcp.tcpi_snd_cwnd;
+	info->unacked = tcp.tcpi_unacked;
+	info->lost = tcp.tcpi_lost;
+	info->total_retrans = tcp.tcpi_total_retrans;
+	++network->info_count;
+	network->info_rtt_us += info->rtt_us;
+	network->info_unacked += info->unacked;
+	network->info_lost += info->lost;
+	network->info_retrans += info->total_retrans;
+	return 0;
+}
+
+static void network_info_remove(struct network_data_t *network,
+                                struct connection_data_t *connection)
+{
+	struct connection_info_t *info = &connection->info;
+
+	if (info->sampled_at == 0) {
+		return;
+	}
+
+	--network->info_count;
+	network->info_rtt_us -= info->rtt_us;
+	network->info_unacked -= info->unacked;
+	network->info_lost -= info->lost;
+	network->info_retrans -= info->total_retrans;
+	memset(info, 0, sizeof(*info));
+}
+
+static void handle_throttle_timer(struct network_data_t *network, struct timer_data_t *timer)
+{
+	struct connection_event_t conn_event = {0};
+	struct connection_data_t *connection, **prev;
+	uint64_t now = network_time_now();
+	(void)timer;
+	conn_event.data_buffer = network->attr.data_buffer;
+
+	/* Resume the connections one at a time; callbacks may free others */
+	do {
+		for (prev = &network->throttled; (connection = *prev) != NULL;
+		     prev = &connection->throttle_next) {
+			if (connection->resume_at <= now) {
+				*prev = connection->throttle_next;
+				connection->throttle_next = NULL;
+				connection->throttled = 0;
+				handle_connection_data(network, connection, &conn_event);
+				break;
+			}
+		}
+	} while (connection != NULL);
+
+	network_throttle_arm(network);
+}
+
+static uint64_t network_time_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+static int32_t ring_buffer_map(struct ring_buffer_t *ring, size_t size,
+                               size_t align, uint32_t flags)
+{
+	int32_t fd = memfd_create("ebnlib-ring", MFD_CLOEXEC | flags);
+	uint8_t *reserved, *base;
+	size_t head;
+
+	if (fd == -1) {
+		_perror("memfd_create()");
+		return -1;
+	}
+
+	if (ftruncate(fd, size) == -1) {
+		_perror("ftruncate()");
+		close(fd);
+		return -1;
+	}
+
+	/* Reserve both halves at once, with room to align them to the page
+	 * size of the file; huge page mappings must start on a huge page */
+	reserved = mmap(NULL, 2 * size + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (reserved == MAP_FAILED) {
+		_perror("mmap()");
+		close(fd);
+		return -1;
+	}
+
+	base = (uint8_t *)(((uintptr_t)reserved + align - 1) & ~(uintptr_t)(align - 1));
+	head = base - reserved;
+
+	if (head > 0) {
+		munmap(reserved, head);
+	}
+
+	munmap(base + 2 * size, align - head);
+
+	if (mmap(base, size, PROT_READ | PROT_WRITE,
+	         MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+	    mmap(base + size, size, PROT_READ | PROT_WRITE,
+	         MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		_perror("mmap()");
+		munmap(base, 2 * size);
+		close(fd);
+		return -1;
+	}
+
+	/* The mappings keep the file alive */
+	close(fd);
+	ring->base = base;
+	ring->size = size;
+	return 0;
+}
+
+static int32_t ring_buffer_create(struct ring_buffer_t *ring, size_t size, uint8_t hugepages)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	memset(ring, 0, sizeof(*ring));
+
+	if (hugepages) {
+		size_t huge = (size + RING_HUGE_PAGE_SIZE - 1) & ~(RING_HUGE_PAGE_SIZE - 1);
+
+		if (ring_buffer_map(ring, huge, RING_HUGE_PAGE_SIZE, MFD_HUGETLB) == 0) {
+			ring->hugepages = 1;
+			return 0;
+		}
+
+		/* E.g. too few free in vm.nr_hugepages; the cause is printed above */
+		_fprintf(stderr, "Huge page receive ring failed; using regular pages.\n");
+	}
+
+	return ring_buffer_map(ring, (size + page - 1) & ~(page - 1), page, 0);
+}
+
+static void ring_buffer_free(struct ring_buffer_t *ring)
+{
+	if (ring->base != NULL) {
+		munmap(ring->base, 2 * ring->size);
+		ring->base = NULL;
+	}
+}
+
+static struct buffer_pool_t *buffer_pool_create(const struct network_buffer_pool_attr_t *attr)
+{
+	struct buffer_pool_t *pool;
+	uint32_t i;
+
+	if (attr->buffer_size == 0) {
+		_fprintf(stderr, "Invalid buffer size: 0\n");
+		return NULL;
+	}
+
+	pool = calloc(1, sizeof(*pool));
+
+	if (pool == NULL) {
+		_perror("calloc()");
+		return NULL;
+	}
+
+	/* One allocation for the data; buffers are never freed on their own */
+	pool->buffers = calloc(attr->num_buffers, sizeof(*pool->buffers));
+	pool->memory = malloc(attr->num_buffers * attr->buffer_size);
+
+	if (pool->buffers == NULL || pool->memory == NULL) {
+		_perror("malloc()");
+		free(pool->buffers);
+		free(pool->memory);
+		free(pool);
+		return NULL;
+	}
+
+#ifdef PTHREAD
+
+	if (pthread_mutex_init(&pool->lock, NULL)) {
+		_perror("pthread_mutex_init()");
+		free(pool->buffers);
+		free(pool->memory);
+		free(pool);
+		return NULL;
+	}
+
+#endif
+	pool->buffer_size = attr->buffer_size;
+	pool->num_buffers = pool->num_free = attr->num_buffers;
+
+	for (i = attr->num_buffers; i-- > 0;) {
+		struct buffer_data_t *buffer = &pool->buffers[i];
+		buffer->pool = pool;
+		buffer->data = pool->memory + i * attr->buffer_size;
+		buffer->next = pool->free;
+		pool->free = buffer;
+	}
+
+	return pool;
+}
+
+static void buffer_pool_destroy(struct buffer_pool_t *pool)
+{
+#ifdef PTHREAD
+	pthread_mutex_destroy(&pool->lock);
+#endif
+	free(pool->buffers);
+	free(pool->memory);
+	free(pool);
+}
+
+static struct buffer_data_t *buffer_pool_get(struct buffer_pool_t *pool)
+{
+	struct buffer_data_t *buffer;
+	_lock(pool);
+	buffer = pool->free;
+
+	if (buffer != NULL) {
+		pool->free = buffer->next;
+		--pool->num_free;
+	}
+
+	_unlock(pool);
+
+	if (buffer != NULL) {
+		return buffer;
+	}
+
+	/* Exhausted; a buffer of the heap keeps the data in order with the rest */
+	return buffer_heap_create(pool->buffer_size);
+}
+
+static struct buffer_data_t *buffer_heap_create(size_t size)
+{
+	struct buffer_data_t *buffer = malloc(sizeof(*buffer) + size);
+
+	if (buffer == NULL) {
+		_perror("malloc()");
+		return NULL;
+	}
+
+	/* Freed by the last release; it has no pool */
+	memset(buffer, 0, sizeof(*buffer));
+	buffer->data = (uint8_t *)(buffer + 1);
+	return buffer;
+}
+
+static void buffer_pool_put(struct buffer_data_t *buffer)
+{
+	struct buffer_pool_t *pool = buffer->pool;
+	uint8_t empty;
+
+	if (pool == NULL) {
+		free(buffer);
+		return;
+	}
+
+	_lock(pool);
+	buffer->next = pool->free;
+	pool->free = buffer;
+	++pool->num_free;
+	empty = pool->closed && pool->num_free == pool->num_buffers;
+	_unlock(pool);
+
+	if (empty) {
+		buffer_pool_destroy(pool);
+	}
+}
+
+static void buffer_pool_close(struct buffer_pool_t *pool)
+{
+	uint8_t empty;
+
+	if (pool == NULL) {
+		return;
+	}
+
+	_lock(pool);
+	pool->closed = 1;
+	empty = pool->num_free == pool->num_buffers;
+	_unlock(pool);
+
+	if (empty) {
+		buffer_pool_destroy(pool);
+	}
+}
+
+static void buffer_release(struct buffer_data_t *buffer)
+{
+	if (__atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		buffer_pool_put(buffer);
+	}
+}
+
+static int32_t send_queue_reserve(struct send_queue_t *queue, size_t num_buffers)
+{
+	struct buffer_data_t **buffers;
+	size_t capacity;
+
+	if (queue->head + queue->len + num_buffers <= queue->capacity) {
+		return 0;
+	}
+
+	/* Reclaim the slots already sent before growing */
+	memmove(queue->buffers, queue->buffers + queue->head,
+	        queue->len * sizeof(*queue->buffers));
+	queue->head = 0;
+
+	if (queue->len + num_buffers <= queue->capacity) {
+		return 0;
+	}
+
+	capacity = queue->capacity > 0 ? 2 * queue->capacity : SEND_QUEUE_IOV;
+
+	if (capacity < queue->len + num_buffers) {
+		capacity = queue->len + num_buffers;
+	}
+
+	buffers = realloc(queue->buffers, capacity * sizeof(*buffers));
+
+	if (buffers == NULL) {
+		_perror("realloc()");
+		return -1;
+	}
+
+	queue->buffers = buffers;
+	queue->capacity = capacity;
+	return 0;
+}
+
+static int32_t send_queue_flush(struct connection_data_t *connection)
+{
+	struct send_queue_t *queue = &connection->send_queue;
+
+	while (queue->len > 0) {
+		struct iovec iov[SEND_QUEUE_IOV];
+		struct msghdr msg;
+		size_t i, total = 0;
+		size_t n = queue->len < SEND_QUEUE_IOV ? queue->len : SEND_QUEUE_IOV;
+		ssize_t s, written;
+
+		for (i = 0; i < n; ++i) {
+			struct buffer_data_t *buffer = queue->buffers[queue->head + i];
+			size_t offset = i == 0 ? queue->offset : 0;
+			iov[i].iov_base = buffer->data + offset;
+			iov[i].iov_len = buffer->len - offset;
+			total += iov[i].iov_len;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		s = connection_write_msg(connection, &msg);
+
+		if (s == -1) {
+			/* Full socket; continued on EPOLLOUT */
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+
+			/* Undeliverable; the error is reported by the event loop */
+			send_queue_free(queue);
+			return -1;
+		}
+
+		queue->bytes -= s;
+
+		/* Release the buffers written in full */
+		for (i = 0, written = s; i < n && written > 0; ++i) {
+			if ((size_t)written < iov[i].iov_len) {
+				queue->offset += written;
+				break;
+			}
+
+			written -= iov[i].iov_len;
+			buffer_release(queue->buffers[queue->head]);
+			++queue->head;
+			--queue->len;
+			queue->offset = 0;
+		}
+
+		/* Full socket; continued on EPOLLOUT */
+		if ((size_t)s < total) {
+			return 0;
+		}
+	}
+
+	queue->head = 0;
+	return 0;
+}
+
+static void send_queue_free(struct send_queue_t *queue)
+{
+	size_t i;
+
+	for (i = 0; i < queue->len; ++i) {
+		buffer_release(queue->buffers[queue->head + i]);
+	}
+
+	free(queue->buffers);
+	memset(queue, 0, sizeof(*queue));
+}
+
+static void send_queue_conflate(struct send_queue_t *queue)
+{
+	/* A buffer partly written must be completed */
+	size_t keep = queue->offset > 0 ? 1 : 0;
+
+	while (queue->len > keep) {
+		buffer_release(queue->buffers[queue->head + --queue->len]);
+	}
+
+	queue->bytes = keep ? queue->buffers[queue->head]->len - queue->offset : 0;
+}
+
+static int32_t send_queue_append(struct connection_data_t *connection,
+                                 const network_buffer_t *buffers, size_t num_buffers)
+{
+	struct send_queue_t *queue = &connection->send_queue;
+	size_t i, len = 0;
+
+	for (i = 0; i < num_buffers; ++i) {
+		len += ((struct buffer_data_t *)buffers[i])->len;
+	}
+
+	/* Only a reader already behind is over its backlog */
+	if (connection->backlog.max_bytes > 0 && queue->len > 0 &&
+	    queue->bytes + len > connection->backlog.max_bytes) {
+		if (connection->backlog.policy == connection_backlog_drop) {
+			struct network_data_t *network = connection->network;
+			send_queue_free(queue);
+			connection_close_socket(connection);
+			connection->dropped = 1;
+			network_flush_add(network, connection);
+			errno = ENOBUFS;
+			return -1;
+		}
+
+		send_queue_conflate(queue);
+	}
+
+	if (send_queue_reserve(queue, num_buffers) == -1) {
+		return -1;
+	}
+
+	for (i = 0; i < num_buffers; ++i) {
+		struct buffer_data_t *buffer = (struct buffer_data_t *)buffers[i];
+		__atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+		queue->buffers[queue->head + queue->len++] = buffer;
+	}
+
+	queue->bytes += len;
+	return 0;
+}
+
+static int32_t send_queue_copy(struct connection_data_t *connection,
+                               const void *data, size_t len)
+{
+	struct buffer_data_t *buffer = buffer_heap_create(len);
+	network_buffer_t handle = (network_buffer_t)buffer;
+	int32_t s;
+
+	if (buffer == NULL) {
+		return -1;
+	}
+
+	memcpy(buffer->data, data, len);
+	buffer->len = len;
+	buffer->refs = 1;
+	/* The queue takes a reference of its own */
+	s = send_queue_append(connection, &handle, 1);
+	buffer_release(buffer);
+	return s;
+}
+
+static void network_flush_add(struct network_data_t *network, struct connection_data_t *connection)
+{
+	connection->flush_pending = 1;
+	connection->flush_next = network->flushed;
+	network->flushed = connection;
+}
+
+static void network_flush_remove(struct network_data_t *network,
+                                 struct connection_data_t *connection)
+{
+	struct connection_data_t **prev;
+
+	if (!connection->flush_pending) {
+		return;
+	}
+
+	for (prev = &network->flushed; *prev != NULL; prev = &(*prev)->flush_next) {
+		if (*prev == connection) {
+			*prev = connection->flush_next;
+			break;
+		}
+	}
+
+	connection->flush_next = NULL;
+	connection->flush_pending = 0;
+	connection->dropped = 0;
+}
+
+static void network_flush_process(struct network_data_t *network,
+                                  struct connection_event_t *conn_event)
+{
+	struct connection_data_t *connection;
+
+	/* The callbacks may add connections; they are served as well */
+	while ((connection = network->flushed) != NULL) {
+		network->flushed = connection->flush_next;
+		connection->flush_next = NULL;
+		connection->flush_pending = 0;
+
+		if (connection->dropped) {
+			connection->dropped = 0;
+			conn_event->data_len = conn_event->addr_len = 0;
+			conn_event->user_data = connection->user_data;
+			conn_event->event_type = connection_event_connection_dropped;
+			network_dispatch(network, connection, conn_event);
+			continue;
+		}
+
+		/* Everything queued this iteration in one sendmsg() */
+		if (connection_cork_commit(connection) == 0 && send_queue_flush(connection) == 0 &&
+		    connection->send_queue.len > 0) {
+			network_connection_events(network, connection, EPOLLIN | EPOLLOUT | EPOLLET);
+		}
+	}
+}
+
+static uint8_t network_corking(const struct network_data_t *network)
+{
+	/* Other threads have no end of iteration to wait for */
+	return network != NULL && network->batching && network_on_loop(network);
+}
+
+static uint8_t network_on_loop(const struct network_data_t *network)
+{
+	if (network == NULL) {
+		return 0;
+	}
+#ifdef PTHREAD
+	return pthread_equal(pthread_self(), network->loop_thread);
+#else
+	return 1;
+#endif
+}
+
+static ssize_t connection_cork(struct connection_data_t *connection, const void *data, size_t len)
+{
+	struct buffer_data_t *cork = connection->cork;
+	size_t used = cork != NULL ? cork->len : 0;
+
+	if (cork == NULL || used + len > connection->cork_size) {
+		size_t size = cork != NULL ? connection->cork_size : CONNECTION_CORK_SIZE;
+
+		while (size < used + len) {
+			size *= 2;
+		}
+
+		/* Owned by the connection alone until queued */
+		cork = realloc(cork, sizeof(*cork) + size);
+
+		if (cork == NULL) {
+			_perror("realloc()");
+			return -1;
+		}
+
+		if (connection->cork == NULL) {
+			memset(cork, 0, sizeof(*cork));
+			cork->refs = 1;
+
+			if (!connection->flush_pending) {
+				network_flush_add(connection->network, connection);
+			}
+		}
+
+		cork->data = (uint8_t *)(cork + 1);
+		connection->cork = cork;
+		connection->cork_size = size;
+	}
+
+	memcpy(cork->data + used, data, len);
+	cork->len = used + len;
+	return len;
+}
+
+static int32_t connection_cork_commit(struct connection_data_t *connection)
+{
+	struct buffer_data_t *cork = connection->cork;
+	network_buffer_t buffer = (network_buffer_t)cork;
+	int32_t s;
+
+	if (cork == NULL) {
+		return 0;
+	}
+
+	/* The queue takes over the reference of the connection */
+	connection->cork = NULL;
+	connection->cork_size = 0;
+	s = send_queue_append(connection, &buffer, 1);
+	buffer_release(cork);
+	return s;
+}
+
+static int32_t connection_uncork(struct connection_data_t *connection)
+{
+	if (connection_cork_commit(connection) == -1 || send_queue_flush(connection) == -1) {
+		return -1;
+	}
+
+	/* Later writes must wait for the queue */
+	if (connection->send_queue.len > 0) {
+		if (connection->network != NULL) {
+			network_connection_events(connection->network, connection,
+			                          EPOLLIN | EPOLLOUT | EPOLLET);
+		}
+
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int32_t connection_send_ready(struct connection_data_t *connection)
+{
+	/* Direct writes never overtake staged or queued data */
+	if (connection->cork == NULL && connection->send_queue.len == 0) {
+		return 0;
+	}
+
+	/* The queue is written by the loop of the connection alone */
+	if (!network_on_loop(connection->network)) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return connection_uncork(connection);
+}
+
+static int32_t connection_linger(struct connection_data_t *connection)
+{
+	struct network_data_t *network = connection->network;
+
+	/* A stopped loop would never write the rest */
+	if (!network_on_loop(network) || __atomic_load_n(&network->stopped, __ATOMIC_ACQUIRE) ||
+	    connection->socket_fd == -1) {
+		return -1;
+	}
+
+	/* Nothing is reported from now on; EPOLLOUT is armed by the uncork */
+	network_throttle_remove(network, connection);
+	network_defer_remove(network, connection);
+	network_flush_remove(network, connection);
+	connection->lingering = 1;
+	return 0;
+}
+
+static void connection_linger_event(struct connection_data_t *connection, uint32_t events)
+{
+	/* Input is ignored; a failed write frees the queue */
+	if (!(events & (EPOLLERR | EPOLLHUP)) && (events & EPOLLOUT)) {
+		send_queue_flush(connection);
+	}
+
+	if ((events & (EPOLLERR | EPOLLHUP)) || connection->send_queue.len == 0) {
+		connection_linger_end(connection);
+	}
+}
+
+static void connection_linger_end(struct connection_data_t *connection)
+{
+	connection->lingering = 0;
+	send_queue_free(&connection->send_queue);
+	connection_close((connection_t)connection);
+
+	if (connection->orphaned && connection->work_pending == 0) {
+		connection->orphaned = 0;
+		connection_free((connection_t)connection);
+	}
+}
+
+static void rate_limit_init(struct connection_data_t *connection,
+                            const struct connection_rate_limit_t *limit)
+{
+	/* Keep the buckets and a debt of one message within int64_t */
+	const uint64_t max_burst = INT64_MAX / NSEC_PER_SEC / 2;
+	struct connection_rate_limit_t *rate_limit = &connection->rate_limit;
+	*rate_limit = *limit;
+
+	if (rate_limit->bytes_per_sec == 0 && rate_limit->messages_per_sec == 0) {
+		return;
+	}
+
+	if (rate_limit->bytes_burst == 0) {
+		rate_limit->bytes_burst = rate_limit->bytes_per_sec;
+	}
+
+	if (rate_limit->messages_burst == 0) {
+		rate_limit->messages_burst = rate_limit->messages_per_sec;
+	}
+
+	if (rate_limit->bytes_burst > max_burst) {
+		rate_limit->bytes_burst = max_burst;
+	}
+
+	if (rate_limit->messages_burst > max_burst) {
+		rate_limit->messages_burst = max_burst;
+	}
+
+	/* Start with full buckets */
+	connection->bucket.bytes = rate_limit->bytes_burst * NSEC_PER_SEC;
+	connection->bucket.messages = rate_limit->messages_burst * NSEC_PER_SEC;
+	connection->bucket.updated = network_time_now();
+}
+
+static int64_t rate_bucket_fill(int64_t tokens, uint64_t rate, uint64_t burst, uint64_t elapsed)
+{
+	int64_t full = burst * NSEC_PER_SEC;
+
+	/* Refilling the whole bucket would not overflow the product */
+	if (tokens >= full || elapsed >= (uint64_t)(full - tokens) / rate) {
+		return full;
+	}
+
+	return tokens + (int64_t)(elapsed * rate);
+}
+
+static uint64_t rate_limit_check(struct network_data_t *network,
+                                 struct connection_data_t *connection, size_t *len)
+{
+	struct connection_rate_limit_t *rate_limit = &connection->rate_limit;
+	struct rate_bucket_t *bucket = &connection->bucket;
+	uint64_t now = network_time_now(), wait = 0;
+	uint64_t elapsed = now - bucket->updated;
+	bucket->updated = now;
+
+	if (rate_limit->bytes_per_sec > 0) {
+		/* Read in whole buffers unless the bucket is smaller */
+		uint64_t chunk = rate_limit->bytes_burst < network->attr.buffer_len
+		                 ? rate_limit->bytes_burst : network->attr.buffer_len;
+		int64_t need = chunk * NSEC_PER_SEC;
+		bucket->bytes = rate_bucket_fill(bucket->bytes, rate_limit->bytes_per_sec,
+		                                 rate_limit->bytes_burst, elapsed);
+
+		if (bucket->bytes < need) {
+			wait = (need - bucket->bytes + rate_limit->bytes_per_sec - 1) /
+			       rate_limit->bytes_per_sec;
+		} else if (connection->socktype == SOCK_STREAM &&
+		           (uint64_t)(bucket->bytes / NSEC_PER_SEC) < *len) {
+			/* Messages are never truncated; streams read what the tokens allow */
+			*len = bucket->bytes / NSEC_PER_SEC;
+		}
+	}
+
+	if (rate_limit->messages_per_sec > 0) {
+		bucket->messages = rate_bucket_fill(bucket->messages, rate_limit->messages_per_sec,
+		                                    rate_limit->messages_burst, elapsed);
+
+		if (bucket->messages < NSEC_PER_SEC) {
+			uint64_t t = (NSEC_PER_SEC - bucket->messages +
+			              rate_limit->messages_per_sec - 1) / rate_limit->messages_per_sec;
+			wait = t > wait ? t : wait;
+		}
+	}
+
+	return wait > 0 ? now + wait : 0;
+}
+
+static uint8_t network_event_rank(struct network_data_t *network, struct epoll_event *event)
+{
+	struct connection_data_t *connection = event->data.ptr;
+
+	/* Stop requests and timers go first */
+	if (connection == network->ipc || connection->data_type != data_type_connection) {
+		return 0;
+	}
+
+	return connection->priority == connection_priority_high ? 0
+	       : connection->priority == connection_priority_low ? 2 : 1;
+}
+
+static void network_events_order(struct network_data_t *network,
+                                 struct epoll_event *events, int32_t num_ready)
+{
+	int32_t low = 0, mid = 0, high = num_ready - 1;
+
+	/* Three-way partition; ranked once before any callback runs */
+	while (mid <= high) {
+		struct epoll_event event = events[mid];
+		uint8_t rank = network_event_rank(network, &event);
+
+		if (rank == 0) {
+			events[mid++] = events[low];
+			events[low++] = event;
+		} else if (rank == 2) {
+			events[mid] = events[high];
+			events[high--] = event;
+		} else {
+			++mid;
+		}
+	}
+}
+
+static void network_defer(struct network_data_t *network, struct connection_data_t *connection)
+{
+	connection_priority_e priority = connection->priority;
+	connection->deferred = 1;
+	connection->defer_round = network->round;
+	connection->defer_next = NULL;
+
+	if (network->deferred_tail[priority] != NULL) {
+		network->deferred_tail[priority]->defer_next = connection;
+	} else {
+		network->deferred_head[priority] = connection;
+	}
+
+	network->deferred_tail[priority] = connection;
+	++network->num_deferred;
+}
+
+static void network_defer_remove(struct network_data_t *network,
+                                 struct connection_data_t *connection)
+{
+	connection_priority_e priority = connection->priority;
+	struct connection_data_t **prev, *last = NULL;
+
+	if (!connection->deferred) {
+		return;
+	}
+
+	for (prev = &network->deferred_head[priority]; *prev != NULL;
+	     last = *prev, prev = &(*prev)->defer_next) {
+		if (*prev == connection) {
+			*prev = connection->defer_next;
+
+			if (network->deferred_tail[priority] == connection) {
+				network->deferred_tail[priority] = last;
+			}
+
+			--network->num_deferred;
+			break;
+		}
+	}
+
+	connection->defer_next = NULL;
+	connection->deferred = 0;
+}
+
+static void network_deferred_process(struct network_data_t *network,
+                                     struct connection_event_t *conn_event)
+{
+	static const connection_priority_e order[CONNECTION_PRIORITIES] = {
+		connection_priority_high, connection_priority_normal, connection_priority_low
+	};
+	uint32_t i;
+
+	/* Connections deferred in this wakeup have had their share already */
+	for (i = 0; i < CONNECTION_PRIORITIES; ++i) {
+		struct connection_data_t *connection;
+
+		while ((connection = network->deferred_head[order[i]]) != NULL &&
+		       connection->defer_round != network->round) {
+			network_defer_remove(network, connection);
+			handle_connection_data(network, connection, conn_event);
+		}
+	}
+}
+
+static int32_t network_throttle(struct network_data_t *network,
+                                struct connection_data_t *connection, uint64_t resume_at)
+{
+	connection->resume_at = resume_at;
+	connection->throttled = 1;
+	connection->throttle_next = network->throttled;
+	network->throttled = connection;
+
+	if (network_throttle_arm(network) == -1) {
+		network->throttled = connection->throttle_next;
+		connection->throttle_next = NULL;
+		connection->throttled = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void network_throttle_remove(struct network_data_t *network,
+                                    struct connection_data_t *connection)
+{
+	struct connection_data_t **prev;
+
+	if (!connection->throttled) {
+		return;
+	}
+
+	for (prev = &network->throttled; *prev != NULL; prev = &(*prev)->throttle_next) {
+		if (*prev == connection) {
+			*prev = connection->throttle_next;
+			break;
+		}
+	}
+
+	connection->throttle_next = NULL;
+	connection->throttled = 0;
+}
+
+static int32_t network_throttle_arm(struct network_data_t *network)
+{
+	struct connection_data_t *connection;
+	struct itimerspec spec;
+	uint64_t resume_at = 0;
+	memset(&spec, 0, sizeof(spec));
+
+	for (connection = network->throttled; connection != NULL;
+	     connection = connection->throttle_next) {
+		if (resume_at == 0 || connection->resume_at < resume_at) {
+			resume_at = connection->resume_at;
+		}
+	}
+
+	if (network->throttle_timer == NULL) {
+		network_t handle = (network_t)network;
+		network_timer_t timer;
+		struct network_timer_attr_t attr;
+
+		if (resume_at == 0) {
+			return 0;
+		}
+
+		/* Relative timers run on the monotonic clock like the buckets */
+		memset(&attr, 0, sizeof(attr));
+		attr.network = &handle;
+		attr.type = network_timer_type_relative;
+
+		if (network_timer_create(&timer, &attr) == -1) {
+			return -1;
+		}
+
+		network->throttle_timer = (struct timer_data_t *)timer;
+		network->throttle_timer->handler = handle_throttle_timer;
+	}
+
+	/* An all-zero value disarms the timer */
+	spec.it_value.tv_sec = resume_at / NSEC_PER_SEC;
+	spec.it_value.tv_nsec = resume_at % NSEC_PER_SEC;
+
+	if (timerfd_settime(network->throttle_timer->timer_fd, TFD_TIMER_ABSTIME,
+	                    &spec, NULL) == -1) {
+		_perror("timerfd_settime()");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void handle_timer(struct network_data_t *network, struct timer_data_t *timer)
+{
+	struct network_timer_event_t timer_event = {0};
+	struct itimerspec timer_spec;
+	uint64_t exp;
+	ssize_t bytes;
+	bytes = read(timer->timer_fd, &exp, sizeof(uint64_t));
+
+	if (bytes == -1) {
+		/* Closed by the user? */
+		if (errno == EBADF) {
+			return;
+		}
+
+		/* No data available for reading; return */
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return;
+		}
+
+		_perror("read()");
+		close(timer->timer_fd);
+		return;
+	}
+
+	if (bytes != sizeof(uint64_t)) {
+		_fprintf(stderr, "Invalid number of timer bytes: %ld\n", bytes);
+		return;
+	}
+
+	_probe(timer, network, timer, exp);
+
+	if (timer->handler != NULL) {
+		timer->handler(network, timer);
+		return;
+	}
+
+	timerfd_gettime(timer->timer_fd, &timer_spec);
+	timer_event.num_expirations = exp;
+	timer_event.user_data = timer->user_data;
+	timer_event.next_expiry = &timer_spec.it_value;
+	timer_event.interval = &timer_spec.it_interval;
+	_probe(callback_entry, network, timer, 0);
+	network_watch_enter(network, (uintptr_t)timer, 0);
+	network->attr.timer_event_cb((network_timer_t)timer,
+	                             &timer_event, network->attr.user_data);
+	network_watch_leave(network);
+	_probe(callback_return, network, timer, 0);
+}
+
+static int32_t connection_send_payload(struct connection_data_t *connection)
+{
+	int32_t retval = 0;
+	ssize_t s = send(connection->socket_fd, connection->payload,
+	                 connection->payload_len, MSG_NOSIGNAL);
+
+	if (s == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		_perror("send()");
+		retval = -1;
+	} else {
+		s = s == -1 ? 0 : s;
+		_probe(send, connection, s);
+
+		/* The rest goes first from the queue, written on EPOLLOUT */
+		if ((size_t)s < connection->payload_len &&
+		    (send_queue_copy(connection, (uint8_t *)connection->payload + s,
+		                     connection->payload_len - s) == -1 ||
+		     network_connection_events(connection->network, connection,
+		                               EPOLLIN | EPOLLOUT | EPOLLET) == -1)) {
+			retval = -1;
+		}
+	}
+
+	free(connection->payload);
+	connection->payload = NULL;
+	connection->payload_len = 0;
+	return retval;
+}
+
+static int32_t connection_tls_init(struct connection_data_t *connection,
+                                   const struct connection_attr_t *attr)
+{
+#ifdef TLS
+	if (connection->socktype != SOCK_STREAM) {
+		_fprintf(stderr, "TLS requires a stream socket.\n");
+		return -1;
+	}
+
+	connection->tls_context = attr->tls_context;
+
+	/* Listeners only hand the context to accepted connections */
+	if (connection->mode == connection_mode_server) {
+		return 0;
+	}
+
+	return connection_tls_session(connection, attr->tls_context, attr->hostname);
+#else
+	(void)connection;
+	(void)attr;
+	_fprintf(stderr, "TLS support not compiled in.\n");
+	return -1;
+#endif
+}
+
+static void connection_tls_free(struct connection_data_t *connection)
+{
+#ifdef TLS
+	if (connection->tls != NULL) {
+		SSL_free(connection->tls);
+		connection->tls = NULL;
+	}
+#else
+	(void)connection;
+#endif
+}
+
+#ifdef TLS
+static int32_t connection_tls_session(struct connection_data_t *connection,
+                                      SSL_CTX *context, const char *hostname)
+{
+	struct in6_addr addr;
+	SSL *tls = SSL_new(context);
+
+	if (tls == NULL) {
+		_fprintf(stderr, "SSL_new(): %s\n", ERR_reason_error_string(ERR_get_error()));
+		return -1;
+	}
+
+	/* Records are handed to the kernel after the handshake if it supports kTLS */
+	SSL_set_options(tls, SSL_OP_ENABLE_KTLS | SSL_OP_IGNORE_UNEXPECTED_EOF);
+	SSL_set_mode(tls, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	if (SSL_set_fd(tls, connection->socket_fd) != 1) {
+		_fprintf(stderr, "SSL_set_fd(): %s\n", ERR_reason_error_string(ERR_get_error()));
+		SSL_free(tls);
+		return -1;
+	}
+
+	if (hostname == NULL) {
+		SSL_set_accept_state(tls);
+	} else {
+		SSL_set_connect_state(tls);
+
+		/* Server name indication and verification take host names only */
+		if (hostname[0] != '\0' && inet_pton(AF_INET, hostname, &addr) != 1 &&
+		    inet_pton(AF_INET6, hostname, &addr) != 1) {
+			SSL_set_tlsext_host_name(tls, hostname);
+			SSL_set1_host(tls, hostname);
+		}
+	}
+
+	connection->tls = tls;
+	connection->tls_handshake = 1;
+	return 0;
+}
+
+static void handle_tls_handshake(struct network_data_t *network,
+                                 struct connection_data_t *connection,
+                                 struct connection_event_t *conn_event)
+{
+	if (connection->tls_handshake) {
+		int32_t s;
+		ERR_clear_error();
+		s = SSL_do_handshake(connection->tls);
+
+		if (s != 1) {
+			switch (SSL_get_error(connection->tls, s)) {
+				case SSL_ERROR_WANT_READ:
+					network_connection_events(network, connection, EPOLLIN | EPOLLET);
+					return;
+
+				case SSL_ERROR_WANT_WRITE:
+					network_connection_events(network, connection,
+					                          EPOLLIN | EPOLLOUT | EPOLLET);
+					return;
+
+				default:
+					_fprintf(stderr, "SSL_do_handshake(): %s\n",
+					         ERR_reason_error_string(ERR_get_error()));
+					connection_close_socket(connection);
+					conn_event->user_data = connection->user_data;
+					conn_event->data_len = conn_event->addr_len = 0;
+					conn_event->event_type = connection_event_connection_error;
+					network_dispatch(network, connection, conn_event);
+					return;
+			}
+		}
+
+		connection->tls_handshake = 0;
+		conn_event->data_len = conn_event->addr_len = 0;
+		conn_event->user_data = connection->user_data;
+		conn_event->event_type = connection_event_connection_created;
+		network_dispatch(network, connection, conn_event);
+
+		/* Closed by the user? */
+		if (connection->socket_fd == -1) {
+			return;
+		}
+	}
+
+	/* Reading no longer waits for the socket to become writable */
+	if ((connection->events & EPOLLOUT) &&
+	    network_connection_events(network, connection, EPOLLIN | EPOLLET) == -1) {
+		return;
+	}
+
+	/* Records that arrived with the handshake raise no new edge */
+	handle_connection_data(network, connection, conn_event);
+}
+
+static ssize_t connection_tls_result(struct connection_data_t *connection,
+                                     int32_t s, size_t len)
+{
+	if (s == 1) {
+		return len;
+	}
+
+	switch (SSL_get_error(connection->tls, s)) {
+		case SSL_ERROR_ZERO_RETURN:
+			/* Closed by the remote host */
+			return 0;
+
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			errno = EAGAIN;
+			return -1;
+
+		case SSL_ERROR_SYSCALL:
+			/* The errno of the failed call is kept */
+			return -1;
+
+		default:
+			_fprintf(stderr, "SSL: %s\n", ERR_reason_error_string(ERR_get_error()));
+			errno = EPROTO;
+			return -1;
+	}
+}
+
+static ssize_t connection_tls_write(struct connection_data_t *connection,
+                                    const void *data, size_t len)
+{
+	size_t n = 0;
+
+	if (connection->tls_handshake) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	ERR_clear_error();
+	return connection_tls_result(connection,
+	                             SSL_write_ex(connection->tls, data, len, &n), n);
+}
+
+static ssize_t connection_tls_sendfile(struct connection_data_t *connection,
+                                       int32_t fd, off_t *offset, size_t count)
+{
+	/* One record worth of data per call without offload */
+	uint8_t buffer[16384];
+	off_t pos = offset != NULL ? *offset : lseek(fd, 0, SEEK_CUR);
+	ssize_t s;
+
+	if (pos == -1) {
+		_perror("lseek()");
+		return -1;
+	}
+
+	if (connection->tls_handshake) {
+		errno = EAGAIN;
+		s = -1;
+	} else if (BIO_get_ktls_send(SSL_get_wbio(connection->tls))) {
+		/* The kernel encrypts the pages on their way out */
+		ERR_clear_error();
+		s = SSL_sendfile(connection->tls, fd, pos, count, 0);
+
+		if (s < 0) {
+			s = connection_tls_result(connection, s, 0);
+		}
+	} else {
+		s = pread(fd, buffer, count < sizeof(buffer) ? count : sizeof(buffer), pos);
+
+		if (s > 0) {
+			s = connection_tls_write(connection, buffer, s);
+		}
+	}
+
+	if (s == -1) {
+		_perror("sendfile()");
+		return -1;
+	}
+
+	if (offset != NULL) {
+		*offset = pos + s;
+	} else if (lseek(fd, pos + s, SEEK_SET) == -1) {
+		_perror("lseek()");
+		return -1;
+	}
+
+	_probe(send, connection, s);
+	return s;
+}
+
+static int32_t connection_tls_encrypts(struct connection_data_t *connection)
+{
+	/* Sessions not offloaded to the kernel are encrypted here */
+	return connection->tls != NULL &&
+	       (connection->tls_handshake || !BIO_get_ktls_send(SSL_get_wbio(connection->tls)));
+}
+#endif
+
+static int32_t network_connection_events(struct network_data_t *network,
+                                         struct connection_data_t *connection,
+                                         uint32_t events)
+{
+	struct epoll_event event = {0};
+
+	if (connection->events == events) {
+		return 0;
+	}
+
+	event.events = events;
+	event.data.ptr = connection;
+
+	if (epoll_ctl(network->epoll_fd, EPOLL_CTL_MOD,
+	              connection->socket_fd, &event) == -1) {
+		_perror("epoll_ctl()");
+		return -1;
+	}
+
+	connection->events = events;
+	return 0;
+}
+
+static void handle_connection_writable(struct network_data_t *network,
+                                       struct connection_data_t *connection,
+                                       struct connection_event_t *conn_event,
+                                       uint32_t events)
+{
+	uint8_t want_write = connection->want_write;
+
+	/* Queued buffers go first; the socket reports again once it drains */
+	send_queue_flush(connection);
+
+	if (connection->send_queue.len == 0) {
+		/* One notification per request */
+		connection->want_write = 0;
+
+		if (network_connection_events(network, connection, EPOLLIN | EPOLLET) == -1) {
+			return;
+		}
+
+		if (want_write) {
+			conn_event->data_len = conn_event->addr_len = 0;
+			conn_event->user_data = connection->user_data;
+			conn_event->event_type = connection_event_connection_writable;
+			network_dispatch(network, connection, conn_event);
+		}
+	}
+
+	/* The read edge came with this event; it is not raised again */
+	if ((events & EPOLLIN) && connection->socket_fd != -1) {
+		handle_connection_data(network, connection, conn_event);
+	}
+}
+
+static void network_dispatch(struct network_data_t *network,
+                             struct connection_data_t *connection,
+                             struct connection_event_t *conn_event)
+{
+	const struct connection_handlers_t *handlers = connection->handlers;
+	connection_event_cb_t callback = NULL;
+
+	/* Idle in the client pool; not held by the application */
+	if (connection->pool_idle) {
+		connection_pool_event(connection, conn_event);
+		return;
+	}
+
+	if (handlers != NULL) {
+		switch (conn_event->event_type) {
+			case connection_event_data_received:
+				callback = handlers->on_data;
+				break;
+
+			case connection_event_connection_accepted:
+				callback = handlers->on_accept;
+				break;
+
+			case connection_event_connection_closed:
+				callback = handlers->on_close;
+				break;
+
+			case connection_event_connection_error:
+				callback = handlers->on_error;
+				break;
+
+			case connection_event_connection_created:
+				callback = handlers->on_created;
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	/* The callback may free the connection; only its address is traced after */
+	_probe(callback_entry, network, connection, conn_event->event_type);
+	network_watch_enter(network, (uintptr_t)connection, conn_event->event_type);
+
+	if (callback != NULL) {
+		callback((connection_t)connection, conn_event, handlers->context);
+	} else if (network->attr.connection_event_cb != NULL) {
+		network->attr.connection_event_cb((connection_t)connection,
+		                                  conn_event, network->attr.user_data);
+	}
+
+	network_watch_leave(network);
+	_probe(callback_return, network, connection, conn_event->event_type);
+}
+
+static void network_watch_enter(struct network_data_t *network,
+                                uintptr_t handle, uint32_t type)
+{
+#ifdef PTHREAD
+
+	/* Nested callbacks count towards the outermost one */
+	if (network->watchdog_running && network->watch_depth++ == 0) {
+		/* Seqlock: the watchdog rereads the entry time to validate the rest */
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		__atomic_store_n(&network->watch_handle, handle, __ATOMIC_RELAXED);
+		__atomic_store_n(&network->watch_type, type, __ATOMIC_RELAXED);
+		__atomic_store_n(&network->watch_entered, network_time_now(), __ATOMIC_RELEASE);
+	}
+
+#else
+	(void)network;
+	(void)handle;
+	(void)type;
+#endif
+}
+
+static void network_watch_leave(struct network_data_t *network)
+{
+#ifdef PTHREAD
+
+	if (network->watchdog_running && --network->watch_depth == 0) {
+		__atomic_store_n(&network->watch_entered, 0, __ATOMIC_RELEASE);
+	}
+
+#else
+	(void)network;
+#endif
+}
+
+#ifdef PTHREAD
+
+static void network_watchdog_signal(int32_t signum)
+{
+	struct network_data_t *network = watchdog_network;
+	int32_t saved_errno = errno;
+	(void)signum;
+
+	if (network != NULL) {
+		network->backtrace_len = backtrace(network->backtrace, WATCHDOG_BACKTRACE_MAX);
+		sem_post(&network->backtrace_done);
 	}
 
-	event.data.ptr = conn;
-	event.events = EPOLLIN | EPOLLET;
+	errno = saved_errno;
+}
 
-	if (epoll_ctl(network->epoll_fd, EPOLL_CTL_ADD,
-	              conn->socket_fd, &event) == -1) {
-		_perror("epoll_ctl()");
-		free(conn);
-		return -1;
+static void network_watchdog_report(struct network_data_t *network, uint64_t entered,
+                                    uintptr_t handle, uint32_t type, uint64_t elapsed)
+{
+	struct network_watchdog_event_t event = {0};
+	int32_t signum = network->attr.watchdog.backtrace_signal;
+	event.handle = handle;
+	event.event_type = type;
+	event.elapsed.tv_sec = elapsed / NSEC_PER_SEC;
+	event.elapsed.tv_nsec = elapsed % NSEC_PER_SEC;
+
+	if (signum != 0) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += NSEC_PER_SEC / 10;
+
+		if (deadline.tv_nsec >= NSEC_PER_SEC) {
+			deadline.tv_sec += 1;
+			deadline.tv_nsec -= NSEC_PER_SEC;
+		}
+
+		/* A late answer to an earlier request would be taken for this one */
+		while (sem_trywait(&network->backtrace_done) == 0);
+
+		/* Only a stack still inside the stalled callback is reported */
+		if (pthread_kill(network->loop_thread, signum) == 0 &&
+		    sem_timedwait(&network->backtrace_done, &deadline) == 0 &&
+		    __atomic_load_n(&network->watch_entered, __ATOMIC_ACQUIRE) == entered) {
+			event.backtrace = network->backtrace;
+			event.backtrace_len = network->backtrace_len;
+		}
 	}
 
-	network->ipc = conn;
-	return 0;
+	if (network->attr.watchdog.watchdog_cb != NULL) {
+		network->attr.watchdog.watchdog_cb((network_t)network, &event,
+		                                   network->attr.user_data);
+		return;
+	}
+
+	fprintf(stderr, "Slow callback: handle=%#lx, event_type=%u, elapsed=%ld.%09ld\n",
+	        (unsigned long)handle, type, (long)event.elapsed.tv_sec, event.elapsed.tv_nsec);
+
+	if (event.backtrace != NULL) {
+		backtrace_symbols_fd(event.backtrace, event.backtrace_len, STDERR_FILENO);
+	}
 }
 
-static int32_t network_socket_create(struct connection_data_t *connection, const struct connection_attr_t *attr)
+static void *network_watchdog(void *args)
 {
-	struct addrinfo *rp, *result;
-	int32_t s = getaddrinfo(attr->hostname, attr->service, &attr->hints, &result);
+	struct network_data_t *network = (struct network_data_t *)args;
+	const struct timespec *threshold = &network->attr.watchdog.threshold;
+	uint64_t limit = threshold->tv_sec * NSEC_PER_SEC + threshold->tv_nsec;
+	/* Stalls are noticed within a quarter of the threshold */
+	uint64_t period = limit / 4 > NSEC_PER_SEC / 1000 ? limit / 4 : NSEC_PER_SEC / 1000;
+	uint64_t reported = 0;
+	pthread_mutex_lock(&network->lock);
 
-	if (s != 0) {
-		_fprintf(stderr, "getaddrinfo(): %s\n", gai_strerror(s));
-		return -1;
-	}
+	while (network->watchdog_running) {
+		uint64_t entered, now, wakeup = network_time_now() + period;
+		struct timespec deadline = {
+			.tv_sec = wakeup / NSEC_PER_SEC,
+			.tv_nsec = wakeup % NSEC_PER_SEC,
+		};
+		uintptr_t handle;
+		uint32_t type;
+		pthread_cond_timedwait(&network->watchdog_cond, &network->lock, &deadline);
 
-	for (rp = result; rp != NULL; rp = rp->ai_next) {
-		connection->socket_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+		if (!network->watchdog_running) {
+			break;
+		}
 
-		if (connection->socket_fd == -1) {
+		entered = __atomic_load_n(&network->watch_entered, __ATOMIC_ACQUIRE);
+		now = network_time_now();
+
+		/* Each stall is reported once */
+		if (entered == 0 || entered == reported || now - entered < limit) {
 			continue;
 		}
 
-		if (network_socket_non_blocking(connection->socket_fd) == -1) {
-			close(connection->socket_fd);
+		handle = __atomic_load_n(&network->watch_handle, __ATOMIC_RELAXED);
+		type = __atomic_load_n(&network->watch_type, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&network->watch_entered, __ATOMIC_RELAXED) != entered) {
 			continue;
 		}
 
-		if (attr->mode == connection_mode_client) {
-			s = network_socket_connect(connection->socket_fd, rp, attr);
-		} else if (attr->mode == connection_mode_server) {
-			s = network_socket_bind(connection->socket_fd, rp);
-		} else {
-			_fprintf(stderr, "Invalid connection mode: %d\n", attr->mode);
-			s = -1;
-		}
+		reported = entered;
+		pthread_mutex_unlock(&network->lock);
+		network_watchdog_report(network, entered, handle, type, now - entered);
+		pthread_mutex_lock(&network->lock);
+	}
 
-		if (s == 0) {
-			connection->socktype = rp->ai_socktype;
-			break;
+	pthread_mutex_unlock(&network->lock);
+	return NULL;
+}
+
+static int32_t network_watchdog_start(struct network_data_t *network)
+{
+	const struct network_watchdog_attr_t *attr = &network->attr.watchdog;
+	network->watch_entered = 0;
+	network->watch_depth = 0;
+
+	if (attr->threshold.tv_sec == 0 && attr->threshold.tv_nsec == 0) {
+		return 0;
+	}
+
+	if (attr->backtrace_signal != 0) {
+		struct sigaction action;
+		void *frame;
+		/* The unwinder allocates when first loaded; not in the handler */
+		backtrace(&frame, 1);
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = network_watchdog_signal;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+
+		if (sigaction(attr->backtrace_signal, &action, NULL) == -1) {
+			_perror("sigaction()");
+			return -1;
 		}
 
-		close(connection->socket_fd);
+		watchdog_network = network;
 	}
 
-	if (rp == NULL) {
-		_fprintf(stderr, "Creating socket failed.\n");
-		freeaddrinfo(result);
+	network->watchdog_running = 1;
+
+	if (pthread_create(&network->watchdog_thread, NULL, network_watchdog, network)) {
+		_perror("pthread_create()");
+		network->watchdog_running = 0;
+		watchdog_network = NULL;
 		return -1;
 	}
 
-	freeaddrinfo(result);
 	return 0;
 }
 
-static int32_t network_socket_connect(int32_t socket_fd, struct addrinfo *result, const struct connection_attr_t *attr)
+static void network_watchdog_stop(struct network_data_t *network)
 {
-	if (attr->src_addrlen > 0) {
-		/* Bind to a source address/port if given by the user */
-		if (bind(socket_fd, attr->src_addr, attr->src_addrlen) == -1) {
-			_perror("bind()");
-			return -1;
-		}
+	if (!network->watchdog_running) {
+		return;
 	}
 
-	if (connect(socket_fd, result->ai_addr, result->ai_addrlen) == -1) {
-		if (errno != EINPROGRESS) {
-			_perror("connect()");
-			return -1;
-		}
+	pthread_mutex_lock(&network->lock);
+	network->watchdog_running = 0;
+	pthread_cond_signal(&network->watchdog_cond);
+	pthread_mutex_unlock(&network->lock);
+
+	if (pthread_join(network->watchdog_thread, NULL)) {
+		_perror("pthread_join()");
 	}
 
-	return 0;
+	/* The handler stays installed and ignores a late signal */
+	watchdog_network = NULL;
 }
 
-static int32_t network_socket_bind(int32_t socket_fd, struct addrinfo *result)
+static int32_t offload_ring_create(struct offload_ring_t *ring, uint32_t size)
 {
-	if (bind(socket_fd, result->ai_addr, result->ai_addrlen) == -1) {
-		_perror("bind()");
+	ring->items = calloc(size, sizeof(*ring->items));
+
+	if (ring->items == NULL) {
+		_perror("calloc()");
 		return -1;
 	}
 
-	/* Listen only STREAM and SEQPACKET sockets */
-	if (result->ai_socktype != SOCK_STREAM &&
-	    result->ai_socktype != SOCK_SEQPACKET) {
+	ring->mask = size - 1;
+	ring->head = ring->tail = 0;
+	return 0;
+}
+
+/* Room is guaranteed by the requests in flight of the worker */
+static void offload_ring_push(struct offload_ring_t *ring, const struct offload_item_t *item)
+{
+	uint32_t tail = ring->tail;
+	ring->items[tail & ring->mask] = *item;
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static uint8_t offload_ring_pop(struct offload_ring_t *ring, struct offload_item_t *item)
+{
+	uint32_t head = ring->head;
+
+	if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
 		return 0;
 	}
 
-	if (listen(socket_fd, SOMAXCONN) == -1) {
-		_perror("listen()");
+	*item = ring->items[head & ring->mask];
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static struct offload_worker_t *network_worker_select(struct network_data_t *network)
+{
+	uint32_t i, best = network->next_worker % network->num_workers;
+
+	/* The least busy, starting from the one after the previous choice */
+	for (i = 1; i < network->num_workers; ++i) {
+		uint32_t j = (network->next_worker + i) % network->num_workers;
+
+		if (network->workers[j].pending < network->workers[best].pending) {
+			best = j;
+		}
+	}
+
+	network->next_worker = best + 1;
+	return &network->workers[best];
+}
+
+static void network_worker_run(struct offload_worker_t *worker, struct offload_item_t *item)
+{
+	struct network_data_t *network = worker->network;
+	struct network_work_t work = {0};
+	work.connection = (connection_t)item->connection;
+	work.user_data = item->user_data;
+	work.data = item->buffer->data;
+	work.data_len = item->buffer->len;
+	network->attr.offload.work_cb((network_t)network, &work, network->attr.user_data);
+	buffer_release(item->buffer);
+	item->buffer = (struct buffer_data_t *)work.result;
+	offload_ring_push(&worker->results, item);
+
+	/* One wakeup until the loop takes the results of every worker */
+	if (!__atomic_exchange_n(&network->offload_signaled, 1, __ATOMIC_SEQ_CST)) {
+		network_wakeup(network);
+	}
+}
+
+static void *network_worker(void *args)
+{
+	struct offload_worker_t *worker = (struct offload_worker_t *)args;
+	struct offload_item_t item;
+	uint64_t data;
+
+	while (!__atomic_load_n(&worker->stopped, __ATOMIC_ACQUIRE)) {
+		if (offload_ring_pop(&worker->requests, &item)) {
+			network_worker_run(worker, &item);
+			continue;
+		}
+
+		/* The loop writes the eventfd for a sleeper; recheck after announcing */
+		__atomic_store_n(&worker->sleeping, 1, __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&worker->requests.tail, __ATOMIC_SEQ_CST) == worker->requests.head &&
+		    read(worker->wake_fd, &data, sizeof(data)) == -1 && errno != EINTR) {
+			_perror("read()");
+		}
+
+		__atomic_store_n(&worker->sleeping, 0, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static int32_t network_workers_create(struct network_data_t *network)
+{
+	const struct network_offload_attr_t *attr = &network->attr.offload;
+	uint32_t i, size = 1, queue_len = attr->queue_len > 0 ? attr->queue_len : 256;
+
+	while (size < queue_len) {
+		size <<= 1;
+	}
+
+	network->workers = calloc(attr->num_workers, sizeof(*network->workers));
+
+	if (network->workers == NULL) {
+		_perror("calloc()");
 		return -1;
 	}
 
+	for (i = 0; i < attr->num_workers; ++i) {
+		struct offload_worker_t *worker = &network->workers[i];
+		worker->network = network;
+		worker->wake_fd = -1;
+		network->num_workers = i + 1;
+
+		if (offload_ring_create(&worker->requests, size) == -1 ||
+		    offload_ring_create(&worker->results, size) == -1) {
+			network_workers_free(network);
+			return -1;
+		}
+
+		worker->wake_fd = eventfd(0, EFD_CLOEXEC);
+
+		if (worker->wake_fd == -1) {
+			_perror("eventfd()");
+			network_workers_free(network);
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
-static int32_t network_socket_non_blocking(int32_t socket_fd)
+static int32_t network_workers_start(struct network_data_t *network)
 {
-	int32_t flags = fcntl(socket_fd, F_GETFL, 0);
+	uint32_t i;
 
-	if (flags == -1) {
-		_perror("fcntl()");
-		return -1;
+	if (network->attr.offload.num_workers == 0) {
+		return 0;
 	}
 
-	if (fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
-		_perror("fcntl()");
+	/* Created with the first start; requests left by a stop are kept */
+	if (network->workers == NULL && network_workers_create(network) == -1) {
 		return -1;
 	}
 
+	for (i = 0; i < network->num_workers; ++i) {
+		struct offload_worker_t *worker = &network->workers[i];
+		worker->stopped = 0;
+
+		if (pthread_create(&worker->thread, NULL, network_worker, worker)) {
+			_perror("pthread_create()");
+			network->num_workers = i;
+			network_workers_stop(network);
+			network->num_workers = network->attr.offload.num_workers;
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
-static void *network_eventloop(void *args)
+static void network_workers_stop(struct network_data_t *network)
 {
-	struct epoll_event *events, event = {0};
-	struct connection_event_t conn_event = {0};
-	struct network_data_t *network;
-	events = calloc(SOMAXCONN, sizeof(event));
-	network = (struct network_data_t *)args;
-	network->loop_retval = 0;
+	uint64_t data = 1;
+	uint32_t i;
 
-	if (events == NULL) {
-		network->loop_retval = -1;
-		_perror("calloc()");
-		return NULL;
+	for (i = 0; i < network->num_workers; ++i) {
+		__atomic_store_n(&network->workers[i].stopped, 1, __ATOMIC_RELEASE);
+
+		if (write(network->workers[i].wake_fd, &data, sizeof(data)) == -1) {
+			_perror("write()");
+		}
 	}
 
-	conn_event.data_buffer = network->attr.data_buffer;
+	for (i = 0; i < network->num_workers; ++i) {
+		if (pthread_join(network->workers[i].thread, NULL)) {
+			_perror("pthread_join()");
+		}
+	}
+}
 
-	while (1) {
-		int32_t i, j = epoll_wait(network->epoll_fd, events, SOMAXCONN, -1);
+static void network_offload_return(struct offload_worker_t *worker, struct offload_item_t *item)
+{
+	struct connection_data_t *connection = item->connection;
+	--worker->pending;
+	--connection->work_pending;
 
-		if (j == -1) {
-			/* Error or interrupt occurred */
-			if (errno != EINTR) {
-				network->loop_retval = -1;
-				_perror("epoll_wait()");
-			}
+	if (item->buffer != NULL) {
+		buffer_release(item->buffer);
+	}
 
-			break;
-		}
+	if (connection->orphaned && connection->work_pending == 0) {
+		connection->orphaned = 0;
+		connection_free((connection_t)connection);
+	}
+}
 
-		for (i = 0; i < j; ++i) {
-			struct connection_data_t *connection = events[i].data.ptr;
+static void network_offload_process(struct network_data_t *network,
+                                    struct connection_event_t *conn_event)
+{
+	struct offload_item_t item;
+	uint32_t i;
+	/* Results pushed from now on wake the loop again */
+	__atomic_exchange_n(&network->offload_signaled, 0, __ATOMIC_SEQ_CST);
 
-			/* Any activity on the IPC socket ends the event loop */
-			if (connection->socket_fd == network->ipc->socket_fd) {
-				goto END;
+	for (i = 0; i < network->num_workers; ++i) {
+		struct offload_worker_t *worker = &network->workers[i];
+
+		while (offload_ring_pop(&worker->results, &item)) {
+			struct connection_data_t *connection = item.connection;
+
+			if (connection->orphaned) {
+				network_offload_return(worker, &item);
+				continue;
 			}
 
-			if ((events[i].events & EPOLLERR) ||
-			    (events[i].events & EPOLLHUP)) {
-				/* Error occurred; close the connection */
-				close(connection->socket_fd);
-				conn_event.user_data = connection->user_data;
-				conn_event.data_len = conn_event.addr_len = 0;
-				conn_event.event_type = connection_event_connection_error;
-				network->attr.connection_event_cb((connection_t)connection,
-				                                  &conn_event, network->attr.user_data);
-			} else if (events[i].events & EPOLLOUT) {
-				/* Outgoing connection succeeded */
-				event.events = EPOLLIN | EPOLLET;
-				event.data.ptr = connection;
+			conn_event->data_len = conn_event->addr_len = 0;
 
-				/* Remove EPOLLOUT so that we don't receive it again */
-				if (epoll_ctl(network->epoll_fd, EPOLL_CTL_MOD,
-				              connection->socket_fd, &event) == -1) {
-					_perror("epoll_ctl()");
-					continue;
-				}
+			if (item.buffer != NULL) {
+				conn_event->buffer = (network_buffer_t)item.buffer;
+				conn_event->data_buffer = item.buffer->data;
+				conn_event->data_len = item.buffer->len;
+			}
 
-				conn_event.data_len = conn_event.addr_len = 0;
-				conn_event.user_data = connection->user_data;
-				conn_event.event_type = connection_event_connection_created;
-				network->attr.connection_event_cb((connection_t)connection,
-				                                  &conn_event, network->attr.user_data);
-			} else if (events[i].events & EPOLLIN) {
-				/* Handle timer expiration event if data type is timer */
-				if (connection->data_type == data_type_timer) {
-					handle_timer(network, (struct timer_data_t *)connection);
-					continue;
-				}
+			/* Freeing the connection in the callback waits for the rest */
+			--worker->pending;
+			--connection->work_pending;
+			conn_event->user_data = connection->user_data;
+			conn_event->event_type = connection_event_work_completed;
+			network_dispatch(network, connection, conn_event);
+			conn_event->data_buffer = network->attr.data_buffer;
+			conn_event->buffer = 0;
 
-				if (connection->mode == connection_mode_server &&
-				    (connection->socktype == SOCK_STREAM ||
-				     connection->socktype == SOCK_SEQPACKET)) {
-					/* New connection on a connection-oriented socket */
-					while (1) {
-						struct connection_data_t *ptr;
-						struct sockaddr_storage in_addr;
-						socklen_t in_len = sizeof(in_addr);
-						int32_t socket_fd = accept(connection->socket_fd,
-						                           (struct sockaddr *)
-						                           &in_addr, &in_len);
-
-						if (socket_fd == -1) {
-							/* Closed by the user? */
-							if (errno == EBADF) {
-								break;
-							}
-
-							/* No more incoming connections; break the loop */
-							if (errno == EAGAIN || errno == EWOULDBLOCK) {
-								break;
-							}
-
-							_perror("accept()");
-							break;
-						}
-
-						ptr = malloc(sizeof(*ptr));
-
-						if (ptr == NULL) {
-							_perror("malloc()");
-							close(socket_fd);
-							break;
-						}
-
-						memset(ptr, 0, sizeof(*ptr));
-						ptr->mode = connection_mode_client;
-						ptr->data_type = data_type_connection;
-						ptr->socket_fd = socket_fd;
-
-						if (network_socket_non_blocking(ptr->socket_fd) == -1) {
-							close(socket_fd);
-							free(ptr);
-							break;
-						}
-
-						event.events = EPOLLIN | EPOLLET;
-						event.data.ptr = ptr;
-
-						if (epoll_ctl(network->epoll_fd, EPOLL_CTL_ADD,
-						              ptr->socket_fd, &event) == -1) {
-							_perror("epoll_ctl()");
-							close(socket_fd);
-							free(ptr);
-							break;
-						}
-
-						conn_event.data_len = 0;
-						conn_event.addr_len = in_len;
-						conn_event.addr = (struct sockaddr *)&in_addr;
-						conn_event.new_connection = (connection_t)ptr;
-						conn_event.user_data = connection->user_data;
-						conn_event.event_type = connection_event_connection_accepted;
-						network->attr.connection_event_cb((connection_t)connection,
-						                                  &conn_event, network->attr.user_data);
-					}
-				} else {
-					/* Data from an existing connection */
-					int32_t closed = 0;
-
-					while (1) {
-						struct sockaddr_storage in_addr;
-						socklen_t in_len = sizeof(in_addr);
-						/* Structure in_addr is ignored with connection-oriented sockets */
-						ssize_t count = (connection->socktype == SOCK_SEQPACKET) ?
-						                recvmsg(connection->socket_fd, network->attr.data_buffer, 0) :
-						                recvfrom(connection->socket_fd, network->attr.data_buffer,
-						                         network->attr.buffer_len, 0, (struct sockaddr *)
-						                         &in_addr, &in_len);
-
-						if (count == -1) {
-							/* Closed by the user? */
-							if (errno == EBADF) {
-								closed = 1;
-								break;
-							}
-
-							/* No more data to read; break the loop */
-							if (errno == EAGAIN || errno == EWOULDBLOCK) {
-								break;
-							}
-
-							_perror("recv()");
-							closed = 1;
-							break;
-						} else if (count == 0) {
-							/* Closed by the remote host */
-							closed = 1;
-							break;
-						}
-
-						conn_event.data_len = count;
-						conn_event.addr_len = in_len;
-						conn_event.addr = (struct sockaddr *)&in_addr;
-						conn_event.user_data = connection->user_data;
-						conn_event.event_type = connection_event_data_received;
-						network->attr.connection_event_cb((connection_t)connection,
-						                                  &conn_event, network->attr.user_data);
-					}
-
-					if (closed) {
-						close(connection->socket_fd);
-						conn_event.data_len = conn_event.addr_len = 0;
-						conn_event.user_data = connection->user_data;
-						conn_event.event_type = connection_event_connection_closed;
-						network->attr.connection_event_cb((connection_t)connection,
-						                                  &conn_event, network->attr.user_data);
-					}
-				}
+			if (item.buffer != NULL) {
+				buffer_release(item.buffer);
 			}
 		}
 	}
-
-END:
-	free(events);
-	return NULL;
 }
 
-static void handle_timer(struct network_data_t *network, struct timer_data_t *timer)
+static void network_workers_free(struct network_data_t *network)
 {
-	struct network_timer_event_t timer_event = {0};
-	struct itimerspec timer_spec;
-	uint64_t exp;
-	ssize_t bytes;
-	bytes = read(timer->timer_fd, &exp, sizeof(uint64_t));
+	struct offload_item_t item;
+	uint32_t i;
 
-	if (bytes == -1) {
-		/* Closed by the user? */
-		if (errno == EBADF) {
-			return;
+	if (network->workers == NULL) {
+		return;
+	}
+
+	for (i = 0; i < network->num_workers; ++i) {
+		struct offload_worker_t *worker = &network->workers[i];
+
+		/* The requests still hold the data; the results hold their own */
+		while (worker->requests.items != NULL && offload_ring_pop(&worker->requests, &item)) {
+			buffer_release(item.buffer);
+			item.buffer = NULL;
+			network_offload_return(worker, &item);
 		}
 
-		/* No data available for reading; return */
-		if (errno == EAGAIN || errno == EWOULDBLOCK) {
-			return;
+		while (worker->results.items != NULL && offload_ring_pop(&worker->results, &item)) {
+			network_offload_return(worker, &item);
 		}
 
-		_perror("read()");
-		close(timer->timer_fd);
-		return;
-	}
+		free(worker->requests.items);
+		free(worker->results.items);
 
-	if (bytes != sizeof(uint64_t)) {
-		_fprintf(stderr, "Invalid number of timer bytes: %ld\n", bytes);
-		return;
+		if (worker->wake_fd != -1) {
+			close(worker->wake_fd);
+		}
 	}
 
-	timerfd_gettime(timer->timer_fd, &timer_spec);
-	timer_event.num_expirations = exp;
-	timer_event.user_data = timer->user_data;
-	timer_event.next_expiry = &timer_spec.it_value;
-	timer_event.interval = &timer_spec.it_interval;
-	network->attr.timer_event_cb((network_timer_t)timer,
-	                             &timer_event, network->attr.user_data);
+	free(network->workers);
+	network->workers = NULL;
+	network->num_workers = 0;
 }
+
+#endif
@@ -10,11 +10,55 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <errno.h>
 #ifdef PTHREAD
 #include <pthread.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <execinfo.h>
+#endif
+#ifdef TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+/* Default lower bound of the adaptive event batch */
+#define NETWORK_MIN_EVENTS 8
+/* Consecutive wakeups after which the event batch is resized */
+#define NETWORK_ADAPT_WAKEUPS 4
+/* Default reads per wakeup of the normal and low priority classes */
+#define NETWORK_NORMAL_READS 16
+#define NETWORK_LOW_READS 4
+/* Token buckets count nanotokens to refill at nanosecond resolution */
+#define NSEC_PER_SEC 1000000000LL
+/* Receive rings backed by huge pages are rounded up to this size */
+#define RING_HUGE_PAGE_SIZE (2UL << 20)
+/* Queued buffers written by one sendmsg() */
+#define SEND_QUEUE_IOV 64
+/* Initial and largest staging buffer of an auto-corked connection */
+#define CONNECTION_CORK_SIZE 4096
+#define CONNECTION_CORK_MAX (64 * 1024)
+/* Hostname, service, hints and TLS context of a pooled connection */
+#define CONNECTION_POOL_KEY 384
+/* Frames captured of a stalled event loop */
+#define WATCHDOG_BACKTRACE_MAX 64
+
+#ifdef PTHREAD
+#define _lock(x) do { pthread_mutex_lock(&(x)->lock); } while(0)
+#define _unlock(x) do { pthread_mutex_unlock(&(x)->lock); } while(0)
+#else
+#define _lock(x) do { } while(0)
+#define _unlock(x) do { } while(0)
 #endif
 
 typedef enum {
@@ -22,28 +66,298 @@ typedef enum {
     data_type_connection = 2
 } data_type_e;
 
+typedef enum {
+    ipc_message_migrate = 1,
+    ipc_message_attach = 2,
+    ipc_message_rebalance = 3
+} ipc_message_e;
+
+struct network_data_t;
+
 struct timer_data_t {
 	data_type_e data_type;
 	int32_t timer_fd;
 	network_timer_type_e timer_type;
 	user_data_t user_data;
+	/* Handler of an internal timer; bypasses timer_event_cb */
+	void (*handler)(struct network_data_t *network, struct timer_data_t *timer);
+};
+
+struct accept_counter_t {
+	/* The listener and each of its accepted connections */
+	uint32_t refs;
+	/* Accepted connections with an open socket */
+	uint32_t count;
+	/* Network of the listener; woken up when accepting may resume */
+	struct network_data_t *network;
+};
+
+struct rate_bucket_t {
+	int64_t bytes;
+	int64_t messages;
+	uint64_t updated;
+};
+
+struct ring_buffer_t {
+	/* Two mappings of the same pages, back to back */
+	uint8_t *base;
+	size_t size;
+	/* Unread data: len bytes from the offset head */
+	size_t head;
+	size_t len;
+	uint8_t hugepages;
+	/* Reading stopped with the ring full */
+	uint8_t stalled;
+};
+
+struct buffer_pool_t;
+
+struct buffer_data_t {
+	struct buffer_pool_t *pool;
+	/* Next free buffer of the pool */
+	struct buffer_data_t *next;
+	uint8_t *data;
+	size_t len;
+	uint32_t refs;
+};
+
+struct buffer_pool_t {
+	struct buffer_data_t *buffers;
+	uint8_t *memory;
+	size_t buffer_size;
+	struct buffer_data_t *free;
+	uint32_t num_buffers;
+	uint32_t num_free;
+	/* Freed with the last buffer once the network is gone */
+	uint8_t closed;
+#ifdef PTHREAD
+	pthread_mutex_t lock;
+#endif
+};
+
+#ifdef PTHREAD
+
+struct offload_item_t {
+	struct connection_data_t *connection;
+	/* The data handed off, and then the result (NULL = none) */
+	struct buffer_data_t *buffer;
+	user_data_t user_data;
+};
+
+struct offload_ring_t {
+	/* Single producer and consumer; each index on its own cache line */
+	struct offload_item_t *items;
+	uint32_t mask;
+	uint32_t head __attribute__((aligned(64)));
+	uint32_t tail __attribute__((aligned(64)));
+};
+
+struct offload_worker_t {
+	struct network_data_t *network;
+	pthread_t thread;
+	/* Requests of the loop, and the results going back to it */
+	struct offload_ring_t requests;
+	struct offload_ring_t results;
+	/* Requests not yet returned to the loop; bounds the result ring */
+	uint32_t pending;
+	/* Blocked on the eventfd for requests */
+	int32_t wake_fd;
+	uint8_t sleeping;
+	uint8_t stopped;
+};
+
+#endif
+
+struct send_queue_t {
+	/* Referenced buffers waiting for the socket, oldest at head */
+	struct buffer_data_t **buffers;
+	size_t head;
+	size_t len;
+	size_t capacity;
+	/* Bytes of the oldest buffer already sent, and of all not sent */
+	size_t offset;
+	size_t bytes;
 };
 
 struct connection_data_t {
 	data_type_e data_type;
 	int32_t socket_fd;
 	int32_t socktype;
+	int32_t family;
 	connection_mode_e mode;
 	user_data_t user_data;
+	/* Events of this connection; NULL = the network callback */
+	const struct connection_handlers_t *handlers;
+	/* Registered epoll events */
+	uint32_t events;
+	/* Events handled since the last rebalance */
+	uint64_t load;
+	struct connection_rate_limit_t rate_limit;
+	struct rate_bucket_t bucket;
+	/* Reading resumes at this time when throttled */
+	uint64_t resume_at;
+	uint8_t throttled;
+	struct connection_data_t *throttle_next;
+	/* Receive ring; a listener keeps only the size for accepted connections */
+	struct ring_buffer_t ring;
+	connection_priority_e priority;
+	/* CONNECTION_TIMESTAMP_* flags; a listener applies them on accept */
+	uint32_t timestamping;
+	/* Out of reads for the wakeup; continued in the next one */
+	uint8_t deferred;
+	uint64_t defer_round;
+	struct connection_data_t *defer_next;
+	/* Raise connection_writable on the next EPOLLOUT */
+	uint8_t want_write;
+	/* Buffers of connection_send_buffers() left over by the socket */
+	struct send_queue_t send_queue;
+	struct connection_backlog_t backlog;
+	/* Latest TCP_INFO sample; in the sums of the network unless sampled_at = 0 */
+	struct connection_info_t info;
+	/* Sends of the iteration staged for one write; queued when flushed */
+	uint8_t auto_cork;
+	struct buffer_data_t *cork;
+	size_t cork_size;
+	/* Written at the end of the loop iteration, or dropped for its backlog */
+	uint8_t flush_pending;
+	uint8_t dropped;
+	struct connection_data_t *flush_next;
+	/* Worker of the requests in flight; results return in order */
+	struct offload_worker_t *worker;
+	uint32_t work_pending;
+	/* Freed by the application; freed for real once the work returns */
+	uint8_t orphaned;
+	/* Closed by the application; the socket stays open for the queued data */
+	uint8_t lingering;
+	/* Client pool: the host and service matched on acquire, and the idle
+	 * list while the pool holds the connection */
+	char *pool_key;
+	uint8_t pool_idle;
+	uint64_t idle_since;
+	struct connection_data_t *pool_prev;
+	struct connection_data_t *pool_next;
+	/* Listener: limits and the counter shared with accepted connections */
+	uint32_t max_connections;
+	uint32_t resume_connections;
+	uint8_t accept_paused;
+	struct accept_counter_t *counter;
+	/* Accepted connection: the network whose limit counts it (NULL = none) */
+	struct network_data_t *accounted;
+	/* UDP listener: a connected socket per peer, and those still open */
+	uint8_t udp_flows;
+	struct connection_data_t *flows;
+	/* Socket of one peer: its listener and the address of the peer */
+	struct connection_data_t *flow_listener;
+	struct connection_data_t *flow_prev;
+	struct connection_data_t *flow_next;
+	struct sockaddr_in6 flow_peer;
+	/* First payload left over from the SYN; sent once connected */
+	void *payload;
+	size_t payload_len;
+#ifdef TLS
+	/* Listener: the context of accepted connections */
+	SSL_CTX *tls_context;
+	SSL *tls;
+	uint8_t tls_handshake;
+#endif
+	struct network_data_t *network;
+	struct connection_data_t *prev;
+	struct connection_data_t *next;
+};
+
+struct ipc_message_t {
+	ipc_message_e type;
+	struct connection_data_t *connection;
+	/* Destination of the migration */
+	struct network_data_t *network;
+	size_t max_connections;
+	uint64_t load;
+	struct ipc_message_t *next;
 };
 
 struct network_data_t {
 	struct network_attr_t attr;
 	struct connection_data_t *ipc;
+	struct ipc_message_t *ipc_head;
+	struct ipc_message_t *ipc_tail;
+	struct connection_data_t *connections;
+	/* Connections waiting for tokens, and the timer that resumes them */
+	struct connection_data_t *throttled;
+	struct timer_data_t *throttle_timer;
+	/* Connections deferred per priority, oldest first, and the wakeup count */
+	struct connection_data_t *deferred_head[CONNECTION_PRIORITIES];
+	struct connection_data_t *deferred_tail[CONNECTION_PRIORITIES];
+	uint32_t num_deferred;
+	uint64_t round;
+	struct epoll_event *events;
+	uint32_t num_events;
+	uint32_t full_wakeups;
+	uint32_t sparse_wakeups;
 	int32_t loop_retval;
 	int32_t epoll_fd;
+	uint8_t stopped;
+	uint8_t draining;
+	/* Connections are closed at this time when draining (0 = not requested) */
+	uint64_t drain_deadline;
+	/* Spare descriptor released to shed connections when out of them */
+	int32_t reserve_fd;
+	uint32_t num_accepted;
+	uint32_t num_paused;
+	/* Events handled by the loop; sampled by the rebalancer */
+	uint64_t load;
+	uint64_t load_mark;
+	/* Connections with broadcasts to write or drops to report */
+	struct connection_data_t *flushed;
+	/* Callbacks of the batch are running; auto-corked sends are staged */
+	uint8_t batching;
+	/* Receive buffers, and the one kept for the next read */
+	struct buffer_pool_t *buffer_pool;
+	struct buffer_data_t *spare_buffer;
+	/* Idle client connections, least recently released first, and the
+	 * timer closing them */
+	struct connection_data_t *pool_head;
+	struct connection_data_t *pool_tail;
+	uint32_t num_pooled;
+	struct timer_data_t *pool_timer;
+	/* TCP_INFO sampler: the next connection of the rotation, its timer and
+	 * the sums over the latest samples */
+	struct connection_data_t *info_next;
+	struct timer_data_t *info_timer;
+	uint32_t info_count;
+	uint64_t info_rtt_us;
+	uint64_t info_unacked;
+	uint64_t info_lost;
+	uint64_t info_retrans;
+	/* Ancillary data of the message being received */
+	union {
+		size_t align;
+		uint8_t buf[CMSG_SPACE(sizeof(int32_t) * CONNECTION_MAX_FDS) +
+		            CMSG_SPACE(sizeof(struct scm_timestamping)) +
+		            CMSG_SPACE(sizeof(struct sock_extended_err) +
+		                       sizeof(struct sockaddr_in6))];
+	} control;
 #ifdef PTHREAD
 	pthread_t thread;
+	pthread_t loop_thread;
+	pthread_mutex_t lock;
+	/* Callback being run, published to the watchdog (entered 0 = none) */
+	uint64_t watch_entered;
+	uintptr_t watch_handle;
+	uint32_t watch_type;
+	uint32_t watch_depth;
+	pthread_t watchdog_thread;
+	pthread_cond_t watchdog_cond;
+	uint8_t watchdog_running;
+	/* Filled by the signal handler on the loop thread */
+	sem_t backtrace_done;
+	void *backtrace[WATCHDOG_BACKTRACE_MAX];
+	int32_t backtrace_len;
+	/* Worker threads, the next one to try, and whether they have woken the
+	 * loop for their results */
+	struct offload_worker_t *workers;
+	uint32_t num_workers;
+	uint32_t next_worker;
+	uint8_t offload_signaled;
 #endif
 };
 
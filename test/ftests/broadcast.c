@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#define MESSAGE_LEN 1024
+#define NUM_MESSAGES 1000
+#define NUM_SUBSCRIBERS 3
+
+struct subscriber_t {
+	const char *name;
+	connection_t connection;
+	uint32_t received;
+	int64_t last;
+	uint8_t ordered;
+	uint8_t done;
+};
+
+static network_t network;
+static connection_t drop_server;
+static connection_t conflate_server;
+static network_timer_t timer;
+static uint8_t buffer[1024];
+static uint8_t running;
+/* Server side: the accepted connections published to */
+static connection_t sessions[NUM_SUBSCRIBERS];
+static size_t num_sessions;
+static uint32_t published;
+/* Client side: a reader keeping up, one not reading at all, and one
+ * reading only once everything has been published */
+static struct subscriber_t fast = {"fast", 0, 0, -1, 1, 0};
+static struct subscriber_t slow = {"slow", 0, 0, -1, 1, 0};
+static struct subscriber_t lagging = {"lagging", 0, 0, -1, 1, 0};
+static const uint8_t *lagging_data;
+static size_t lagging_len;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+static void timer_callback(network_timer_t timer, const struct network_timer_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = timer_callback,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+	.buffer_pool = {
+		.num_buffers = 64,
+		.buffer_size = MESSAGE_LEN,
+	},
+};
+
+/* Subscribers more than 64 messages behind are dropped */
+static const struct connection_attr_t drop_server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12369",
+	.sockopts = {
+		.sndbuf = 4096,
+	},
+	.backlog = {
+		.max_bytes = 64 * MESSAGE_LEN,
+		.policy = connection_backlog_drop,
+	},
+};
+
+/* Subscribers behind get the latest messages only */
+static const struct connection_attr_t conflate_server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12370",
+	.sockopts = {
+		.sndbuf = 4096,
+	},
+	.backlog = {
+		.max_bytes = 8 * MESSAGE_LEN,
+		.policy = connection_backlog_conflate,
+	},
+};
+
+/* Whole messages stay in the ring until consumed */
+static struct connection_attr_t subscriber_attr(const char *service, size_t ring_size)
+{
+	struct connection_attr_t attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.network = &network;
+	attr.hints.ai_family = AF_INET6;
+	attr.hints.ai_socktype = SOCK_STREAM;
+	attr.hints.ai_protocol = IPPROTO_TCP;
+	attr.mode = connection_mode_client;
+	strcpy(attr.hostname, "::1");
+	strcpy(attr.service, service);
+	attr.ring.size = ring_size;
+	attr.sockopts.rcvbuf = ring_size < 65536 ? 4096 : 0;
+	return attr;
+}
+
+static size_t subscriber_read(struct subscriber_t *subscriber, const uint8_t *data, size_t len)
+{
+	size_t offset;
+
+	for (offset = 0; offset + MESSAGE_LEN <= len; offset += MESSAGE_LEN) {
+		uint32_t seq;
+		memcpy(&seq, data + offset, sizeof(seq));
+
+		/* Conflated streams skip messages but never reorder them */
+		if ((int64_t)seq <= subscriber->last ||
+		    (subscriber == &fast && (int64_t)seq != subscriber->last + 1)) {
+			subscriber->ordered = 0;
+		}
+
+		subscriber->last = seq;
+		++subscriber->received;
+	}
+
+	if (subscriber->last == NUM_MESSAGES - 1 && !subscriber->done) {
+		subscriber->done = 1;
+		fprintf(stdout, "Subscriber %s: received=%s, last=%d, ordered=%s\n", subscriber->name,
+		        subscriber->received == NUM_MESSAGES ? "all" : "some",
+		        (int)subscriber->last, subscriber->ordered ? "yes" : "no");
+		running = !(fast.done && lagging.done);
+	}
+
+	return offset;
+}
+
+static void publish(void)
+{
+	uint8_t message[MESSAGE_LEN];
+	network_buffer_t message_buffer;
+
+	memcpy(message, &published, sizeof(published));
+	memset(message + sizeof(published), published % 251, sizeof(message) - sizeof(published));
+
+	/* One copy of the message, shared by every subscriber */
+	if (network_buffer_create(network, message, sizeof(message), &message_buffer) == -1) {
+		running = 0;
+		return;
+	}
+
+	connection_broadcast(sessions, num_sessions, message_buffer);
+	network_buffer_unref(message_buffer);
+	++published;
+}
+
+static void timer_callback(network_timer_t timer, const struct network_timer_event_t *event, user_data_t network_user_data)
+{
+	uint32_t i;
+	(void)event;
+	(void)network_user_data;
+
+	for (i = 0; i < 10 && published < NUM_MESSAGES; ++i) {
+		publish();
+	}
+
+	if (published < NUM_MESSAGES) {
+		return;
+	}
+
+	network_timer_cancel(timer);
+	fprintf(stdout, "Published: messages=%u\n", published);
+
+	/* The lagging subscriber starts reading */
+	connection_consume(lagging.connection, subscriber_read(&lagging, lagging_data, lagging_len));
+}
+
+static void session_remove(connection_t connection)
+{
+	size_t i;
+
+	for (i = 0; i < num_sessions; ++i) {
+		if (sessions[i] == connection) {
+			sessions[i] = sessions[--num_sessions];
+			break;
+		}
+	}
+}
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	const struct timespec interval = {0, 1000000};
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			sessions[num_sessions++] = event->new_connection;
+
+			if (num_sessions == NUM_SUBSCRIBERS && network_timer_start(timer, &interval) == -1) {
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_connection_created:
+			fprintf(stdout, "Connection created.\n");
+			break;
+
+		case connection_event_connection_dropped:
+			fprintf(stdout, "Subscriber dropped: published=%s\n",
+			        published < NUM_MESSAGES ? "some" : "all");
+			session_remove(connection);
+			connection_free(connection);
+			break;
+
+		case connection_event_data_received:
+			if (connection == fast.connection) {
+				connection_consume(connection, subscriber_read(&fast, event->data_buffer,
+				                                               event->data_len));
+			} else if (connection == lagging.connection) {
+				if (published < NUM_MESSAGES) {
+					lagging_data = event->data_buffer;
+					lagging_len = event->data_len;
+				} else {
+					connection_consume(connection, subscriber_read(&lagging, event->data_buffer,
+					                                               event->data_len));
+				}
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			session_remove(connection);
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	connection_t *connections[] = {
+		&fast.connection, &slow.connection, &lagging.connection,
+		&drop_server, &conflate_server
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(connections) / sizeof(connections[0]); ++i) {
+		if (*connections[i]) {
+			connection_close(*connections[i]);
+			connection_free(*connections[i]);
+		}
+	}
+
+	if (timer) {
+		network_timer_free(timer);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	const struct network_timer_attr_t timer_attr = {
+		.network = &network,
+		.type = network_timer_type_periodic,
+	};
+	struct connection_attr_t attr;
+	network = 0;
+	drop_server = 0;
+	conflate_server = 0;
+	timer = 0;
+	running = 1;
+
+	/* Create a network with a buffer pool in the thread mode */
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_timer_create(&timer, &timer_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&drop_server, &drop_server_attr) == -1 ||
+	    connection_create(&conflate_server, &conflate_server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	attr = subscriber_attr("12369", 65536);
+
+	if (connection_create(&fast.connection, &attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	attr = subscriber_attr("12369", 4096);
+
+	if (connection_create(&slow.connection, &attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	attr = subscriber_attr("12370", 4096);
+
+	if (connection_create(&lagging.connection, &attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		usleep(10000);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	terminate(fast.ordered && lagging.ordered ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
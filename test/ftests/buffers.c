@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+
+#define TOTAL_LEN (256 * 1024)
+#define MAX_BUFFERS 1024
+
+static network_t network;
+static connection_t server;
+static connection_t client;
+static uint8_t buffer[1024];
+static uint8_t running;
+/* Server: buffers kept until all the data has arrived */
+static network_buffer_t kept[MAX_BUFFERS];
+static size_t num_kept;
+static size_t kept_len;
+/* Client: bytes sent, echoed back, and whether they matched */
+static size_t sent_len;
+static size_t echo_len;
+static uint8_t echo_valid;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+/* Fewer pool buffers than kept; the rest come from the heap */
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+	.buffer_pool = {
+		.num_buffers = 16,
+		.buffer_size = 4096,
+	},
+};
+
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12368",
+	/* Small enough for the echo to be queued */
+	.sockopts = {
+		.sndbuf = 4096,
+	},
+};
+
+static const struct connection_attr_t client_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_client,
+	.hostname = "::1",
+	.service = "12368",
+	.sockopts = {
+		.rcvbuf = 4096,
+	},
+};
+
+static void client_send(connection_t connection)
+{
+	static uint8_t data[8192];
+
+	while (sent_len < TOTAL_LEN) {
+		size_t i, len = TOTAL_LEN - sent_len < sizeof(data) ? TOTAL_LEN - sent_len : sizeof(data);
+		ssize_t s;
+
+		for (i = 0; i < len; ++i) {
+			data[i] = (uint8_t)((sent_len + i) % 251);
+		}
+
+		s = connection_send(connection, data, len);
+
+		if (s == -1) {
+			/* Continued from the writable event */
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				connection_want_write(connection);
+			} else {
+				running = 0;
+			}
+
+			return;
+		}
+
+		sent_len += s;
+	}
+}
+
+static void server_data(connection_t connection, const struct connection_event_t *event)
+{
+	size_t i;
+
+	if (event->buffer == 0 || num_kept == MAX_BUFFERS) {
+		fprintf(stderr, "No buffer to keep.\n");
+		running = 0;
+		return;
+	}
+
+	/* Outlives the callback */
+	network_buffer_ref(event->buffer);
+	kept[num_kept++] = event->buffer;
+	kept_len += event->data_len;
+
+	if (kept_len < TOTAL_LEN) {
+		return;
+	}
+
+	fprintf(stdout, "Buffers kept: length=%u, many=%s\n", (unsigned)kept_len,
+	        num_kept > 16 ? "yes" : "no");
+
+	/* Echo the whole chain back without copying it */
+	if (connection_send_buffers(connection, kept, num_kept) == -1) {
+		running = 0;
+	}
+
+	for (i = 0; i < num_kept; ++i) {
+		network_buffer_unref(kept[i]);
+	}
+}
+
+static void client_data(const struct connection_event_t *event)
+{
+	size_t i;
+	const uint8_t *data = event->data_buffer;
+
+	for (i = 0; i < event->data_len; ++i) {
+		if (data[i] != (uint8_t)((echo_len + i) % 251)) {
+			echo_valid = 0;
+		}
+	}
+
+	echo_len += event->data_len;
+
+	if (echo_len >= TOTAL_LEN) {
+		fprintf(stdout, "Echo received: length=%u, valid=%s\n", (unsigned)echo_len,
+		        echo_valid ? "yes" : "no");
+		running = 0;
+	}
+}
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+			break;
+
+		case connection_event_connection_created:
+			fprintf(stdout, "Connection created.\n");
+			client_send(connection);
+			break;
+
+		case connection_event_connection_writable:
+			client_send(connection);
+			break;
+
+		case connection_event_data_received:
+			if (connection == client) {
+				client_data(event);
+			} else {
+				server_data(connection, event);
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			fprintf(stdout, "Connection closed.\n");
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	if (client) {
+		connection_close(client);
+		connection_free(client);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	network = 0;
+	server = 0;
+	client = 0;
+	running = 1;
+	echo_valid = 1;
+
+	/* Create a network with a buffer pool in the thread mode */
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&client, &client_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		usleep(10000);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	terminate(echo_len == TOTAL_LEN && echo_valid ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
@@ -0,0 +1,30 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_04")
+        self.unix = None
+
+    def ramp_up(self):
+        # Create a local socket test application instance
+        self.unix = TestProcess("./unix", self.get_logger("unix"))
+
+    def case(self):
+        # Start the test program
+        self.unix.start()
+
+        # Wait the test program to finish
+        self.unix.stop(stop_signal=None)
+
+        # Verify that the sequenced packet was received with one descriptor
+        self.unix.verify_traces(["New connection\.", "Connection created\."])
+        self.unix.verify_traces(["Data received: length=12, data=Hello world!, fds=1"], min_count=1, max_count=1)
+
+        # Verify that the passed descriptor was usable by the receiver
+        self.unix.verify_traces(["Pipe received: Hello pipe!", "Exit: Success"])
+
+    def ramp_down(self):
+        pass
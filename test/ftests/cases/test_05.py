@@ -0,0 +1,32 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_05")
+        self.migrate = None
+
+    def ramp_up(self):
+        # Create a connection migration test application instance
+        self.migrate = TestProcess("./migrate", self.get_logger("migrate"))
+
+    def case(self):
+        # Start the test program
+        self.migrate.start()
+
+        # Wait the test program to finish
+        self.migrate.stop(stop_signal=None)
+
+        # Verify that the connection was accepted on the first network and moved to the second
+        self.migrate.verify_traces(["New connection: network=1", "Connection migrated: network=2"])
+
+        # Verify that the client received the data sent after the migration
+        self.migrate.verify_traces(["Data received: network=2, user_data=2, length=12"], min_count=1, max_count=1)
+
+        # Verify successful termination of the program
+        self.migrate.verify_traces(["Exit: Success"])
+
+    def ramp_down(self):
+        pass
@@ -0,0 +1,31 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_06")
+        self.drain = None
+
+    def ramp_up(self):
+        # Create a graceful drain test application instance
+        self.drain = TestProcess("./drain", self.get_logger("drain"))
+
+    def case(self):
+        # Start the test program
+        self.drain.start()
+
+        # Wait the test program to finish
+        self.drain.stop(stop_signal=None)
+
+        # Verify that accepting stopped, that the response pending on the
+        # connection closed while draining was written in full and that the
+        # connection left open was closed at the deadline
+        self.drain.verify_traces(["Accepted while draining: 0",
+                                  "Response complete: yes",
+                                  "Closed at the deadline: 1",
+                                  "Exit: Success"])
+
+    def ramp_down(self):
+        pass
@@ -0,0 +1,38 @@
+from ftest import TestCase
+from ftest import TestProcess
+import os
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_07")
+        self.tls = None
+
+    def ramp_up(self):
+        # Built only with TLS=1
+        if os.path.exists("./tls"):
+            self.tls = TestProcess("./tls", self.get_logger("tls"))
+
+    def case(self):
+        if self.tls is None:
+            self.logger.writeline("TLS support not built; skipped.")
+            return
+
+        # Start the test program
+        self.tls.start()
+
+        # Wait the test program to finish
+        self.tls.stop(stop_signal=None)
+
+        # Verify that both ends completed the handshake
+        self.tls.verify_traces(["New connection\.", "Handshake completed\."])
+        self.tls.verify_traces(["Handshake completed\."], min_count=2, max_count=2)
+
+        # Verify the request and the file sent back over the session
+        self.tls.verify_traces(["Data received: length=12, data=Hello world!",
+                                "Data received: length=11, data=Hello file!",
+                                "Exit: Success"])
+
+    def ramp_down(self):
+        pass
@@ -0,0 +1,28 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_08")
+        self.payload = None
+
+    def ramp_up(self):
+        # Create a first payload test application instance
+        self.payload = TestProcess("./payload", self.get_logger("payload"))
+
+    def case(self):
+        # Start the test program
+        self.payload.start()
+
+        # Wait the test program to finish
+        self.payload.stop(stop_signal=None)
+
+        # Verify that a first payload larger than the socket takes at once
+        # arrived in full and in order
+        self.payload.verify_traces(["Payload received: yes",
+                                    "Exit: Success"])
+
+    def ramp_down(self):
+        pass
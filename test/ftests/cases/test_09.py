@@ -0,0 +1,33 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_09")
+        self.coro = None
+
+    def ramp_up(self):
+        # Create a coroutine echo test application instance
+        self.coro = TestProcess("./coro", self.get_logger("coro"))
+
+    def case(self):
+        # Start the test program
+        self.coro.start()
+
+        # Wait the test program to finish
+        self.coro.stop(stop_signal=None)
+
+        # Verify that the coroutines were resumed on accept and connect
+        self.coro.verify_traces(["New connection\.", "Connection created\."])
+
+        # Verify that each echo was read back and each sleep completed
+        self.coro.verify_traces(["Data received: length=12, data=Hello world!"], min_count=3, max_count=3)
+        self.coro.verify_traces(["Timer expired\."], min_count=3, max_count=3)
+
+        # Verify successful termination of the program
+        self.coro.verify_traces(["Exit: Success"])
+
+    def ramp_down(self):
+        pass
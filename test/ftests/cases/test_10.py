@@ -0,0 +1,33 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_10")
+        self.handlers = None
+
+    def ramp_up(self):
+        # Create a per-connection handler test application instance
+        self.handlers = TestProcess("./handlers", self.get_logger("handlers"))
+
+    def case(self):
+        # Start the test program
+        self.handlers.start()
+
+        # Wait the test program to finish
+        self.handlers.stop(stop_signal=None)
+
+        # Verify that the listener and the client got their own handlers
+        self.handlers.verify_traces(["New connection: handler=server", "Connection created: handler=client"])
+
+        # Verify that the accepted connection switched to the session handlers
+        self.handlers.verify_traces(["Data received: handler=session, length=12",
+                                     "Data received: handler=client, length=12"])
+
+        # Verify successful termination of the program
+        self.handlers.verify_traces(["Exit: Success"])
+
+    def ramp_down(self):
+        pass
@@ -0,0 +1,35 @@
+from ftest import TestCase
+from ftest import TestProcess
+import os
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_11")
+        self.ring = None
+
+    def ramp_up(self):
+        # Create a receive ring test application instance
+        self.ring = TestProcess("./ring", self.get_logger("ring"))
+
+    def case(self):
+        # Start the test program
+        self.ring.start()
+
+        # Wait the test program to finish
+        self.ring.stop(stop_signal=None)
+
+        # Verify that the frames wrapping around the ring were parsed in place
+        self.ring.verify_traces(["New connection\.", "Connection created\."])
+        self.ring.verify_traces(["Frames received: count=1000, errors=0", "Exit: Success"])
+
+        # Verify that the client ring took huge pages whenever one was free
+        path = "/sys/kernel/mm/hugepages/hugepages-2048kB/free_hugepages"
+        free = int(open(path).read()) if os.path.exists(path) else 0
+        self.ring.verify_traces(["Huge page receive ring failed"],
+                                min_count=0 if free > 0 else 1,
+                                max_count=0 if free > 0 else 1)
+
+    def ramp_down(self):
+        pass
@@ -0,0 +1,27 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_12")
+        self.priority = None
+
+    def ramp_up(self):
+        # Create a priority class test application instance
+        self.priority = TestProcess("./priority", self.get_logger("priority"))
+
+    def case(self):
+        # Start the test program
+        self.priority.start()
+
+        # Wait the test program to finish
+        self.priority.stop(stop_signal=None)
+
+        # Verify that the high-priority connection was served first and
+        # the low-priority one was deferred to one read per wakeup
+        self.priority.verify_traces(["Served: HHHHLLLL", "Exit: Success"])
+
+    def ramp_down(self):
+        pass
@@ -0,0 +1,31 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_13")
+        self.timestamps = None
+
+    def ramp_up(self):
+        # Create a timestamping test application instance
+        self.timestamps = TestProcess("./timestamps", self.get_logger("timestamps"))
+
+    def case(self):
+        # Start the test program
+        self.timestamps.start()
+
+        # Wait the test program to finish
+        self.timestamps.stop(stop_signal=None)
+
+        # Verify that the receive side got a kernel timestamp and the
+        # send side got every transmit stage from the error queue
+        self.timestamps.verify_traces(["Data received: length=12, timestamp=yes",
+                                       "TX timestamp: type=sched, key=11, timestamp=yes",
+                                       "TX timestamp: type=send, key=11, timestamp=yes",
+                                       "TX timestamp: type=ack, key=11, timestamp=yes",
+                                       "Exit: Success"])
+
+    def ramp_down(self):
+        pass
@@ -0,0 +1,30 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_14")
+        self.watchdog = None
+
+    def ramp_up(self):
+        # Create a watchdog test application instance
+        self.watchdog = TestProcess("./watchdog", self.get_logger("watchdog"))
+
+    def case(self):
+        # Start the test program
+        self.watchdog.start()
+
+        # Wait the test program to finish
+        self.watchdog.stop(stop_signal=None)
+
+        # Verify that both stalls were reported once with a backtrace and
+        # that the fast callbacks were not
+        self.watchdog.verify_traces(["Slow callback: source=connection, event_type=1, backtrace=yes",
+                                     "Slow callback: source=timer, event_type=0, backtrace=yes"],
+                                    max_count=1)
+        self.watchdog.verify_traces(["Reports: 2", "Exit: Success"])
+
+    def ramp_down(self):
+        pass
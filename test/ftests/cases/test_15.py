@@ -0,0 +1,29 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_15")
+        self.buffers = None
+
+    def ramp_up(self):
+        # Create a buffer pool test application instance
+        self.buffers = TestProcess("./buffers", self.get_logger("buffers"))
+
+    def case(self):
+        # Start the test program
+        self.buffers.start()
+
+        # Wait the test program to finish
+        self.buffers.stop(stop_signal=None)
+
+        # Verify that the server kept more buffers than the pool has and
+        # that the chain sent back without a copy arrived intact
+        self.buffers.verify_traces(["Buffers kept: length=262144, many=yes",
+                                    "Echo received: length=262144, valid=yes",
+                                    "Exit: Success"])
+
+    def ramp_down(self):
+        pass
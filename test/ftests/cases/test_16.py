@@ -0,0 +1,32 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_16")
+        self.broadcast = None
+
+    def ramp_up(self):
+        # Create a broadcast test application instance
+        self.broadcast = TestProcess("./broadcast", self.get_logger("broadcast"))
+
+    def case(self):
+        # Start the test program
+        self.broadcast.start()
+
+        # Wait the test program to finish
+        self.broadcast.stop(stop_signal=None)
+
+        # Verify that the subscriber not reading was dropped while publishing,
+        # the one keeping up got every message, and the lagging one got the
+        # latest messages only, in order
+        self.broadcast.verify_traces(["Subscriber dropped: published=some"], max_count=1)
+        self.broadcast.verify_traces(["Published: messages=1000",
+                                      "Subscriber fast: received=all, last=999, ordered=yes",
+                                      "Subscriber lagging: received=some, last=999, ordered=yes",
+                                      "Exit: Success"])
+
+    def ramp_down(self):
+        pass
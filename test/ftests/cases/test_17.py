@@ -0,0 +1,33 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_17")
+        self.pool = None
+
+    def ramp_up(self):
+        # Create a client pool test application instance
+        self.pool = TestProcess("./pool", self.get_logger("pool"))
+
+    def case(self):
+        # Start the test program
+        self.pool.start()
+
+        # Wait the test program to finish
+        self.pool.stop(stop_signal=None)
+
+        # Verify that a released connection is reused, and that closing by
+        # the peer and the idle timeout both lead to a new connection
+        self.pool.verify_traces(["Acquired: step=1, reused=0",
+                                 "Acquired: step=2, reused=1",
+                                 "Acquired: step=3, reused=1",
+                                 "Acquired: step=4, reused=0",
+                                 "Acquired: step=5, reused=0",
+                                 "Connections accepted: 3",
+                                 "Exit: Success"])
+
+    def ramp_down(self):
+        pass
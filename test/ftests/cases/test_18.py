@@ -0,0 +1,29 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_18")
+        self.offload = None
+
+    def ramp_up(self):
+        # Create a worker offload test application instance
+        self.offload = TestProcess("./offload", self.get_logger("offload"))
+
+    def case(self):
+        # Start the test program
+        self.offload.start()
+
+        # Wait the test program to finish
+        self.offload.stop(stop_signal=None)
+
+        # Verify that the results of several workers came back in the order
+        # of each connection and that none of the work ran on the loop
+        self.offload.verify_traces(["Results received: valid=yes",
+                                    "Work threads: many=yes, loop=no",
+                                    "Exit: Success"])
+
+    def ramp_down(self):
+        pass
@@ -0,0 +1,30 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_19")
+        self.flows = None
+
+    def ramp_up(self):
+        # Create a per-peer UDP socket test application instance
+        self.flows = TestProcess("./flows", self.get_logger("flows"))
+
+    def case(self):
+        # Start the test program
+        self.flows.start()
+
+        # Wait the test program to finish
+        self.flows.stop(stop_signal=None)
+
+        # Verify that each peer got a socket of its own and that the kernel
+        # delivered the rest to those sockets after the listener was closed
+        self.flows.verify_traces(["Flows accepted: 3",
+                                  "Listener datagrams: 0",
+                                  "Echoes received: 30",
+                                  "Exit: Success"])
+
+    def ramp_down(self):
+        pass
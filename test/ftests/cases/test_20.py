@@ -0,0 +1,29 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_20")
+        self.cork = None
+
+    def ramp_up(self):
+        # Create an auto-cork test application instance
+        self.cork = TestProcess("./cork", self.get_logger("cork"))
+
+    def case(self):
+        # Start the test program
+        self.cork.start()
+
+        # Wait the test program to finish
+        self.cork.stop(stop_signal=None)
+
+        # Verify that the sends of each response were written at once and in
+        # the order sent, leaving the server in one segment
+        self.cork.verify_traces(["Responses received: 100",
+                                 "Segments per response: 1",
+                                 "Exit: Success"])
+
+    def ramp_down(self):
+        pass
@@ -0,0 +1,29 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_21")
+        self.tcpinfo = None
+
+    def ramp_up(self):
+        # Create a TCP_INFO sampler test application instance
+        self.tcpinfo = TestProcess("./tcpinfo", self.get_logger("tcpinfo"))
+
+    def case(self):
+        # Start the test program
+        self.tcpinfo.start()
+
+        # Wait the test program to finish
+        self.tcpinfo.stop(stop_signal=None)
+
+        # Verify that the sampler rotated through every connection within
+        # its budget and that the sums carry the round-trip times
+        self.tcpinfo.verify_traces(["Connections sampled: 8",
+                                    "RTT measured: yes",
+                                    "Exit: Success"])
+
+    def ramp_down(self):
+        pass
@@ -0,0 +1,30 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_22")
+        self.rebalance = None
+
+    def ramp_up(self):
+        # Create a load rebalancing test application instance
+        self.rebalance = TestProcess("./rebalance", self.get_logger("rebalance"))
+
+    def case(self):
+        # Start the test program
+        self.rebalance.start()
+
+        # Wait the test program to finish
+        self.rebalance.stop(stop_signal=None)
+
+        # Verify that the rebalancer moved one connection from the busy loop
+        # to the idle one and that the echoes continued across the loops
+        self.rebalance.verify_traces(["Connections migrated: 1",
+                                      "Migrated to: network=2",
+                                      "Echoes after the move: yes",
+                                      "Exit: Success"])
+
+    def ramp_down(self):
+        pass
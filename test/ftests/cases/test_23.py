@@ -0,0 +1,29 @@
+from ftest import TestCase
+from ftest import TestProcess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_23")
+        self.ratelimit = None
+
+    def ramp_up(self):
+        # Create a rate limiting test application instance
+        self.ratelimit = TestProcess("./ratelimit", self.get_logger("ratelimit"))
+
+    def case(self):
+        # Start the test program
+        self.ratelimit.start()
+
+        # Wait the test program to finish
+        self.ratelimit.stop(stop_signal=None)
+
+        # Verify that data sent beyond the burst arrived in full, read at
+        # the configured rate once the bucket was empty
+        self.ratelimit.verify_traces(["Bytes received: 262144",
+                                      "Throttled to the rate: yes",
+                                      "Exit: Success"])
+
+    def ramp_down(self):
+        pass
@@ -0,0 +1,38 @@
+from ftest import TestCase
+from ftest import TestError
+import os
+import re
+import subprocess
+
+
+class TestCaseImpl(TestCase):
+
+    def __init__(self):
+        TestCase.__init__(self, "test_24")
+        self.notes = None
+
+    def ramp_up(self):
+        # Probes are built in whenever the compiler finds <sys/sdt.h>
+        with open(os.devnull, "w") as null:
+            found = subprocess.call(["gcc", "-E", "-include", "sys/sdt.h", "-x", "c", os.devnull],
+                                    stdout=null, stderr=null) == 0
+
+        if found:
+            self.notes = subprocess.check_output(["readelf", "-n", "../../libebnlib.a"])
+            self.notes = self.notes.decode()
+
+    def case(self):
+        if self.notes is None:
+            self.logger.writeline("<sys/sdt.h> not available; skipped.")
+            return
+
+        # Verify that each probe left its stapsdt note in the library
+        for probe in ["wakeup", "accept", "recv", "send", "close", "timer",
+                      "callback_entry", "callback_return"]:
+            if not re.search(r"Provider: ebnlib\s+Name: %s$" % probe, self.notes, re.M):
+                raise TestError("Probe %s not found in libebnlib.a." % probe)
+
+            self.logger.writeline("Probe %s found." % probe)
+
+    def ramp_down(self):
+        pass
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+
+#define NUM_REQUESTS 100
+#define BODY_LEN 1000
+#define RESPONSE_LEN (4 + BODY_LEN + 4)
+
+static network_t network;
+static connection_t server;
+static uint8_t body[BODY_LEN];
+static uint8_t buffer[4096];
+static int32_t client_fd = -1;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+};
+
+/* The sends of a response are written at once */
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12374",
+	.sockopts = {
+		.nodelay = 1,
+	},
+	.auto_cork = 1,
+};
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	size_t i;
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+			break;
+
+		case connection_event_data_received:
+			/* Header, body and trailer as separate sends */
+			for (i = 0; i < event->data_len; ++i) {
+				connection_send(connection, "HDR:", 4);
+				connection_send(connection, body, sizeof(body));
+				connection_send(connection, "END\n", 4);
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			break;
+
+		default:
+			break;
+	};
+}
+
+/* A plain blocking client; the segments it receives are counted */
+static int32_t client_request(void)
+{
+	uint8_t response[RESPONSE_LEN];
+	size_t len = 0;
+
+	if (send(client_fd, "?", 1, 0) != 1) {
+		return -1;
+	}
+
+	while (len < sizeof(response)) {
+		ssize_t s = recv(client_fd, response + len, sizeof(response) - len, 0);
+
+		if (s <= 0) {
+			return -1;
+		}
+
+		len += s;
+	}
+
+	if (memcmp(response, "HDR:", 4) != 0 ||
+	    memcmp(response + 4, body, sizeof(body)) != 0 ||
+	    memcmp(response + 4 + sizeof(body), "END\n", 4) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint32_t client_segments(void)
+{
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+	memset(&info, 0, sizeof(info));
+
+	if (getsockopt(client_fd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1) {
+		return 0;
+	}
+
+	return info.tcpi_segs_in;
+}
+
+static void terminate(int retval)
+{
+	if (client_fd != -1) {
+		close(client_fd);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	struct sockaddr_in6 addr;
+	uint32_t i, segments, num_responses = 0;
+	int32_t nodelay = 1;
+	network = 0;
+	server = 0;
+
+	for (i = 0; i < sizeof(body); ++i) {
+		body[i] = (uint8_t)(i % 251);
+	}
+
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port = htons(12374);
+	addr.sin6_addr = in6addr_loopback;
+	client_fd = socket(AF_INET6, SOCK_STREAM, 0);
+
+	if (client_fd == -1 ||
+	    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) == -1 ||
+	    connect(client_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	segments = client_segments();
+
+	while (num_responses < NUM_REQUESTS && client_request() == 0) {
+		++num_responses;
+	}
+
+	segments = client_segments() - segments;
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Three sends per response; written at once they leave in one segment */
+	fprintf(stdout, "Responses received: %u\n", num_responses);
+	fprintf(stdout, "Segments per response: %s\n", segments < 2 * NUM_REQUESTS ? "1" : "more");
+	terminate(num_responses == NUM_REQUESTS &&
+	          segments < 2 * NUM_REQUESTS ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
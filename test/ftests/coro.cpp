@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib_coro.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+static uint8_t buffer[1024];
+static volatile bool running;
+static int32_t retval;
+
+static ebnlib::co::task serve(std::unique_ptr<ebnlib::co::stream> client)
+{
+	char data[64];
+	ssize_t len;
+
+	/* Echo until the client closes the connection */
+	while ((len = co_await client->read_some(data, sizeof(data))) > 0) {
+		if (co_await client->write_all(data, len) != len) {
+			break;
+		}
+	}
+
+	std::fprintf(stdout, "Server stream ended.\n");
+}
+
+static ebnlib::co::task listen(ebnlib::co::listener &server)
+{
+	while (std::unique_ptr<ebnlib::co::stream> client = co_await ebnlib::co::accept(server)) {
+		std::fprintf(stdout, "New connection.\n");
+		serve(std::move(client));
+	}
+}
+
+static ebnlib::co::task talk(ebnlib::co::stream &client, ebnlib::co::timer &timer)
+{
+	char data[64];
+	size_t received = 0;
+	int32_t i;
+
+	if (!co_await client.connect()) {
+		running = false;
+		co_return;
+	}
+
+	std::fprintf(stdout, "Connection created.\n");
+
+	for (i = 0; i < 3; ++i) {
+		co_await client.write_all("Hello world!", 12);
+
+		/* The echo may arrive in pieces */
+		for (received = 0; received < 12;) {
+			ssize_t len = co_await client.read_some(data + received, 12 - received);
+
+			if (len <= 0) {
+				running = false;
+				co_return;
+			}
+
+			received += len;
+		}
+
+		std::fprintf(stdout, "Data received: length=%zu, data=%.*s\n", received, (int)received, data);
+		co_await timer.sleep(100ms);
+		std::fprintf(stdout, "Timer expired.\n");
+	}
+
+	retval = EXIT_SUCCESS;
+	running = false;
+}
+
+int main(void)
+{
+	struct network_attr_t network_attr;
+	struct connection_attr_t server_attr;
+	struct connection_attr_t client_attr;
+	std::memset(&network_attr, 0, sizeof(network_attr));
+	std::memset(&server_attr, 0, sizeof(server_attr));
+	network_attr.mode = network_mode_thread;
+	network_attr.data_buffer = buffer;
+	network_attr.buffer_len = sizeof(buffer);
+	server_attr.hints.ai_family = AF_INET6;
+	server_attr.hints.ai_socktype = SOCK_STREAM;
+	server_attr.hints.ai_flags = AI_PASSIVE;
+	server_attr.hints.ai_protocol = IPPROTO_TCP;
+	server_attr.mode = connection_mode_server;
+	std::strcpy(server_attr.hostname, "::1");
+	std::strcpy(server_attr.service, "12361");
+	client_attr = server_attr;
+	client_attr.hints.ai_flags = 0;
+	client_attr.mode = connection_mode_client;
+	retval = EXIT_FAILURE;
+	running = true;
+
+	try {
+		ebnlib::co::network network(network_attr);
+		ebnlib::co::listener server(network.get(), server_attr);
+		ebnlib::co::stream client(network.get(), client_attr);
+		ebnlib::co::timer timer(network.get());
+
+		/* Suspend on the first await; resumed from the event loop */
+		listen(server);
+		talk(client, timer);
+
+		if (network.start() == -1) {
+			return EXIT_FAILURE;
+		}
+
+		while (running) {
+			usleep(10000);
+		}
+
+		network.stop();
+	} catch (const std::system_error &error) {
+		std::fprintf(stderr, "Error: %s\n", error.what());
+	}
+
+	std::fprintf(stdout, "Exit: %s\n", retval == EXIT_SUCCESS ? "Success" : "Failure");
+	return retval;
+}
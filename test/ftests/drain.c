@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define RESPONSE_LEN (4 * 1024 * 1024)
+
+static network_t network;
+static connection_t server;
+static connection_t pending;
+static uint8_t buffer[1024];
+static uint8_t draining;
+static uint32_t num_accepted;
+static uint32_t num_late;
+static uint32_t num_closed;
+static int32_t close_retval = -1;
+static int32_t client_fds[3] = {-1, -1, -1};
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+};
+
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12376",
+};
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	network_buffer_t response;
+	uint8_t *data;
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+
+			if (__atomic_load_n(&draining, __ATOMIC_ACQUIRE)) {
+				++num_late;
+			}
+
+			/* The first client gets a response larger than the socket takes */
+			if (__atomic_add_fetch(&num_accepted, 1, __ATOMIC_RELEASE) > 1) {
+				break;
+			}
+
+			data = calloc(1, RESPONSE_LEN);
+
+			if (data != NULL && network_buffer_create(network, data, RESPONSE_LEN, &response) == 0) {
+				connection_send_buffers(event->new_connection, &response, 1);
+				network_buffer_unref(response);
+				pending = event->new_connection;
+			}
+
+			free(data);
+			break;
+
+		case connection_event_connection_draining:
+			/* The rest of the response is written before the socket closes */
+			if (connection == pending) {
+				close_retval = connection_close(connection);
+				connection_free(connection);
+				pending = 0;
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			++num_closed;
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void *drain_thread(void *arg)
+{
+	struct timespec timeout = {2, 0};
+	(void)arg;
+	return (void *)(intptr_t)network_drain(network, &timeout);
+}
+
+static int32_t client_connect(void)
+{
+	struct sockaddr_in6 addr;
+	int32_t fd;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port = htons(12376);
+	addr.sin6_addr = in6addr_loopback;
+	fd = socket(AF_INET6, SOCK_STREAM, 0);
+
+	if (fd != -1 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static size_t client_read(int32_t fd)
+{
+	uint8_t data[65536];
+	size_t len = 0;
+	ssize_t s;
+
+	/* Until the server closes the connection */
+	while ((s = recv(fd, data, sizeof(data), 0)) > 0) {
+		len += s;
+	}
+
+	return len;
+}
+
+static void terminate(int retval)
+{
+	uint32_t i;
+
+	for (i = 0; i < 3; ++i) {
+		if (client_fds[i] != -1) {
+			close(client_fds[i]);
+		}
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	pthread_t thread;
+	void *drain_retval;
+	size_t response_len, idle_len;
+	uint32_t i;
+	network = 0;
+	server = 0;
+
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* One client with a response pending and one idle */
+	for (i = 0; i < 2; ++i) {
+		if ((client_fds[i] = client_connect()) == -1) {
+			terminate(EXIT_FAILURE);
+		}
+	}
+
+	while (__atomic_load_n(&num_accepted, __ATOMIC_ACQUIRE) < 2) {
+		usleep(10000);
+	}
+
+	__atomic_store_n(&draining, 1, __ATOMIC_RELEASE);
+
+	if (pthread_create(&thread, NULL, drain_thread, NULL) != 0) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Accepting stops; the kernel still completes the handshake */
+	usleep(100000);
+	client_fds[2] = client_connect();
+	response_len = client_read(client_fds[0]);
+	/* Left open by the application; closed at the deadline */
+	idle_len = client_read(client_fds[1]);
+	pthread_join(thread, &drain_retval);
+
+	fprintf(stdout, "Accepted while draining: %u\n", num_late);
+	fprintf(stdout, "Response complete: %s\n", response_len == RESPONSE_LEN ? "yes" : "no");
+	fprintf(stdout, "Closed at the deadline: %u\n", num_closed);
+	terminate(drain_retval == 0 && close_retval == 0 && num_late == 0 &&
+	          response_len == RESPONSE_LEN && idle_len == 0 &&
+	          num_closed == 1 ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
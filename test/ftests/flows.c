@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#define NUM_CLIENTS 3
+#define NUM_MESSAGES 10
+
+struct client_t {
+	connection_t connection;
+	uint32_t num_echoes;
+};
+
+static network_t network;
+static connection_t server;
+static struct client_t clients[NUM_CLIENTS];
+static connection_t flows[NUM_CLIENTS];
+static uint8_t buffer[1024];
+static uint8_t running;
+static uint32_t num_flows;
+static uint32_t num_listener;
+static uint32_t num_echoes;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+};
+
+/* Each peer gets a socket of its own */
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_DGRAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_UDP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12373",
+	.udp_flows = 1,
+};
+
+static void client_data(struct client_t *client)
+{
+	++client->num_echoes;
+
+	if (++num_echoes == NUM_CLIENTS * NUM_MESSAGES) {
+		running = 0;
+	} else if (client->num_echoes < NUM_MESSAGES) {
+		connection_send(client->connection, "hello", 5);
+	}
+}
+
+static void server_data(connection_t connection, const struct connection_event_t *event)
+{
+	/* Only with no socket for the peer */
+	if (connection == server) {
+		++num_listener;
+		connection_sendto(connection, event->data_buffer, event->data_len,
+		                  event->addr, event->addr_len);
+		return;
+	}
+
+	connection_send(connection, event->data_buffer, event->data_len);
+}
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	struct client_t *client = event->user_data.ptr;
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New flow.\n");
+
+			if (num_flows < NUM_CLIENTS) {
+				flows[num_flows++] = event->new_connection;
+			}
+
+			/* The rest reach the sockets of the peers directly */
+			if (num_flows == NUM_CLIENTS) {
+				connection_close(connection);
+			}
+
+			break;
+
+		case connection_event_connection_created:
+			connection_send(connection, "hello", 5);
+			break;
+
+		case connection_event_data_received:
+			if (client != NULL) {
+				client_data(client);
+			} else {
+				server_data(connection, event);
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			if (connection == server) {
+				server = 0;
+			}
+
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	uint32_t i;
+
+	for (i = 0; i < NUM_CLIENTS; ++i) {
+		if (clients[i].connection) {
+			connection_close(clients[i].connection);
+			connection_free(clients[i].connection);
+		}
+
+		if (flows[i]) {
+			connection_close(flows[i]);
+			connection_free(flows[i]);
+		}
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	struct connection_attr_t client_attr = {
+		.network = &network,
+		.hints = {
+			.ai_family = AF_INET6,
+			.ai_socktype = SOCK_DGRAM,
+			.ai_protocol = IPPROTO_UDP,
+		},
+		.mode = connection_mode_client,
+		.hostname = "::1",
+		.service = "12373",
+	};
+	uint32_t i;
+	network = 0;
+	server = 0;
+	running = 1;
+
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < NUM_CLIENTS; ++i) {
+		client_attr.user_data.ptr = &clients[i];
+
+		if (connection_create(&clients[i].connection, &client_attr) == -1) {
+			terminate(EXIT_FAILURE);
+		}
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		usleep(10000);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	fprintf(stdout, "Flows accepted: %u\n", num_flows);
+	fprintf(stdout, "Listener datagrams: %u\n", num_listener);
+	fprintf(stdout, "Echoes received: %u\n", num_echoes);
+	terminate(num_flows == NUM_CLIENTS && num_listener == 0 &&
+	          num_echoes == NUM_CLIENTS * NUM_MESSAGES ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
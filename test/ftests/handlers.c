@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+static network_t network;
+static connection_t server;
+static connection_t client;
+static uint8_t buffer[1024];
+static uint8_t running;
+
+static void server_accept(connection_t connection, const struct connection_event_t *event, user_data_t context);
+static void session_data(connection_t connection, const struct connection_event_t *event, user_data_t context);
+static void client_created(connection_t connection, const struct connection_event_t *event, user_data_t context);
+static void client_data(connection_t connection, const struct connection_event_t *event, user_data_t context);
+static void connection_closed(connection_t connection, const struct connection_event_t *event, user_data_t context);
+static void connection_error(connection_t connection, const struct connection_event_t *event, user_data_t context);
+
+/* No network callback; every event has a handler */
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = NULL,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+};
+
+static const struct connection_handlers_t server_handlers = {
+	.on_accept = server_accept,
+	.on_error = connection_error,
+	.context = {
+		.ptr = "server",
+	},
+};
+
+/* Replaces the inherited table on accept */
+static const struct connection_handlers_t session_handlers = {
+	.on_data = session_data,
+	.on_close = connection_closed,
+	.on_error = connection_error,
+	.context = {
+		.ptr = "session",
+	},
+};
+
+static const struct connection_handlers_t client_handlers = {
+	.on_created = client_created,
+	.on_data = client_data,
+	.on_close = connection_closed,
+	.on_error = connection_error,
+	.context = {
+		.ptr = "client",
+	},
+};
+
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12362",
+	.handlers = &server_handlers,
+};
+
+static const struct connection_attr_t client_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_client,
+	.hostname = "::1",
+	.service = "12362",
+	.handlers = &client_handlers,
+};
+
+static void server_accept(connection_t connection, const struct connection_event_t *event, user_data_t context)
+{
+	(void)connection;
+	fprintf(stdout, "New connection: handler=%s\n", (char *)context.ptr);
+	connection_set_handlers(event->new_connection, &session_handlers);
+}
+
+static void session_data(connection_t connection, const struct connection_event_t *event, user_data_t context)
+{
+	fprintf(stdout, "Data received: handler=%s, length=%u\n",
+	        (char *)context.ptr, (unsigned)event->data_len);
+	/* Echo the data back to the client */
+	connection_send(connection, event->data_buffer, event->data_len);
+}
+
+static void client_created(connection_t connection, const struct connection_event_t *event, user_data_t context)
+{
+	(void)event;
+	fprintf(stdout, "Connection created: handler=%s\n", (char *)context.ptr);
+	connection_send(connection, "Hello world!", 12);
+}
+
+static void client_data(connection_t connection, const struct connection_event_t *event, user_data_t context)
+{
+	(void)connection;
+	fprintf(stdout, "Data received: handler=%s, length=%u\n",
+	        (char *)context.ptr, (unsigned)event->data_len);
+	running = 0;
+}
+
+static void connection_closed(connection_t connection, const struct connection_event_t *event, user_data_t context)
+{
+	(void)event;
+	fprintf(stdout, "Connection closed: handler=%s\n", (char *)context.ptr);
+	connection_free(connection);
+}
+
+static void connection_error(connection_t connection, const struct connection_event_t *event, user_data_t context)
+{
+	(void)connection;
+	(void)event;
+	fprintf(stderr, "Connection error: handler=%s\n", (char *)context.ptr);
+	running = 0;
+}
+
+static void terminate(int retval)
+{
+	if (client) {
+		connection_close(client);
+		connection_free(client);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	network = 0;
+	server = 0;
+	client = 0;
+	running = 1;
+
+	/* Create a network in the thread mode */
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Server and client with their own handlers on the same network */
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&client, &client_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		sleep(1);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	terminate(EXIT_SUCCESS);
+	return 0;
+}
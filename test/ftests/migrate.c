@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+static network_t network1;
+static network_t network2;
+static connection_t server;
+static connection_t client;
+static uint8_t buffer1[1024];
+static uint8_t buffer2[1024];
+static uint8_t running;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr1 = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer1,
+	.buffer_len = sizeof(buffer1),
+	.user_data = {
+		.u32 = 1,
+	},
+};
+
+static const struct network_attr_t network_attr2 = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer2,
+	.buffer_len = sizeof(buffer2),
+	.user_data = {
+		.u32 = 2,
+	},
+};
+
+static const struct connection_attr_t server_attr = {
+	.network = &network1,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12359",
+	.user_data = {
+		.u32 = 1,
+	},
+};
+
+static const struct connection_attr_t client_attr = {
+	.network = &network2,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_client,
+	.hostname = "::1",
+	.service = "12359",
+	.user_data = {
+		.u32 = 2,
+	},
+};
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection: network=%u\n", network_user_data.u32);
+
+			/* Move the accepted connection to the other loop */
+			if (connection_migrate(event->new_connection, network2) == -1) {
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_connection_migrated:
+			fprintf(stdout, "Connection migrated: network=%u\n", network_user_data.u32);
+			connection_send(connection, "Hello world!", 12);
+			break;
+
+		case connection_event_data_received:
+			fprintf(stdout, "Data received: network=%u, user_data=%u, length=%u\n",
+			        network_user_data.u32, event->user_data.u32, (unsigned)event->data_len);
+
+			if (event->user_data.u32 == 2) {
+				/* The client got the data sent by the migrated connection */
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			fprintf(stdout, "Connection closed.\n");
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		case connection_event_connection_created:
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	if (client) {
+		connection_close(client);
+		connection_free(client);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network1) {
+		network_free(network1);
+	}
+
+	if (network2) {
+		network_free(network2);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	network1 = 0;
+	network2 = 0;
+	server = 0;
+	client = 0;
+	running = 1;
+
+	/* Create two networks in the thread mode */
+	if (network_create(&network1, &network_attr1) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_create(&network2, &network_attr2) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Server on the first network, client on the second */
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&client, &client_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network1) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network2) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		sleep(1);
+	}
+
+	/* Stop the network event loops */
+	if (network_stop(network1) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_stop(network2) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	terminate(EXIT_SUCCESS);
+	return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define NUM_CLIENTS 8
+#define TOTAL_LEN (64 * 1024)
+
+struct client_t {
+	connection_t connection;
+	size_t sent_len;
+	size_t echo_len;
+	uint8_t echo_valid;
+};
+
+static network_t network;
+static connection_t server;
+static struct client_t clients[NUM_CLIENTS];
+static uint8_t buffer[1024];
+static uint8_t running;
+static uint32_t num_done;
+/* Threads the work ran on; the loop thread must not be one of them */
+static pthread_t loop_thread;
+static uint8_t loop_known;
+static pthread_t work_threads[NUM_CLIENTS];
+static uint32_t num_threads;
+static uint8_t work_on_loop;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+static void work_callback(network_t network, struct network_work_t *work, user_data_t network_user_data);
+
+/* Received data is handed off to the workers without a copy */
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+	.buffer_pool = {
+		.num_buffers = 256,
+		.buffer_size = 4096,
+	},
+	.offload = {
+		.num_workers = 4,
+		.queue_len = 1024,
+		.work_cb = work_callback,
+	},
+};
+
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12372",
+};
+
+static void client_send(struct client_t *client)
+{
+	static uint8_t data[1024];
+
+	while (client->sent_len < TOTAL_LEN) {
+		size_t i;
+		ssize_t s;
+
+		for (i = 0; i < sizeof(data); ++i) {
+			data[i] = (uint8_t)((client->sent_len + i) % 251);
+		}
+
+		s = connection_send(client->connection, data, sizeof(data));
+
+		if (s == -1) {
+			/* Continued from the writable event */
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				connection_want_write(client->connection);
+			} else {
+				running = 0;
+			}
+
+			return;
+		}
+
+		client->sent_len += s;
+	}
+}
+
+static void client_data(struct client_t *client, const struct connection_event_t *event)
+{
+	const uint8_t *data = event->data_buffer;
+	size_t i;
+
+	/* Each byte comes back incremented, in the order sent */
+	for (i = 0; i < event->data_len; ++i) {
+		if (data[i] != (uint8_t)((client->echo_len + i) % 251 + 1)) {
+			client->echo_valid = 0;
+		}
+	}
+
+	client->echo_len += event->data_len;
+
+	if (client->echo_len == TOTAL_LEN && ++num_done == NUM_CLIENTS) {
+		running = 0;
+	}
+}
+
+static void work_callback(network_t network, struct network_work_t *work, user_data_t network_user_data)
+{
+	const uint8_t *data = work->data;
+	uint8_t result[4096];
+	pthread_t self = pthread_self();
+	uint32_t i;
+	(void)network_user_data;
+
+	pthread_mutex_lock(&lock);
+
+	if (pthread_equal(self, loop_thread)) {
+		work_on_loop = 1;
+	}
+
+	for (i = 0; i < num_threads && !pthread_equal(self, work_threads[i]); ++i) {
+	}
+
+	if (i == num_threads && num_threads < NUM_CLIENTS) {
+		work_threads[num_threads++] = self;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	/* CPU-heavy work; other connections keep being served meanwhile */
+	for (i = 0; i < work->data_len; ++i) {
+		result[i] = data[i] + 1;
+	}
+
+	usleep(100);
+	network_buffer_create(network, result, work->data_len, &work->result);
+}
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	struct client_t *client = event->user_data.ptr;
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+			break;
+
+		case connection_event_connection_created:
+		case connection_event_connection_writable:
+			client_send(client);
+			break;
+
+		case connection_event_data_received:
+			if (client != NULL) {
+				client_data(client, event);
+				break;
+			}
+
+			/* Published to the workers by the first request */
+			if (!loop_known) {
+				loop_thread = pthread_self();
+				loop_known = 1;
+			}
+
+			if (connection_offload(connection, event->buffer) == -1) {
+				fprintf(stderr, "Offload failed.\n");
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_work_completed:
+			/* The result goes out after the earlier ones */
+			if (event->buffer == 0 || connection_send_buffers(connection, &event->buffer, 1) == -1) {
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	uint32_t i;
+
+	for (i = 0; i < NUM_CLIENTS; ++i) {
+		if (clients[i].connection) {
+			connection_close(clients[i].connection);
+			connection_free(clients[i].connection);
+		}
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	struct connection_attr_t client_attr = {
+		.network = &network,
+		.hints = {
+			.ai_family = AF_INET6,
+			.ai_socktype = SOCK_STREAM,
+			.ai_protocol = IPPROTO_TCP,
+		},
+		.mode = connection_mode_client,
+		.hostname = "::1",
+		.service = "12372",
+	};
+	uint8_t valid = 1;
+	uint32_t i;
+	network = 0;
+	server = 0;
+	running = 1;
+
+	/* Create a network with workers in the thread mode */
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < NUM_CLIENTS; ++i) {
+		clients[i].echo_valid = 1;
+		client_attr.user_data.ptr = &clients[i];
+
+		if (connection_create(&clients[i].connection, &client_attr) == -1) {
+			terminate(EXIT_FAILURE);
+		}
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		usleep(10000);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < NUM_CLIENTS; ++i) {
+		valid = valid && clients[i].echo_len == TOTAL_LEN && clients[i].echo_valid;
+	}
+
+	fprintf(stdout, "Results received: valid=%s\n", valid ? "yes" : "no");
+	fprintf(stdout, "Work threads: many=%s, loop=%s\n", num_threads > 1 ? "yes" : "no",
+	        work_on_loop ? "yes" : "no");
+	terminate(valid && num_threads > 1 && !work_on_loop ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
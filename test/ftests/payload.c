@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#define PAYLOAD_LEN (4 * 1024 * 1024)
+
+static network_t network;
+static connection_t server;
+static connection_t client;
+static uint8_t buffer[65536];
+static uint8_t running;
+static size_t num_received;
+static uint8_t corrupted;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+};
+
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12378",
+};
+
+/* The first payload is larger than the socket takes at once */
+static const struct connection_attr_t client_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_client,
+	.hostname = "::1",
+	.service = "12378",
+};
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	const uint8_t *data = event->data_buffer;
+	size_t i;
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+			break;
+
+		case connection_event_data_received:
+			for (i = 0; i < event->data_len; ++i) {
+				if (data[i] != (uint8_t)((num_received + i) % 251)) {
+					corrupted = 1;
+				}
+			}
+
+			num_received += event->data_len;
+
+			if (num_received >= PAYLOAD_LEN) {
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			if (connection == client) {
+				client = 0;
+			}
+
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	if (client) {
+		connection_close(client);
+		connection_free(client);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	uint8_t *payload;
+	size_t i;
+	network = 0;
+	server = 0;
+	client = 0;
+	running = 1;
+	payload = malloc(PAYLOAD_LEN);
+
+	if (payload == NULL) {
+		terminate(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < PAYLOAD_LEN; ++i) {
+		payload[i] = (uint8_t)(i % 251);
+	}
+
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create_send(&client, &client_attr, payload, PAYLOAD_LEN) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	free(payload);
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		usleep(10000);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	fprintf(stdout, "Payload received: %s\n",
+	        num_received == PAYLOAD_LEN && !corrupted ? "yes" : "no");
+	terminate(num_received == PAYLOAD_LEN && !corrupted ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
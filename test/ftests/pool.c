@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#define LAST_STEP 5
+
+static network_t network;
+static connection_t server;
+static network_timer_t timer;
+static uint8_t buffer[1024];
+static uint8_t running;
+/* Client: the connection of the current step */
+static connection_t client;
+static uint32_t step;
+static uint32_t num_accepted;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+static void timer_callback(network_timer_t timer, const struct network_timer_event_t *event, user_data_t network_user_data);
+
+/* Idle connections are closed after 200 milliseconds */
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = timer_callback,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+	.client_pool = {
+		.max_idle = 2,
+		.idle_timeout = {
+			.tv_sec = 0,
+			.tv_nsec = 200000000,
+		},
+	},
+};
+
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12371",
+};
+
+static const struct connection_attr_t client_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_client,
+	.hostname = "::1",
+	.service = "12371",
+};
+
+/* Step 3 asks the server to close after the reply */
+static void client_request(connection_t connection)
+{
+	if (step == 3) {
+		connection_send(connection, "bye", 3);
+	} else {
+		connection_send(connection, "ping", 4);
+	}
+}
+
+static void client_step(void)
+{
+	int32_t reused;
+	++step;
+	reused = connection_pool_acquire(&client, &client_attr);
+
+	if (reused == -1) {
+		running = 0;
+		return;
+	}
+
+	fprintf(stdout, "Acquired: step=%u, reused=%d\n", step, reused);
+
+	/* A new connection sends once created */
+	if (reused) {
+		client_request(client);
+	}
+}
+
+static void client_reply(void)
+{
+	/* The next step after the peer has closed or the pool timed out */
+	struct timespec next = {0, 10000000};
+	fprintf(stdout, "Reply received: step=%u\n", step);
+
+	if (connection_pool_release(client) == -1) {
+		running = 0;
+		return;
+	}
+
+	client = 0;
+
+	if (step == LAST_STEP) {
+		running = 0;
+		return;
+	}
+
+	if (step == 3) {
+		next.tv_nsec = 100000000;
+	} else if (step == 4) {
+		next.tv_nsec = 400000000;
+	}
+
+	network_timer_start(timer, &next);
+}
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+			++num_accepted;
+			break;
+
+		case connection_event_connection_created:
+			client_request(connection);
+			break;
+
+		case connection_event_data_received:
+			if (connection == client) {
+				client_reply();
+				break;
+			}
+
+			/* Echo the data back to the client */
+			connection_send(connection, event->data_buffer, event->data_len);
+
+			if (event->data_len == 3 && memcmp(event->data_buffer, "bye", 3) == 0) {
+				connection_close(connection);
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void timer_callback(network_timer_t timer, const struct network_timer_event_t *event, user_data_t network_user_data)
+{
+	(void)timer;
+	(void)event;
+	(void)network_user_data;
+	client_step();
+}
+
+static void terminate(int retval)
+{
+	if (timer) {
+		network_timer_free(timer);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	/* Closes the idle connections */
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	struct network_timer_attr_t timer_attr = {&network, network_timer_type_relative, {0}};
+	struct timespec first = {0, 10000000};
+	network = 0;
+	server = 0;
+	timer = 0;
+	running = 1;
+
+	/* Create a network with a client pool in the thread mode */
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_timer_create(&timer, &timer_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* The steps acquire from the loop */
+	if (network_timer_start(timer, &first) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		usleep(10000);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	fprintf(stdout, "Connections accepted: %u\n", num_accepted);
+	terminate(step == LAST_STEP && num_accepted == 3 ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
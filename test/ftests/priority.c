@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+static network_t network1;
+static network_t network2;
+static connection_t servers[2];
+static connection_t clients[2];
+static uint8_t buffer1[16];
+static uint8_t buffer2[1024];
+static char served[32];
+static size_t num_served;
+static uint8_t running;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+/* Small reads; a low-priority connection gets one per wakeup */
+static const struct network_attr_t network_attr1 = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer1,
+	.buffer_len = sizeof(buffer1),
+	.user_data = {
+		.u32 = 1,
+	},
+	.priority_reads = {
+		[connection_priority_low] = 1,
+	},
+};
+
+static const struct network_attr_t network_attr2 = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer2,
+	.buffer_len = sizeof(buffer2),
+	.user_data = {
+		.u32 = 2,
+	},
+};
+
+static const struct connection_attr_t server_attrs[2] = {
+	{
+		.network = &network1,
+		.hints = {
+			.ai_family = AF_INET6,
+			.ai_socktype = SOCK_STREAM,
+			.ai_flags = AI_PASSIVE,
+			.ai_protocol = IPPROTO_TCP,
+		},
+		.mode = connection_mode_server,
+		.hostname = "::1",
+		.service = "12364",
+		.user_data = {
+			.u32 = 'L',
+		},
+		.priority = connection_priority_low,
+	},
+	{
+		.network = &network1,
+		.hints = {
+			.ai_family = AF_INET6,
+			.ai_socktype = SOCK_STREAM,
+			.ai_flags = AI_PASSIVE,
+			.ai_protocol = IPPROTO_TCP,
+		},
+		.mode = connection_mode_server,
+		.hostname = "::1",
+		.service = "12365",
+		.user_data = {
+			.u32 = 'H',
+		},
+		.priority = connection_priority_high,
+	},
+};
+
+static const struct connection_attr_t client_attrs[2] = {
+	{
+		.network = &network2,
+		.hints = {
+			.ai_family = AF_INET6,
+			.ai_socktype = SOCK_STREAM,
+			.ai_protocol = IPPROTO_TCP,
+		},
+		.mode = connection_mode_client,
+		.hostname = "::1",
+		.service = "12364",
+	},
+	{
+		.network = &network2,
+		.hints = {
+			.ai_family = AF_INET6,
+			.ai_socktype = SOCK_STREAM,
+			.ai_protocol = IPPROTO_TCP,
+		},
+		.mode = connection_mode_client,
+		.hostname = "::1",
+		.service = "12365",
+	},
+};
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			/* Tag the accepted connection with the class of its listener */
+			connection_set_user_data(event->new_connection, event->user_data);
+			break;
+
+		case connection_event_connection_created:
+			/* Both clients send 64 bytes; the server reads 16 at a time */
+			if (connection_send(connection, "0123456789abcdef0123456789abcdef"
+			                    "0123456789abcdef0123456789abcdef", 64) != 64) {
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_data_received:
+			if (network_user_data.u32 == 1 && num_served < sizeof(served) - 1) {
+				served[num_served++] = (char)event->user_data.u32;
+
+				if (num_served == 8) {
+					running = 0;
+				}
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	size_t i;
+
+	for (i = 0; i < 2; ++i) {
+		if (clients[i]) {
+			connection_close(clients[i]);
+			connection_free(clients[i]);
+		}
+
+		if (servers[i]) {
+			connection_close(servers[i]);
+			connection_free(servers[i]);
+		}
+	}
+
+	if (network1) {
+		network_free(network1);
+	}
+
+	if (network2) {
+		network_free(network2);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	size_t i;
+	network1 = 0;
+	network2 = 0;
+	running = 1;
+
+	if (network_create(&network1, &network_attr1) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_create(&network2, &network_attr2) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Low- and high-priority listeners on the first network */
+	for (i = 0; i < 2; ++i) {
+		if (connection_create(&servers[i], &server_attrs[i]) == -1) {
+			terminate(EXIT_FAILURE);
+		}
+
+		if (connection_create(&clients[i], &client_attrs[i]) == -1) {
+			terminate(EXIT_FAILURE);
+		}
+	}
+
+	/* Let the data of both clients queue up before the server runs */
+	if (network_start(network2) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	usleep(200000);
+
+	if (network_start(network1) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		sleep(1);
+	}
+
+	if (network_stop(network1) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_stop(network2) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* All the high-priority reads come before the deferred low-priority ones */
+	fprintf(stdout, "Served: %s\n", served);
+	terminate(strcmp(served, "HHHHLLLL") == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#define RATE (64 * 1024)
+#define DATA_LEN (4 * RATE)
+
+static network_t network;
+static connection_t server;
+static uint8_t buffer[16384];
+static uint8_t data[DATA_LEN];
+static size_t num_received;
+static uint64_t completed_at;
+static int32_t client_fd = -1;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+};
+
+/* Inherited by the accepted connection; the burst is one second */
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12379",
+	.rate_limit = {
+		.bytes_per_sec = RATE,
+	},
+};
+
+static uint64_t time_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+			break;
+
+		case connection_event_data_received:
+			if (event->data_len > sizeof(buffer)) {
+				fprintf(stderr, "Read beyond the buffer.\n");
+			}
+
+			num_received += event->data_len;
+
+			if (num_received == DATA_LEN) {
+				__atomic_store_n(&completed_at, time_now(), __ATOMIC_RELEASE);
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			fprintf(stdout, "Connection closed.\n");
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	if (client_fd != -1) {
+		close(client_fd);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	struct sockaddr_in6 addr;
+	uint64_t started_at, elapsed = 0;
+	uint32_t i;
+	network = 0;
+	server = 0;
+
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port = htons(12379);
+	addr.sin6_addr = in6addr_loopback;
+	client_fd = socket(AF_INET6, SOCK_STREAM, 0);
+
+	if (client_fd == -1 || connect(client_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Idle for two seconds; the bucket holds one second of tokens at most */
+	sleep(2);
+	started_at = time_now();
+
+	if (send(client_fd, data, sizeof(data), 0) != sizeof(data)) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Reading is throttled after the burst and resumed by the timer */
+	for (i = 0; i < 1000 && __atomic_load_n(&completed_at, __ATOMIC_ACQUIRE) == 0; ++i) {
+		usleep(10000);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (completed_at != 0) {
+		elapsed = completed_at - started_at;
+	}
+
+	/* The rest after the burst takes three seconds at the rate */
+	fprintf(stdout, "Bytes received: %zu\n", num_received);
+	fprintf(stdout, "Throttled to the rate: %s\n",
+	        elapsed >= 2700 && elapsed < 6000 ? "yes" : "no");
+	terminate(num_received == DATA_LEN && elapsed >= 2700 && elapsed < 6000
+	          ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#define NUM_ECHOES 1000
+
+static network_t networks[2];
+static connection_t server;
+static connection_t client;
+static uint8_t buffer1[1024];
+static uint8_t buffer2[1024];
+static uint8_t running;
+static uint32_t num_echoes;
+static uint32_t num_migrated;
+static uint32_t migrated_to;
+static uint32_t echoes_after;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr1 = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer1,
+	.buffer_len = sizeof(buffer1),
+	.user_data = {
+		.u32 = 1,
+	},
+};
+
+static const struct network_attr_t network_attr2 = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer2,
+	.buffer_len = sizeof(buffer2),
+	.user_data = {
+		.u32 = 2,
+	},
+};
+
+/* Both ends start on the first network; the second one stays idle */
+static const struct connection_attr_t server_attr = {
+	.network = &networks[0],
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12377",
+	.user_data = {
+		.u32 = 1,
+	},
+};
+
+static const struct connection_attr_t client_attr = {
+	.network = &networks[0],
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_client,
+	.hostname = "::1",
+	.service = "12377",
+	.user_data = {
+		.u32 = 2,
+	},
+};
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection: network=%u\n", network_user_data.u32);
+			break;
+
+		case connection_event_connection_created:
+			connection_send(connection, "ping", 4);
+			break;
+
+		case connection_event_connection_migrated:
+			__atomic_store_n(&migrated_to, network_user_data.u32, __ATOMIC_RELEASE);
+			__atomic_add_fetch(&num_migrated, 1, __ATOMIC_RELEASE);
+			break;
+
+		case connection_event_data_received:
+			/* The client pings again; the accepted connection echoes */
+			if (event->user_data.u32 == 2) {
+				if (__atomic_load_n(&num_migrated, __ATOMIC_ACQUIRE) > 0) {
+					__atomic_add_fetch(&echoes_after, 1, __ATOMIC_RELEASE);
+				}
+
+				if (__atomic_add_fetch(&num_echoes, 1, __ATOMIC_RELEASE) >= NUM_ECHOES &&
+				    __atomic_load_n(&echoes_after, __ATOMIC_ACQUIRE) > 0) {
+					running = 0;
+					break;
+				}
+			}
+
+			connection_send(connection, event->data_buffer, event->data_len);
+			break;
+
+		case connection_event_connection_closed:
+			fprintf(stdout, "Connection closed.\n");
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	if (client) {
+		connection_close(client);
+		connection_free(client);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (networks[0]) {
+		network_free(networks[0]);
+	}
+
+	if (networks[1]) {
+		network_free(networks[1]);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	int32_t moved = 0;
+	networks[0] = 0;
+	networks[1] = 0;
+	server = 0;
+	client = 0;
+	running = 1;
+
+	if (network_create(&networks[0], &network_attr1) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_create(&networks[1], &network_attr2) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&client, &client_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(networks[0]) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(networks[1]) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Sample the loads until one connection moves to the idle loop */
+	while (running) {
+		usleep(50000);
+
+		if (!moved && (moved = network_rebalance(networks, 2, 1)) == -1) {
+			terminate(EXIT_FAILURE);
+		}
+	}
+
+	/* Stop the network event loops */
+	if (network_stop(networks[0]) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_stop(networks[1]) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	fprintf(stdout, "Connections migrated: %u\n", num_migrated);
+	fprintf(stdout, "Migrated to: network=%u\n", migrated_to);
+	fprintf(stdout, "Echoes after the move: %s\n", echoes_after > 0 ? "yes" : "no");
+	terminate(num_migrated == 1 && migrated_to == 2 && echoes_after > 0
+	          ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
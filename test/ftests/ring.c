@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#define FRAME_LEN 100
+#define NUM_FRAMES 1000
+
+static network_t network;
+static connection_t server;
+static connection_t client;
+static uint8_t buffer[1024];
+static uint8_t frames[FRAME_LEN * NUM_FRAMES];
+static uint32_t num_frames;
+static uint32_t num_errors;
+static uint8_t running;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+};
+
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12363",
+	/* One page; the frames do not divide it and wrap around */
+	.ring = {
+		.size = 4096,
+	},
+};
+
+static const struct connection_attr_t client_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_client,
+	.hostname = "::1",
+	.service = "12363",
+	.user_data = {
+		.u32 = 1,
+	},
+	/* Never receives; huge pages when some are free */
+	.ring = {
+		.size = 4096,
+		.hugepages = 1,
+	},
+};
+
+static void frames_create(void)
+{
+	uint32_t i, j;
+
+	/* Big-endian length followed by a pattern derived from the sequence */
+	for (i = 0; i < NUM_FRAMES; ++i) {
+		uint8_t *frame = frames + i * FRAME_LEN;
+		frame[0] = FRAME_LEN >> 8;
+		frame[1] = FRAME_LEN & 0xff;
+
+		for (j = 2; j < FRAME_LEN; ++j) {
+			frame[j] = (uint8_t)(i + j);
+		}
+	}
+}
+
+static size_t frames_parse(const uint8_t *data, size_t len)
+{
+	size_t offset = 0;
+	uint32_t j;
+
+	/* Only whole frames are consumed; the rest waits for more data */
+	while (len - offset >= 2) {
+		const uint8_t *frame = data + offset;
+		size_t frame_len = (size_t)frame[0] << 8 | frame[1];
+
+		if (frame_len != FRAME_LEN) {
+			++num_errors;
+			return len;
+		}
+
+		if (len - offset < frame_len) {
+			break;
+		}
+
+		for (j = 2; j < FRAME_LEN; ++j) {
+			if (frame[j] != (uint8_t)(num_frames + j)) {
+				++num_errors;
+				break;
+			}
+		}
+
+		++num_frames;
+		offset += frame_len;
+	}
+
+	return offset;
+}
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+			break;
+
+		case connection_event_connection_created:
+			fprintf(stdout, "Connection created.\n");
+
+			if (connection_send(connection, frames, sizeof(frames)) != sizeof(frames)) {
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_data_received:
+			if (event->user_data.u32 == 1) {
+				break;
+			}
+
+			/* Frames split by the wrap are still contiguous */
+			if (connection_consume(connection, frames_parse(event->data_buffer,
+			                                                event->data_len)) == -1) {
+				++num_errors;
+			}
+
+			if (num_frames == NUM_FRAMES || num_errors > 0) {
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			fprintf(stdout, "Connection closed.\n");
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	if (client) {
+		connection_close(client);
+		connection_free(client);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	network = 0;
+	server = 0;
+	client = 0;
+	running = 1;
+	frames_create();
+
+	/* Create a network in the thread mode */
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Accepted connections receive into their own rings */
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&client, &client_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		sleep(1);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	fprintf(stdout, "Frames received: count=%u, errors=%u\n", num_frames, num_errors);
+	terminate(num_frames == NUM_FRAMES && num_errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#define NUM_CLIENTS 4
+#define NUM_WAITS 300
+
+static network_t network;
+static connection_t server;
+static connection_t clients[NUM_CLIENTS];
+static uint8_t buffer[1024];
+static uint8_t running;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+/* Two connections sampled every 10 milliseconds */
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+	.tcp_info = {
+		.interval = {
+			.tv_sec = 0,
+			.tv_nsec = 10000000,
+		},
+		.budget = 2,
+	},
+};
+
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12375",
+};
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+			break;
+
+		case connection_event_connection_created:
+			connection_send(connection, "ping", 4);
+			break;
+
+		case connection_event_data_received:
+			/* Both ends keep the connection busy */
+			if (running) {
+				connection_send(connection, event->data_buffer, event->data_len);
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	uint32_t i;
+
+	for (i = 0; i < NUM_CLIENTS; ++i) {
+		if (clients[i]) {
+			connection_close(clients[i]);
+			connection_free(clients[i]);
+		}
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	struct connection_attr_t client_attr = {
+		.network = &network,
+		.hints = {
+			.ai_family = AF_INET6,
+			.ai_socktype = SOCK_STREAM,
+			.ai_protocol = IPPROTO_TCP,
+		},
+		.mode = connection_mode_client,
+		.hostname = "::1",
+		.service = "12375",
+	};
+	struct network_info_t info;
+	uint32_t i;
+	network = 0;
+	server = 0;
+	running = 1;
+
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < NUM_CLIENTS; ++i) {
+		if (connection_create(&clients[i], &client_attr) == -1) {
+			terminate(EXIT_FAILURE);
+		}
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* The sampler rotates through the clients and the accepted connections */
+	for (i = 0; i < NUM_WAITS && running; ++i) {
+		usleep(10000);
+
+		if (network_get_info(network, &info) == -1) {
+			terminate(EXIT_FAILURE);
+		}
+
+		if (info.num_sampled == 2 * NUM_CLIENTS) {
+			break;
+		}
+	}
+
+	running = 0;
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	fprintf(stdout, "Connections sampled: %u\n", info.num_sampled);
+	fprintf(stdout, "RTT measured: %s\n", info.rtt_avg_us > 0 ? "yes" : "no");
+	terminate(info.num_sampled == 2 * NUM_CLIENTS &&
+	          info.rtt_avg_us > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <linux/errqueue.h>
+
+static network_t network;
+static connection_t server;
+static connection_t client;
+static uint8_t buffer[1024];
+static uint8_t received;
+static uint8_t acked;
+static uint8_t running;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+};
+
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12366",
+	.timestamping = CONNECTION_TIMESTAMP_RX,
+};
+
+static const struct connection_attr_t client_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_client,
+	.hostname = "::1",
+	.service = "12366",
+	.timestamping = CONNECTION_TIMESTAMP_TX,
+};
+
+static const char *timestamp_type(uint32_t type)
+{
+	switch (type) {
+		case SCM_TSTAMP_SCHED:
+			return "sched";
+
+		case SCM_TSTAMP_SND:
+			return "send";
+
+		case SCM_TSTAMP_ACK:
+			return "ack";
+
+		default:
+			return "unknown";
+	}
+}
+
+static const char *timestamp_set(const struct timespec *timestamp)
+{
+	return timestamp->tv_sec != 0 || timestamp->tv_nsec != 0 ? "yes" : "no";
+}
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+			break;
+
+		case connection_event_connection_created:
+			fprintf(stdout, "Connection created.\n");
+
+			if (connection_send(connection, "Hello world!", 12) != 12) {
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_data_received:
+			fprintf(stdout, "Data received: length=%u, timestamp=%s\n",
+			        (unsigned)event->data_len, timestamp_set(&event->timestamp));
+			received = 1;
+			running = !(received && acked);
+			break;
+
+		case connection_event_tx_timestamp:
+			fprintf(stdout, "TX timestamp: type=%s, key=%u, timestamp=%s\n",
+			        timestamp_type(event->timestamp_type), event->timestamp_key,
+			        timestamp_set(&event->timestamp));
+
+			if (event->timestamp_type == SCM_TSTAMP_ACK) {
+				acked = 1;
+				running = !(received && acked);
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			fprintf(stdout, "Connection closed.\n");
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	if (client) {
+		connection_close(client);
+		connection_free(client);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	network = 0;
+	server = 0;
+	client = 0;
+	running = 1;
+
+	/* Create a network in the thread mode */
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* The server stamps arrivals, the client the stages of its send */
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* The kernel starts stamping arrivals a moment after it is asked */
+	usleep(100000);
+
+	if (connection_create(&client, &client_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		sleep(1);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	terminate(received && acked ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+static network_t network;
+static connection_t server;
+static connection_t client;
+static SSL_CTX *server_ctx;
+static SSL_CTX *client_ctx;
+static int32_t file_fd;
+static uint8_t buffer[1024];
+static uint8_t running;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+	.user_data = {
+		.ptr = NULL,
+	},
+};
+
+static struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12360",
+	.user_data = {
+		.u32 = 1,
+	},
+};
+
+static struct connection_attr_t client_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_client,
+	.hostname = "::1",
+	.service = "12360",
+	.user_data = {
+		.u32 = 2,
+	},
+};
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	off_t offset = 0;
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+			break;
+
+		case connection_event_connection_created:
+			fprintf(stdout, "Handshake completed.\n");
+
+			/* Kernel offload depends on the running kernel */
+			fprintf(stderr, "Offload: 0x%x\n", connection_tls_offload(connection));
+
+			if (connection == client &&
+			    connection_send(connection, "Hello world!", 12) == -1) {
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_data_received:
+			fprintf(stdout, "Data received: length=%u, data=%.*s\n",
+			        (unsigned)event->data_len, (int)event->data_len,
+			        (char *)event->data_buffer);
+
+			if (connection == client) {
+				running = 0;
+			} else if (connection_sendfile(connection, file_fd, &offset, 11) != 11) {
+				/* Reply with the contents of the file */
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			fprintf(stdout, "Connection closed.\n");
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static int32_t create_contexts(void)
+{
+	X509 *cert = X509_new();
+	EVP_PKEY *key = EVP_EC_gen("P-256");
+	X509_NAME *name;
+	int32_t retval = -1;
+
+	if (cert == NULL || key == NULL) {
+		goto END;
+	}
+
+	/* Self-signed certificate for the loopback address */
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+	X509_set_pubkey(cert, key);
+	name = X509_get_subject_name(cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"::1", -1, -1, 0);
+	X509_set_issuer_name(cert, name);
+
+	if (!X509_sign(cert, key, EVP_sha256())) {
+		goto END;
+	}
+
+	server_ctx = SSL_CTX_new(TLS_server_method());
+	client_ctx = SSL_CTX_new(TLS_client_method());
+
+	if (server_ctx == NULL || client_ctx == NULL ||
+	    SSL_CTX_use_certificate(server_ctx, cert) != 1 ||
+	    SSL_CTX_use_PrivateKey(server_ctx, key) != 1) {
+		goto END;
+	}
+
+	/* The client trusts the certificate of the server only */
+	SSL_CTX_set_verify(client_ctx, SSL_VERIFY_PEER, NULL);
+
+	if (X509_STORE_add_cert(SSL_CTX_get_cert_store(client_ctx), cert) != 1) {
+		goto END;
+	}
+
+	retval = 0;
+END:
+	X509_free(cert);
+	EVP_PKEY_free(key);
+	return retval;
+}
+
+static void terminate(int retval)
+{
+	if (client) {
+		connection_close(client);
+		connection_free(client);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	SSL_CTX_free(server_ctx);
+	SSL_CTX_free(client_ctx);
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	char path[] = "/tmp/ebnlib-tls-XXXXXX";
+	network = 0;
+	server = 0;
+	client = 0;
+	running = 1;
+
+	/* The server replies with the contents of a file */
+	file_fd = mkstemp(path);
+
+	if (file_fd == -1 || write(file_fd, "Hello file!", 11) != 11) {
+		perror("mkstemp()");
+		terminate(EXIT_FAILURE);
+	}
+
+	unlink(path);
+
+	if (create_contexts() == -1) {
+		fprintf(stderr, "Creating TLS contexts failed.\n");
+		terminate(EXIT_FAILURE);
+	}
+
+	server_attr.tls_context = server_ctx;
+	client_attr.tls_context = client_ctx;
+
+	/* Create a network in the thread mode */
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&client, &client_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		sleep(1);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	close(file_fd);
+	terminate(EXIT_SUCCESS);
+	return 0;
+}
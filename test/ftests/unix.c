@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+static network_t network;
+static connection_t server;
+static connection_t client;
+static int32_t pipe_fds[2];
+static uint8_t buffer[1024];
+static uint8_t running;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = NULL,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+	.user_data = {
+		.ptr = NULL,
+	},
+};
+
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_UNIX,
+		.ai_socktype = SOCK_SEQPACKET,
+	},
+	.mode = connection_mode_server,
+	/* Name in the abstract namespace */
+	.hostname = "@ebnlib-ftest",
+	.user_data = {
+		.u32 = 1,
+	},
+};
+
+static const struct connection_attr_t client_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_UNIX,
+		.ai_socktype = SOCK_SEQPACKET,
+	},
+	.mode = connection_mode_client,
+	.hostname = "@ebnlib-ftest",
+	.user_data = {
+		.u32 = 2,
+	},
+};
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	int32_t fds[CONNECTION_MAX_FDS];
+	size_t num_fds;
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+			break;
+
+		case connection_event_connection_created:
+			fprintf(stdout, "Connection created.\n");
+
+			/* Pass the write end of the pipe to the server */
+			if (connection_send_fds(connection, "Hello world!", 12, &pipe_fds[1], 1) == -1) {
+				close(pipe_fds[1]);
+				running = 0;
+			}
+
+			break;
+
+		case connection_event_data_received:
+			num_fds = connection_event_fds(event, fds, CONNECTION_MAX_FDS);
+			fprintf(stdout, "Data received: length=%u, data=%.*s, fds=%u\n",
+			        (unsigned)event->data_len, (int)event->data_len,
+			        (char *)event->data_buffer, (unsigned)num_fds);
+
+			if (num_fds == 1) {
+				/* Reply through the received descriptor */
+				if (write(fds[0], "Hello pipe!", 11) == -1) {
+					perror("write()");
+				}
+
+				close(fds[0]);
+			}
+
+			break;
+
+		case connection_event_connection_closed:
+			fprintf(stdout, "Connection closed.\n");
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			/* Unblock the main thread */
+			close(pipe_fds[1]);
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	if (client) {
+		connection_close(client);
+		connection_free(client);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	char data[32] = {0};
+	ssize_t len;
+	network = 0;
+	server = 0;
+	client = 0;
+	running = 1;
+
+	if (pipe(pipe_fds) == -1) {
+		perror("pipe()");
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Create a network in the thread mode */
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Create a sequenced-packet server and a client */
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&client, &client_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Run the network in a separate thread */
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	/* Wait for the server to answer through the pipe */
+	len = read(pipe_fds[0], data, sizeof(data) - 1);
+
+	if (running && len > 0) {
+		fprintf(stdout, "Pipe received: %s\n", data);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	terminate(running ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
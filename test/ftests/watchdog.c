@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+
+static network_t network;
+static connection_t server;
+static connection_t client;
+static network_timer_t timer;
+static uint8_t buffer[1024];
+static uint8_t running;
+static uint32_t num_reports;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+static void timer_callback(network_timer_t timer, const struct network_timer_event_t *event, user_data_t network_user_data);
+static void watchdog_callback(network_t network, const struct network_watchdog_event_t *event, user_data_t network_user_data);
+
+static const struct network_attr_t network_attr = {
+	.mode = network_mode_thread,
+	.connection_event_cb = event_callback,
+	.timer_event_cb = timer_callback,
+	.data_buffer = buffer,
+	.buffer_len = sizeof(buffer),
+	.watchdog = {
+		.threshold = {0, 50000000},
+		.backtrace_signal = SIGUSR1,
+		.watchdog_cb = watchdog_callback,
+	},
+};
+
+static const struct connection_attr_t server_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_server,
+	.hostname = "::1",
+	.service = "12367",
+};
+
+static const struct connection_attr_t client_attr = {
+	.network = &network,
+	.hints = {
+		.ai_family = AF_INET6,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	},
+	.mode = connection_mode_client,
+	.hostname = "::1",
+	.service = "12367",
+};
+
+/* Stands in for a blocking call; a sleep would be cut short by the signal */
+static void stall(long msec)
+{
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000 +
+	         (now.tv_nsec - start.tv_nsec) / 1000000 < msec);
+}
+
+static void watchdog_callback(network_t network, const struct network_watchdog_event_t *event, user_data_t network_user_data)
+{
+	(void)network;
+	(void)network_user_data;
+	fprintf(stdout, "Slow callback: source=%s, event_type=%u, backtrace=%s\n",
+	        event->handle == timer ? "timer" : "connection", event->event_type,
+	        event->backtrace_len > 0 ? "yes" : "no");
+	++num_reports;
+}
+
+static void timer_callback(network_timer_t timer, const struct network_timer_event_t *event, user_data_t network_user_data)
+{
+	(void)timer;
+	(void)event;
+	(void)network_user_data;
+	fprintf(stdout, "Timer expired.\n");
+	stall(200);
+	running = 0;
+}
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	const struct timespec value = {0, 10000000};
+	(void)network_user_data;
+
+	switch (event->event_type) {
+		case connection_event_connection_accepted:
+			fprintf(stdout, "New connection.\n");
+			break;
+
+		case connection_event_connection_created:
+			fprintf(stdout, "Connection created.\n");
+			connection_send(connection, "Hello world!", 12);
+			break;
+
+		case connection_event_data_received:
+			fprintf(stdout, "Data received: length=%u\n", (unsigned)event->data_len);
+
+			if (connection == client) {
+				network_timer_start(timer, &value);
+				break;
+			}
+
+			/* Stalls every connection of the network */
+			stall(200);
+			connection_send(connection, event->data_buffer, event->data_len);
+			break;
+
+		case connection_event_connection_closed:
+			fprintf(stdout, "Connection closed.\n");
+			connection_free(connection);
+			break;
+
+		case connection_event_connection_error:
+			fprintf(stderr, "Connection error.\n");
+			running = 0;
+			break;
+
+		default:
+			break;
+	};
+}
+
+static void terminate(int retval)
+{
+	if (timer) {
+		network_timer_free(timer);
+	}
+
+	if (client) {
+		connection_close(client);
+		connection_free(client);
+	}
+
+	if (server) {
+		connection_close(server);
+		connection_free(server);
+	}
+
+	if (network) {
+		network_free(network);
+	}
+
+	fprintf(stdout, "Exit: %s\n",
+	        retval == EXIT_SUCCESS
+	        ? "Success" : "Failure");
+	exit(retval);
+}
+
+int main(void)
+{
+	const struct network_timer_attr_t timer_attr = {
+		.network = &network,
+		.type = network_timer_type_relative,
+	};
+	network = 0;
+	server = 0;
+	client = 0;
+	timer = 0;
+	running = 1;
+
+	/* Create a network with a watchdog in the thread mode */
+	if (network_create(&network, &network_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_timer_create(&timer, &timer_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&server, &server_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (connection_create(&client, &client_attr) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	if (network_start(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	while (running) {
+		usleep(10000);
+	}
+
+	/* Stop the network event loop */
+	if (network_stop(network) == -1) {
+		terminate(EXIT_FAILURE);
+	}
+
+	fprintf(stdout, "Reports: %u\n", num_reports);
+	terminate(num_reports == 2 ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}
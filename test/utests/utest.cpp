@@ -5,6 +5,7 @@
 #include "CppUTest/TestRegistry.h"
 #include "CppUTest/TestHarness.h"
 #include "ebnlib.h"
+#include "ebnlib.hpp"
 #include "types.h"
 
 TEST_GROUP(NetworkTests)
@@ -58,6 +59,28 @@ TEST(NetworkTests, Test3)
 	close(ipc.socket_fd);
 }
 
+TEST(NetworkTests, Test4)
+{
+	int32_t retval;
+	network_data_t data;
+	memset(&data, 0, sizeof(data));
+	network_t network = (network_t)&data;
+	connection_data_t ipc;
+	memset(&ipc, 0, sizeof(ipc));
+	data.ipc = &ipc;
+	timespec timeout = {1, 0};
+	ipc.socket_fd = -1;
+	retval = network_drain(network, &timeout);
+	CHECK(retval == -1);
+	ipc.socket_fd = eventfd(0, 0);
+	retval = network_drain(network, NULL);
+	CHECK(retval == -1);
+	data.attr.mode = network_mode_mainloop;
+	retval = network_drain(network, &timeout);
+	CHECK(retval == 0);
+	close(ipc.socket_fd);
+}
+
 TEST_GROUP(ConnectionTests)
 {
 };
@@ -133,6 +156,521 @@ TEST(ConnectionTests, Test3)
 	CHECK(retval == -1);
 }
 
+TEST(ConnectionTests, Test4)
+{
+	int32_t retval;
+	connection_t connection;
+	connection_attr_t attr;
+	connection_data_t data;
+	connection_event_t event;
+	int32_t fds[CONNECTION_MAX_FDS + 1] = {0};
+	memset(&attr, 0, sizeof(connection_attr_t));
+	attr.mode = connection_mode_server;
+	attr.hints.ai_family = AF_UNIX;
+	attr.hints.ai_socktype = SOCK_SEQPACKET;
+	retval = connection_create(&connection, &attr);
+	CHECK(retval == -1);
+	memset(attr.hostname, 'a', sizeof(attr.hostname));
+	retval = connection_create(&connection, &attr);
+	CHECK(retval == -1);
+	memset(&data, 0, sizeof(data));
+	connection = (connection_t)&data;
+	data.socket_fd = -1;
+	retval = connection_send_fds(connection, "a", 1, fds, 1);
+	CHECK(retval == -1);
+	retval = connection_send_fds(connection, "a", 1, fds, CONNECTION_MAX_FDS + 1);
+	CHECK(retval == -1);
+	memset(&event, 0, sizeof(event));
+	CHECK(connection_event_fds(&event, fds, CONNECTION_MAX_FDS) == 0);
+	/* Each descriptor is handed out once; those that do not fit are closed */
+	int32_t pipe_fds[2];
+	uint8_t control[CMSG_SPACE(sizeof(pipe_fds))];
+	msghdr msg;
+	CHECK(pipe(pipe_fds) == 0);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(pipe_fds));
+	memcpy(CMSG_DATA(cmsg), pipe_fds, sizeof(pipe_fds));
+	event.msg = &msg;
+	CHECK(connection_event_fds(&event, fds, 1) == 1);
+	CHECK(fds[0] == pipe_fds[0]);
+	CHECK(fcntl(pipe_fds[1], F_GETFD) == -1);
+	CHECK(connection_event_fds(&event, NULL, 0) == 0);
+	CHECK(fcntl(pipe_fds[0], F_GETFD) != -1);
+	close(pipe_fds[0]);
+}
+
+TEST(ConnectionTests, Test5)
+{
+	int32_t retval;
+	connection_data_t data;
+	network_data_t network_data;
+	memset(&data, 0, sizeof(data));
+	memset(&network_data, 0, sizeof(network_data));
+	connection_t connection = (connection_t)&data;
+	network_t network = (network_t)&network_data;
+	retval = connection_migrate(connection, network);
+	CHECK(retval == -1);
+	data.network = &network_data;
+	retval = connection_migrate(connection, network);
+	CHECK(retval == 0);
+	retval = network_rebalance(&network, 1, 1);
+	CHECK(retval == 0);
+}
+
+TEST(ConnectionTests, Test6)
+{
+	int32_t retval, fds[2];
+	network_data_t network;
+	accept_counter_t *counter = (accept_counter_t *)malloc(sizeof(accept_counter_t));
+	connection_data_t data;
+	connection_t connection = (connection_t)&data;
+	memset(&network, 0, sizeof(network));
+	memset(counter, 0, sizeof(accept_counter_t));
+	memset(&data, 0, sizeof(data));
+	retval = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	CHECK(retval == 0);
+	/* Shared with a listener whose network is gone */
+	counter->refs = 2;
+	counter->count = 1;
+	network.num_accepted = 1;
+	data.counter = counter;
+	data.accounted = &network;
+	data.socket_fd = fds[0];
+	/* Closing leaves the count of the network serving it */
+	retval = connection_close(connection);
+	CHECK(retval == 0);
+	CHECK(network.num_accepted == 0);
+	CHECK(data.accounted == NULL);
+	CHECK(counter->count == 0);
+	CHECK(counter->refs == 1);
+	free(counter);
+	close(fds[1]);
+}
+
+TEST(ConnectionTests, Test7)
+{
+	int32_t retval;
+	connection_t connection;
+	connection_attr_t attr;
+	connection_event_t event;
+	uint8_t buffer[4] = {0};
+	memset(&attr, 0, sizeof(attr));
+	retval = connection_adopt(&connection, &attr, -1);
+	CHECK(retval == -1);
+	retval = connection_export(0, NULL, 0);
+	CHECK(retval == 0);
+	memset(&event, 0, sizeof(event));
+	event.data_buffer = buffer;
+	event.data_len = sizeof(buffer);
+	retval = connection_import(&event, &attr, &connection, 1);
+	CHECK(retval == -1);
+}
+
+TEST(ConnectionTests, Test8)
+{
+	ssize_t retval;
+	off_t offset = 0;
+	connection_data_t data;
+	memset(&data, 0, sizeof(data));
+	connection_t connection = (connection_t)&data;
+	data.socket_fd = -1;
+	CHECK(connection_tls_offload(connection) == -1);
+	retval = connection_sendfile(connection, -1, &offset, 1);
+	CHECK(retval == -1);
+	CHECK(offset == 0);
+}
+
+TEST(ConnectionTests, Test9)
+{
+	int32_t retval;
+	connection_t connection;
+	connection_attr_t attr;
+	memset(&attr, 0, sizeof(connection_attr_t));
+	attr.mode = connection_mode_server;
+	retval = connection_create_send(&connection, &attr, "a", 1);
+	CHECK(retval == -1);
+	attr.mode = connection_mode_client;
+	attr.tls_context = &attr;
+	retval = connection_create_send(&connection, &attr, "a", 1);
+	CHECK(retval == -1);
+	attr.tls_context = NULL;
+	attr.sockopts.nodelay = 1;
+	retval = connection_create_send(&connection, &attr, "a", 1);
+	CHECK(retval == -1);
+}
+
+TEST(ConnectionTests, Test10)
+{
+	int32_t retval;
+	connection_t connection;
+	connection_attr_t attr;
+	connection_data_t data;
+	network_data_t network_data;
+	memset(&data, 0, sizeof(data));
+	memset(&network_data, 0, sizeof(network_data));
+	connection = (connection_t)&data;
+	retval = connection_consume(connection, 0);
+	CHECK(retval == -1);
+	/* A ring of a connection without a network */
+	uint8_t ring[4];
+	data.ring.base = ring;
+	data.ring.size = data.ring.len = sizeof(ring);
+	retval = connection_consume(connection, 1);
+	CHECK(retval == -1);
+	CHECK(data.ring.len == sizeof(ring));
+	data.network = &network_data;
+	retval = connection_consume(connection, 1);
+	CHECK(retval == 0);
+	CHECK(data.ring.len == sizeof(ring) - 1);
+	network_t network = (network_t)&network_data;
+	network_data.epoll_fd = -1;
+	memset(&attr, 0, sizeof(attr));
+	attr.network = &network;
+	attr.mode = connection_mode_client;
+	attr.hints.ai_family = AF_INET6;
+	attr.hints.ai_socktype = SOCK_DGRAM;
+	strcpy(attr.hostname, "::1");
+	strcpy(attr.service, "21537");
+	attr.ring.size = 4096;
+	retval = connection_create(&connection, &attr);
+	CHECK(retval == -1);
+}
+
+TEST(ConnectionTests, Test11)
+{
+	int32_t retval;
+	connection_t connection;
+	connection_attr_t attr;
+	connection_data_t data;
+	memset(&data, 0, sizeof(data));
+	connection = (connection_t)&data;
+	retval = connection_set_priority(connection, (connection_priority_e)CONNECTION_PRIORITIES);
+	CHECK(retval == -1);
+	retval = connection_set_priority(connection, connection_priority_high);
+	CHECK(retval == 0);
+	CHECK(data.priority == connection_priority_high);
+	memset(&attr, 0, sizeof(attr));
+	attr.mode = connection_mode_server;
+	attr.priority = (connection_priority_e)CONNECTION_PRIORITIES;
+	retval = connection_adopt(&connection, &attr, -1);
+	CHECK(retval == -1);
+}
+
+TEST(ConnectionTests, Test12)
+{
+	int32_t retval, fd;
+	network_t network = 0;
+	connection_t connection;
+	connection_attr_t attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.network = &network;
+	attr.mode = connection_mode_client;
+	attr.timestamping = CONNECTION_TIMESTAMP_TX_ACK << 1;
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	CHECK(fd != -1);
+	retval = connection_adopt(&connection, &attr, fd);
+	CHECK(retval == -1);
+	close(fd);
+}
+
+TEST(ConnectionTests, Test13)
+{
+	int32_t retval;
+	size_t len = 0;
+	connection_t connection;
+	connection_data_t data;
+	network_buffer_t buffer;
+	buffer_data_t *ptr = (buffer_data_t *)malloc(sizeof(buffer_data_t) + 4);
+	memset(ptr, 0, sizeof(buffer_data_t));
+	ptr->data = (uint8_t *)(ptr + 1);
+	ptr->len = 4;
+	ptr->refs = 1;
+	buffer = (network_buffer_t)ptr;
+	CHECK(network_buffer_data(buffer, &len) == ptr->data);
+	CHECK(len == 4);
+	memset(&data, 0, sizeof(data));
+	connection = (connection_t)&data;
+	retval = connection_send_buffers(connection, &buffer, 1);
+	CHECK(retval == -1);
+	CHECK(data.send_queue.len == 0);
+	retval = network_buffer_ref(buffer);
+	CHECK(retval == 0);
+	CHECK(ptr->refs == 2);
+	network_buffer_unref(buffer);
+	CHECK(ptr->refs == 1);
+	/* Without a pool the last reference frees it */
+	network_buffer_unref(buffer);
+}
+
+TEST(ConnectionTests, Test14)
+{
+	int32_t retval, fd;
+	network_t network = 0;
+	connection_t connection;
+	connection_attr_t attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.network = &network;
+	attr.mode = connection_mode_client;
+	attr.backlog.max_bytes = 1024;
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	CHECK(fd != -1);
+	retval = connection_adopt(&connection, &attr, fd);
+	CHECK(retval == -1);
+	close(fd);
+	/* A buffer of the heap when there is no pool */
+	network_buffer_t buffer;
+	size_t len = 0;
+	retval = network_buffer_create(0, "data", 4, &buffer);
+	CHECK(retval == 0);
+	CHECK(memcmp(network_buffer_data(buffer, &len), "data", 4) == 0);
+	CHECK(len == 4);
+	network_buffer_unref(buffer);
+}
+
+TEST(ConnectionTests, Test15)
+{
+	int32_t retval;
+	network_data_t network;
+	connection_data_t data;
+	connection_t connection;
+	connection_attr_t attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.mode = connection_mode_server;
+	retval = connection_pool_acquire(&connection, &attr);
+	CHECK(retval == -1);
+	/* Only connections of connection_pool_acquire() go back, and only once */
+	memset(&network, 0, sizeof(network));
+	memset(&data, 0, sizeof(data));
+	data.network = &network;
+	data.socket_fd = -1;
+	retval = connection_pool_release((connection_t)&data);
+	CHECK(retval == -1);
+	data.pool_key = (char *)"::1";
+	data.pool_idle = 1;
+	retval = connection_pool_release((connection_t)&data);
+	CHECK(retval == -1);
+}
+
+TEST(ConnectionTests, Test16)
+{
+	int32_t retval;
+	network_data_t network;
+	connection_data_t data;
+	memset(&network, 0, sizeof(network));
+	memset(&data, 0, sizeof(data));
+	connection_t connection = (connection_t)&data;
+	retval = connection_offload(connection, 0);
+	CHECK(retval == -1);
+	/* Workers are created with the loop */
+	data.network = &network;
+	network.attr.offload.num_workers = 1;
+	retval = connection_offload(connection, 0);
+	CHECK(retval == -1);
+	CHECK(data.work_pending == 0);
+}
+
+TEST(ConnectionTests, Test17)
+{
+	int32_t retval;
+	connection_t connection;
+	connection_attr_t attr;
+	network_data_t data;
+	memset(&data, 0, sizeof(data));
+	network_t network = (network_t)&data;
+	data.epoll_fd = -1;
+	memset(&attr, 0, sizeof(attr));
+	attr.network = &network;
+	attr.mode = connection_mode_client;
+	attr.hints.ai_family = AF_INET6;
+	attr.hints.ai_socktype = SOCK_DGRAM;
+	strcpy(attr.hostname, "::1");
+	strcpy(attr.service, "21537");
+	attr.udp_flows = 1;
+	/* Only a UDP listener spawns sockets per peer */
+	retval = connection_create(&connection, &attr);
+	CHECK(retval == -1);
+	attr.mode = connection_mode_server;
+	attr.hints.ai_socktype = SOCK_STREAM;
+	retval = connection_create(&connection, &attr);
+	CHECK(retval == -1);
+}
+
+TEST(ConnectionTests, Test18)
+{
+	int32_t retval, fds[2];
+	char buf[16];
+	network_data_t network;
+	connection_data_t *data = (connection_data_t *)malloc(sizeof(connection_data_t));
+	connection_t connection = (connection_t)data;
+	memset(&network, 0, sizeof(network));
+	memset(data, 0, sizeof(connection_data_t));
+	retval = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	CHECK(retval == 0);
+	data->socket_fd = fds[0];
+	data->network = &network;
+	data->auto_cork = 1;
+	/* Staged while the callbacks of the batch run on the loop */
+	network.batching = 1;
+	network.loop_thread = pthread_self();
+	CHECK(connection_send(connection, "head", 4) == 4);
+	CHECK(connection_send(connection, "body", 4) == 4);
+	CHECK(recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT) == -1);
+	CHECK(network.flushed == data);
+	/* Closing writes the staged data first */
+	retval = connection_close(connection);
+	CHECK(retval == 0);
+	CHECK(recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT) == 8);
+	CHECK(memcmp(buf, "headbody", 8) == 0);
+	CHECK(network.flushed == NULL);
+	connection_free(connection);
+	close(fds[1]);
+}
+
+TEST(ConnectionTests, Test19)
+{
+	int32_t retval, fd;
+	socklen_t len = sizeof(sockaddr_in);
+	sockaddr_in addr;
+	network_data_t network;
+	network_info_t info;
+	connection_info_t sample;
+	connection_data_t data;
+	connection_t connection = (connection_t)&data;
+	memset(&network, 0, sizeof(network));
+	memset(&data, 0, sizeof(data));
+	data.network = &network;
+	data.data_type = data_type_connection;
+	data.mode = connection_mode_client;
+	data.socktype = SOCK_DGRAM;
+	data.family = AF_INET;
+	data.socket_fd = -1;
+	retval = connection_get_info(connection, &sample);
+	CHECK(retval == -1);
+	/* A TCP connection without a sample is sampled on the call */
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	CHECK(fd != -1);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	CHECK(bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0);
+	CHECK(listen(fd, 1) == 0);
+	CHECK(getsockname(fd, (sockaddr *)&addr, &len) == 0);
+	data.socktype = SOCK_STREAM;
+	data.socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+	CHECK(connect(data.socket_fd, (sockaddr *)&addr, sizeof(addr)) == 0);
+	retval = connection_get_info(connection, &sample);
+	CHECK(retval == 0);
+	CHECK(sample.sampled_at != 0);
+	retval = network_get_info((network_t)&network, &info);
+	CHECK(retval == 0);
+	CHECK(info.num_sampled == 1);
+	/* Closed connections leave the sums */
+	retval = connection_close(connection);
+	CHECK(retval == 0);
+	retval = network_get_info((network_t)&network, &info);
+	CHECK(retval == 0);
+	CHECK(info.num_sampled == 0);
+	close(fd);
+}
+
+TEST(ConnectionTests, Test20)
+{
+	int32_t retval, fds[2], size = 4096;
+	size_t len = 256 * 1024, total = 0;
+	uint8_t *big = (uint8_t *)calloc(1, len);
+	uint8_t buf[4096], last = 0;
+	ssize_t s;
+	network_data_t network;
+	network_buffer_t buffer;
+	connection_data_t data;
+	connection_t connection = (connection_t)&data;
+	memset(&network, 0, sizeof(network));
+	memset(&data, 0, sizeof(data));
+	retval = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	CHECK(retval == 0);
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	data.socket_fd = fds[0];
+	data.network = &network;
+	data.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	network.loop_thread = pthread_self();
+	retval = network_buffer_create(0, big, len, &buffer);
+	CHECK(retval == 0);
+	retval = connection_send_buffers(connection, &buffer, 1);
+	CHECK(retval == 0);
+	CHECK(data.send_queue.len == 1);
+	/* Nothing overtakes the queued buffer */
+	CHECK(connection_send(connection, "Z", 1) == -1);
+	CHECK(errno == EAGAIN);
+
+	while (connection_send(connection, "Z", 1) == -1) {
+		CHECK(errno == EAGAIN);
+		s = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+		total += s > 0 ? s : 0;
+	}
+
+	while ((s = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		total += s;
+		last = buf[s - 1];
+	}
+
+	CHECK(total == len + 1);
+	CHECK(last == 'Z');
+	network_buffer_unref(buffer);
+	connection_close(connection);
+	close(fds[1]);
+	free(big);
+}
+
+TEST(ConnectionTests, Test21)
+{
+	int32_t retval, fds[2], size = 4096;
+	size_t len = 256 * 1024;
+	uint8_t *big = (uint8_t *)calloc(1, len);
+	network_data_t network;
+	network_buffer_t buffer;
+	connection_data_t *data = (connection_data_t *)malloc(sizeof(connection_data_t));
+	connection_t connection = (connection_t)data;
+	memset(&network, 0, sizeof(network));
+	memset(data, 0, sizeof(connection_data_t));
+	retval = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	CHECK(retval == 0);
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	data->socket_fd = fds[0];
+	data->network = &network;
+	data->events = EPOLLIN | EPOLLOUT | EPOLLET;
+	network.loop_thread = pthread_self();
+	retval = network_buffer_create(0, big, len, &buffer);
+	CHECK(retval == 0);
+	retval = connection_send_buffers(connection, &buffer, 1);
+	CHECK(retval == 0);
+	network_buffer_unref(buffer);
+	/* The loop keeps the socket open for the queued data */
+	retval = connection_close(connection);
+	CHECK(retval == 0);
+	CHECK(data->lingering == 1);
+	CHECK(data->socket_fd == fds[0]);
+	retval = connection_free(connection);
+	CHECK(retval == 0);
+	CHECK(data->orphaned == 1);
+	/* Without the loop the rest is dropped and reported */
+	data->lingering = data->orphaned = 0;
+	data->network = NULL;
+	retval = connection_close(connection);
+	CHECK(retval == -1);
+	CHECK(errno == ENOBUFS);
+	CHECK(data->socket_fd == -1);
+	connection_free(connection);
+	close(fds[1]);
+	free(big);
+}
+
 TEST_GROUP(NetworkTimerTests)
 {
 };
@@ -173,6 +711,60 @@ TEST(NetworkTimerTests, Test3)
 	CHECK(retval == -1);
 }
 
+struct CountingHandler : ebnlib::handler {
+	int32_t data;
+	int32_t closed;
+	int32_t timers;
+	CountingHandler() : data(0), closed(0), timers(0) {}
+	void on_data(ebnlib::connection_ref, const connection_event_t &) { ++data; }
+	void on_close(ebnlib::connection_ref, const connection_event_t &) { ++closed; }
+	void on_timer(ebnlib::timer_ref, const network_timer_event_t &) { ++timers; }
+};
+
+TEST_GROUP(WrapperTests)
+{
+};
+
+TEST(WrapperTests, Test1)
+{
+	CountingHandler handler;
+	connection_event_t event;
+	network_timer_event_t timer_event;
+	user_data_t user_data;
+	memset(&event, 0, sizeof(event));
+	memset(&timer_event, 0, sizeof(timer_event));
+	user_data.ptr = &handler;
+	event.event_type = connection_event_data_received;
+	ebnlib::network<CountingHandler>::dispatch(0, &event, user_data);
+	event.event_type = connection_event_connection_closed;
+	ebnlib::network<CountingHandler>::dispatch(0, &event, user_data);
+	event.event_type = connection_event_connection_error;
+	ebnlib::network<CountingHandler>::dispatch(0, &event, user_data);
+	ebnlib::network<CountingHandler>::dispatch_timer(0, &timer_event, user_data);
+	CHECK(handler.data == 1);
+	CHECK(handler.closed == 1);
+	CHECK(handler.timers == 1);
+}
+
+TEST(WrapperTests, Test2)
+{
+	CountingHandler handler;
+	network_attr_t attr;
+	bool thrown = false;
+	memset(&attr, 0, sizeof(attr));
+
+	try {
+		ebnlib::network<CountingHandler> network(handler, attr);
+	} catch (const std::system_error &) {
+		thrown = true;
+	}
+
+	CHECK(thrown);
+	ebnlib::connection connection;
+	CHECK(!connection);
+	CHECK(connection.release() == 0);
+}
+
 int main(int argc, char **argv)
 {
 	return CommandLineTestRunner::RunAllTests(argc, argv);
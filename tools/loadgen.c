@@ -0,0 +1,657 @@
+/*
+ * Copyright (c) 2016 Jani Pellikka <jpellikk@users.noreply.github.com>
+ *
+ * Open-loop load generator for echo servers. Requests go out on a fixed
+ * schedule whatever the responses do, and latency is measured from the
+ * time each request was due rather than from when it was written. A
+ * stalled server therefore shows up in the percentiles instead of quietly
+ * lowering the offered load (coordinated omission).
+ */
+#include "ebnlib.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/resource.h>
+
+/* 2048 sub-buckets per power of two keep three significant digits */
+#define HISTOGRAM_SUB_BITS 11
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_SUB_HALF (HISTOGRAM_SUB_COUNT / 2)
+/* Latencies up to 2^43 ns (about 2.4 hours) */
+#define HISTOGRAM_MAX_BITS 43
+#define HISTOGRAM_BUCKETS (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1)
+#define HISTOGRAM_COUNTS ((HISTOGRAM_BUCKETS + 1) * HISTOGRAM_SUB_HALF)
+/* Percentile levels reported per halving of the distance to 100% */
+#define HISTOGRAM_TICKS 5
+
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_MSEC 1000000ULL
+
+struct histogram_t {
+	uint64_t counts[HISTOGRAM_COUNTS];
+	uint64_t total;
+	uint64_t max;
+	double sum;
+	double sum_sq;
+};
+
+struct loadgen_conn_t {
+	connection_t connection;
+	uint8_t connected;
+	uint8_t failed;
+	/* Intended send times of the requests in flight, oldest first */
+	uint64_t *intended;
+	size_t capacity;
+	size_t head;
+	size_t count;
+	/* Requests due but not written yet, and the progress of the first */
+	size_t unsent;
+	size_t offset;
+	/* Bytes received towards the next response */
+	size_t received;
+};
+
+struct loadgen_worker_t {
+	network_t network;
+	network_timer_t timer;
+	struct loadgen_conn_t *conns;
+	size_t num_conns;
+	size_t next_conn;
+	uint32_t num_connected;
+	uint32_t num_failed;
+	/* Request k is due at start + k * period */
+	uint64_t start;
+	uint64_t end;
+	double period;
+	uint64_t scheduled;
+	uint64_t completed;
+	uint64_t errors;
+	struct histogram_t histogram;
+	uint8_t buffer[65536];
+};
+
+static struct loadgen_worker_t *workers;
+static uint32_t num_workers = 1;
+static uint32_t num_conns = 100;
+static double rate = 1000.0;
+static uint32_t duration = 10;
+static size_t message_len = 64;
+static uint8_t *payload;
+static const char *output;
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data);
+static void timer_callback(network_timer_t timer, const struct network_timer_event_t *event, user_data_t network_user_data);
+
+static uint64_t time_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+static size_t histogram_index(uint64_t value)
+{
+	/* Bucket 0 holds 0..2047 linearly; bucket b the half above 2^(b+10) */
+	uint32_t bucket = 63 - __builtin_clzll(value | (HISTOGRAM_SUB_COUNT - 1)) -
+	                  (HISTOGRAM_SUB_BITS - 1);
+	return ((size_t)bucket << (HISTOGRAM_SUB_BITS - 1)) + (size_t)(value >> bucket);
+}
+
+static uint64_t histogram_value(size_t index)
+{
+	uint64_t sub = index;
+	uint32_t bucket = 0;
+
+	if (index >= HISTOGRAM_SUB_COUNT) {
+		bucket = (uint32_t)(index >> (HISTOGRAM_SUB_BITS - 1)) - 1;
+		sub = (index & (HISTOGRAM_SUB_HALF - 1)) + HISTOGRAM_SUB_HALF;
+	}
+
+	/* The highest value counted at the index */
+	return ((sub + 1) << bucket) - 1;
+}
+
+static void histogram_record(struct histogram_t *histogram, uint64_t value)
+{
+	if (value >= (1ULL << HISTOGRAM_MAX_BITS)) {
+		value = (1ULL << HISTOGRAM_MAX_BITS) - 1;
+	}
+
+	histogram->counts[histogram_index(value)]++;
+	histogram->total++;
+	histogram->sum += (double)value;
+	histogram->sum_sq += (double)value * value;
+
+	if (value > histogram->max) {
+		histogram->max = value;
+	}
+}
+
+static void histogram_merge(struct histogram_t *to, const struct histogram_t *from)
+{
+	size_t i;
+
+	for (i = 0; i < HISTOGRAM_COUNTS; ++i) {
+		to->counts[i] += from->counts[i];
+	}
+
+	to->total += from->total;
+	to->sum += from->sum;
+	to->sum_sq += from->sum_sq;
+
+	if (from->max > to->max) {
+		to->max = from->max;
+	}
+}
+
+static uint64_t histogram_percentile(const struct histogram_t *histogram, double quantile,
+                                     uint64_t *count)
+{
+	uint64_t target = (uint64_t)ceil(quantile * histogram->total);
+	uint64_t total = 0;
+	size_t i;
+
+	if (target == 0) {
+		target = 1;
+	}
+
+	for (i = 0; i < HISTOGRAM_COUNTS; ++i) {
+		total += histogram->counts[i];
+
+		if (total >= target) {
+			break;
+		}
+	}
+
+	*count = total;
+
+	/* The bucket of the maximum reaches past it */
+	if (i == HISTOGRAM_COUNTS || histogram_value(i) > histogram->max) {
+		return histogram->max;
+	}
+
+	return histogram_value(i);
+}
+
+/* Percentile distribution in the HdrHistogram text format, in milliseconds */
+static void histogram_print(const struct histogram_t *histogram, FILE *file)
+{
+	double mean = 0.0, deviation = 0.0;
+	uint64_t value, count;
+	uint32_t tick;
+
+	fprintf(file, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+
+	for (tick = 0; histogram->total > 0; ++tick) {
+		double quantile = 1.0 - pow(0.5, (double)tick / HISTOGRAM_TICKS);
+		value = histogram_percentile(histogram, quantile, &count);
+
+		if (count == histogram->total) {
+			fprintf(file, "%12.3f %14.12f %10lu\n", (double)histogram->max / NSEC_PER_MSEC,
+			        1.0, (unsigned long)count);
+			break;
+		}
+
+		fprintf(file, "%12.3f %14.12f %10lu %14.2f\n", (double)value / NSEC_PER_MSEC,
+		        quantile, (unsigned long)count, 1.0 / (1.0 - quantile));
+	}
+
+	if (histogram->total > 0) {
+		mean = histogram->sum / histogram->total;
+		deviation = sqrt(fmax(histogram->sum_sq / histogram->total - mean * mean, 0.0));
+	}
+
+	fprintf(file, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+	        mean / NSEC_PER_MSEC, deviation / NSEC_PER_MSEC);
+	fprintf(file, "#[Max     = %12.3f, Total count    = %12lu]\n",
+	        (double)histogram->max / NSEC_PER_MSEC, (unsigned long)histogram->total);
+	fprintf(file, "#[Buckets = %12d, SubBuckets     = %12d]\n",
+	        HISTOGRAM_BUCKETS, HISTOGRAM_SUB_COUNT);
+}
+
+static void conn_fail(struct loadgen_worker_t *worker, struct loadgen_conn_t *conn)
+{
+	if (conn->failed) {
+		return;
+	}
+
+	/* The requests in flight will never complete */
+	conn->failed = 1;
+	__atomic_add_fetch(&worker->errors, conn->count, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&worker->num_failed, 1, __ATOMIC_RELAXED);
+	conn->count = conn->unsent = 0;
+}
+
+static void conn_flush(struct loadgen_worker_t *worker, struct loadgen_conn_t *conn)
+{
+	if (!conn->connected || conn->failed) {
+		return;
+	}
+
+	while (conn->unsent > 0) {
+		ssize_t count = connection_send(conn->connection, payload + conn->offset,
+		                                message_len - conn->offset);
+
+		if (count == -1) {
+			/* Behind schedule; the latency keeps counting from the due time */
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				connection_want_write(conn->connection);
+			} else {
+				conn_fail(worker, conn);
+			}
+
+			return;
+		}
+
+		conn->offset += count;
+
+		if (conn->offset == message_len) {
+			conn->offset = 0;
+			conn->unsent--;
+		}
+	}
+}
+
+static int32_t conn_push(struct loadgen_conn_t *conn, uint64_t intended)
+{
+	/* Requests pipeline without bound; grow rather than drop them */
+	if (conn->count == conn->capacity) {
+		size_t i, capacity = conn->capacity ? conn->capacity * 2 : 16;
+		uint64_t *intended_new = malloc(capacity * sizeof(*intended_new));
+
+		if (intended_new == NULL) {
+			perror("malloc()");
+			return -1;
+		}
+
+		for (i = 0; i < conn->count; ++i) {
+			intended_new[i] = conn->intended[(conn->head + i) % conn->capacity];
+		}
+
+		free(conn->intended);
+		conn->intended = intended_new;
+		conn->capacity = capacity;
+		conn->head = 0;
+	}
+
+	conn->intended[(conn->head + conn->count) % conn->capacity] = intended;
+	conn->count++;
+	return 0;
+}
+
+static void conn_receive(struct loadgen_worker_t *worker, struct loadgen_conn_t *conn, size_t len)
+{
+	uint64_t now = time_now();
+	conn->received += len;
+
+	/* The echo returns the requests in order */
+	while (conn->received >= message_len && conn->count > 0) {
+		histogram_record(&worker->histogram, now - conn->intended[conn->head]);
+		conn->head = (conn->head + 1) % conn->capacity;
+		conn->count--;
+		conn->received -= message_len;
+		__atomic_add_fetch(&worker->completed, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static struct loadgen_conn_t *worker_next_conn(struct loadgen_worker_t *worker)
+{
+	size_t i;
+
+	for (i = 0; i < worker->num_conns; ++i) {
+		struct loadgen_conn_t *conn = &worker->conns[worker->next_conn];
+		worker->next_conn = (worker->next_conn + 1) % worker->num_conns;
+
+		if (!conn->failed) {
+			return conn;
+		}
+	}
+
+	return NULL;
+}
+
+static void timer_callback(network_timer_t timer, const struct network_timer_event_t *event, user_data_t network_user_data)
+{
+	struct loadgen_worker_t *worker = network_user_data.ptr;
+	uint64_t now = time_now();
+	(void)event;
+
+	/* Everything due by now, each request stamped with its own due time */
+	while (1) {
+		uint64_t intended = worker->start + (uint64_t)(worker->scheduled * worker->period);
+		struct loadgen_conn_t *conn;
+
+		if (intended > now || intended >= worker->end) {
+			break;
+		}
+
+		conn = worker_next_conn(worker);
+
+		if (conn == NULL || conn_push(conn, intended) == -1) {
+			__atomic_add_fetch(&worker->errors, 1, __ATOMIC_RELAXED);
+		} else {
+			conn->unsent++;
+			conn_flush(worker, conn);
+		}
+
+		__atomic_add_fetch(&worker->scheduled, 1, __ATOMIC_RELAXED);
+	}
+
+	if (now >= worker->end) {
+		network_timer_cancel(timer);
+	}
+}
+
+static void event_callback(connection_t connection, const struct connection_event_t *event, user_data_t network_user_data)
+{
+	struct loadgen_worker_t *worker = network_user_data.ptr;
+	struct loadgen_conn_t *conn = event->user_data.ptr;
+	(void)connection;
+
+	switch (event->event_type) {
+		case connection_event_connection_created:
+			conn->connected = 1;
+			__atomic_add_fetch(&worker->num_connected, 1, __ATOMIC_RELAXED);
+			conn_flush(worker, conn);
+			break;
+
+		case connection_event_data_received:
+			conn_receive(worker, conn, event->data_len);
+			break;
+
+		case connection_event_connection_writable:
+			conn_flush(worker, conn);
+			break;
+
+		case connection_event_connection_closed:
+		case connection_event_connection_error:
+			conn_fail(worker, conn);
+			break;
+
+		default:
+			break;
+	};
+}
+
+static int32_t worker_create(struct loadgen_worker_t *worker, size_t num_worker_conns,
+                             const char *hostname, const char *service)
+{
+	struct network_timer_attr_t timer_attr;
+	struct connection_attr_t attr;
+	struct network_attr_t network_attr;
+	size_t i;
+
+	memset(&network_attr, 0, sizeof(network_attr));
+	network_attr.mode = network_mode_thread;
+	network_attr.connection_event_cb = event_callback;
+	network_attr.timer_event_cb = timer_callback;
+	network_attr.data_buffer = worker->buffer;
+	network_attr.buffer_len = sizeof(worker->buffer);
+	network_attr.user_data.ptr = worker;
+
+	if (network_create(&worker->network, &network_attr) == -1) {
+		return -1;
+	}
+
+	memset(&timer_attr, 0, sizeof(timer_attr));
+	timer_attr.network = &worker->network;
+	timer_attr.type = network_timer_type_periodic;
+
+	if (network_timer_create(&worker->timer, &timer_attr) == -1) {
+		return -1;
+	}
+
+	worker->conns = calloc(num_worker_conns, sizeof(*worker->conns));
+
+	if (worker->conns == NULL) {
+		perror("calloc()");
+		return -1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.network = &worker->network;
+	attr.hints.ai_family = AF_UNSPEC;
+	attr.hints.ai_socktype = SOCK_STREAM;
+	attr.hints.ai_protocol = IPPROTO_TCP;
+	attr.mode = connection_mode_client;
+	attr.sockopts.nodelay = 1;
+	snprintf(attr.hostname, sizeof(attr.hostname), "%s", hostname);
+	snprintf(attr.service, sizeof(attr.service), "%s", service);
+
+	for (i = 0; i < num_worker_conns; ++i) {
+		attr.user_data.ptr = &worker->conns[i];
+
+		if (connection_create(&worker->conns[i].connection, &attr) == -1) {
+			return -1;
+		}
+
+		worker->num_conns++;
+	}
+
+	return 0;
+}
+
+static void worker_free(struct loadgen_worker_t *worker)
+{
+	size_t i;
+
+	for (i = 0; i < worker->num_conns; ++i) {
+		connection_close(worker->conns[i].connection);
+		connection_free(worker->conns[i].connection);
+		free(worker->conns[i].intended);
+	}
+
+	free(worker->conns);
+
+	if (worker->timer) {
+		network_timer_free(worker->timer);
+	}
+
+	if (worker->network) {
+		network_free(worker->network);
+	}
+}
+
+/* Read from the main thread while the loops run */
+static void workers_requests(uint64_t *scheduled, uint64_t *completed, uint64_t *errors)
+{
+	uint32_t i;
+	*scheduled = *completed = *errors = 0;
+
+	for (i = 0; i < num_workers; ++i) {
+		*scheduled += __atomic_load_n(&workers[i].scheduled, __ATOMIC_RELAXED);
+		*completed += __atomic_load_n(&workers[i].completed, __ATOMIC_RELAXED);
+		*errors += __atomic_load_n(&workers[i].errors, __ATOMIC_RELAXED);
+	}
+}
+
+static void workers_connections(uint32_t *connected, uint32_t *failed)
+{
+	uint32_t i;
+	*connected = *failed = 0;
+
+	for (i = 0; i < num_workers; ++i) {
+		*connected += __atomic_load_n(&workers[i].num_connected, __ATOMIC_RELAXED);
+		*failed += __atomic_load_n(&workers[i].num_failed, __ATOMIC_RELAXED);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+	        "Usage: %s [options] hostname service\n"
+	        "  -c connections  connections in total (default 100)\n"
+	        "  -r rate         requests per second in total (default 1000)\n"
+	        "  -d seconds      duration of the schedule (default 10)\n"
+	        "  -s bytes        request size; the server echoes it (default 64)\n"
+	        "  -t threads      event loops sharing the load (default 1)\n"
+	        "  -o file         write the percentile distribution (.hgrm) to a file\n",
+	        name);
+}
+
+static void terminate(int retval)
+{
+	uint32_t i;
+
+	for (i = 0; workers != NULL && i < num_workers; ++i) {
+		worker_free(&workers[i]);
+	}
+
+	free(workers);
+	free(payload);
+	exit(retval);
+}
+
+int main(int argc, char **argv)
+{
+	struct histogram_t *histogram;
+	struct timespec interval;
+	struct rlimit limit;
+	uint64_t start, tick, deadline, scheduled, completed, errors;
+	uint32_t i, connected, failed;
+	FILE *file;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:r:d:s:t:o:")) != -1) {
+		switch (opt) {
+			case 'c': num_conns = (uint32_t)strtoul(optarg, NULL, 10); break;
+			case 'r': rate = strtod(optarg, NULL); break;
+			case 'd': duration = (uint32_t)strtoul(optarg, NULL, 10); break;
+			case 's': message_len = strtoul(optarg, NULL, 10); break;
+			case 't': num_workers = (uint32_t)strtoul(optarg, NULL, 10); break;
+			case 'o': output = optarg; break;
+			default: usage(argv[0]); return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind != 2 || num_conns == 0 || num_workers == 0 ||
+	    num_workers > num_conns || rate <= 0.0 || message_len == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* A few descriptors per connection plus the loops */
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	/* Writes to a connection reset by the server must not kill the process */
+	if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+		perror("signal()");
+		return EXIT_FAILURE;
+	}
+
+	payload = malloc(message_len);
+	workers = calloc(num_workers, sizeof(*workers));
+	histogram = calloc(1, sizeof(*histogram));
+
+	if (payload == NULL || workers == NULL || histogram == NULL) {
+		perror("malloc()");
+		free(histogram);
+		terminate(EXIT_FAILURE);
+	}
+
+	memset(payload, 'x', message_len);
+
+	for (i = 0; i < num_workers; ++i) {
+		size_t share = num_conns / num_workers + (i < num_conns % num_workers);
+
+		if (worker_create(&workers[i], share, argv[optind], argv[optind + 1]) == -1) {
+			free(histogram);
+			terminate(EXIT_FAILURE);
+		}
+
+		if (network_start(workers[i].network) == -1) {
+			free(histogram);
+			terminate(EXIT_FAILURE);
+		}
+	}
+
+	/* The schedule starts once every connection is up or has failed */
+	deadline = time_now() + 10 * NSEC_PER_SEC;
+
+	do {
+		usleep(10000);
+		workers_connections(&connected, &failed);
+	} while (connected + failed < num_conns && time_now() < deadline);
+
+	fprintf(stdout, "Connections: open=%u, failed=%u\n", connected, failed);
+
+	/* Each loop takes an equal share of the rate, offset to interleave */
+	start = time_now() + 10 * NSEC_PER_MSEC;
+	tick = (uint64_t)(num_workers * NSEC_PER_SEC / rate);
+	tick = tick < NSEC_PER_MSEC ? (tick > 50000 ? tick : 50000) : NSEC_PER_MSEC;
+	interval.tv_sec = 0;
+	interval.tv_nsec = (long)tick;
+
+	for (i = 0; i < num_workers; ++i) {
+		workers[i].period = num_workers * (double)NSEC_PER_SEC / rate;
+		workers[i].start = start + (uint64_t)(i * workers[i].period / num_workers);
+		workers[i].end = start + (uint64_t)duration * NSEC_PER_SEC;
+
+		if (network_timer_start(workers[i].timer, &interval) == -1) {
+			free(histogram);
+			terminate(EXIT_FAILURE);
+		}
+	}
+
+	sleep(duration);
+
+	/* Give the requests in flight a grace period to complete */
+	deadline = time_now() + 5 * NSEC_PER_SEC;
+
+	do {
+		usleep(10000);
+		workers_requests(&scheduled, &completed, &errors);
+	} while (completed + errors < scheduled && time_now() < deadline);
+
+	for (i = 0; i < num_workers; ++i) {
+		network_stop(workers[i].network);
+		histogram_merge(histogram, &workers[i].histogram);
+	}
+
+	fprintf(stdout, "Requests: scheduled=%lu, completed=%lu, errors=%lu, incomplete=%lu\n",
+	        (unsigned long)scheduled, (unsigned long)completed, (unsigned long)errors,
+	        (unsigned long)(scheduled - completed - errors));
+	fprintf(stdout, "Rate: target=%.1f/s, achieved=%.1f/s\n", rate, (double)completed / duration);
+	fprintf(stdout, "Latency (ms) from the intended send time:\n");
+
+	if (histogram->total > 0) {
+		static const double quantiles[] = {0.5, 0.9, 0.99, 0.999, 0.9999};
+		uint64_t count;
+		size_t j;
+
+		for (j = 0; j < sizeof(quantiles) / sizeof(quantiles[0]); ++j) {
+			fprintf(stdout, "  p%-7g %10.3f\n", quantiles[j] * 100,
+			        (double)histogram_percentile(histogram, quantiles[j], &count) / NSEC_PER_MSEC);
+		}
+
+		fprintf(stdout, "  max      %10.3f\n", (double)histogram->max / NSEC_PER_MSEC);
+	}
+
+	file = output != NULL ? fopen(output, "w") : stdout;
+
+	if (file == NULL) {
+		perror("fopen()");
+	} else {
+		if (file == stdout) {
+			fprintf(file, "\n");
+		}
+
+		histogram_print(histogram, file);
+
+		if (file != stdout) {
+			fclose(file);
+		}
+	}
+
+	free(histogram);
+	terminate(errors == 0 && completed == scheduled ? EXIT_SUCCESS : EXIT_FAILURE);
+	return 0;
+}